@@ -10,7 +10,7 @@
 
 #include <squirrel.h>
 
-#define SQDBG_SV_API_VER 1
+#define SQDBG_SV_API_VER 2
 
 #ifndef SQDBG_API
 #ifdef SQDBG_DLL
@@ -55,10 +55,39 @@ SQDBG_API void sqdbg_destroy_debugger( HSQUIRRELVM vm );
 // Returns 0 on success
 SQDBG_API int sqdbg_listen_socket( HSQDEBUGSERVER dbg, unsigned short port );
 
+// Open a Unix domain socket at path and allow client connections
+// Not available on Windows
+// Returns 0 on success
+SQDBG_API int sqdbg_listen_unix( HSQDEBUGSERVER dbg, const char *path );
+
+// Create shared memory named name (starting with '/') for a local adapter
+// such as tools/sqdbgshm.cpp to connect through
+// Only available on Linux when compiled with SQDBG_NET_ENABLE_SHM
+// Returns 0 on success
+SQDBG_API int sqdbg_listen_shm( HSQDEBUGSERVER dbg, const char *name );
+
+// Connect a client through stdin and stdout
+// stdout is redirected to stderr to keep other output out of the messages
+// Not available on Windows
+// Returns 0 on success
+SQDBG_API int sqdbg_attach_stdio( HSQDEBUGSERVER dbg );
+
 // Process client connections and incoming messages
 // Blocks on script breakpoints while a client is connected
 SQDBG_API void sqdbg_frame( HSQDEBUGSERVER dbg );
 
+// Like sqdbg_frame(), but stops processing messages once max_us have passed.
+// At least one message is processed, the rest are processed on the next call.
+// Messages are not limited while suspended on a breakpoint
+// Returns 1 if messages were left for the next call
+SQDBG_API int sqdbg_frame_budget( HSQDEBUGSERVER dbg, int max_us );
+
+// Get the number of sqdbg_frame_budget() calls that processed messages, how many of
+// them left messages for the next call, and the longest time spent processing messages
+// in one call in microseconds. Counted for the lifetime of the debugger. Pointers can be NULL
+SQDBG_API void sqdbg_frame_budget_stats( HSQDEBUGSERVER dbg,
+		unsigned int *frames, unsigned int *hits, unsigned int *max_us );
+
 // Copies the script to be able to source it to debugger clients
 SQDBG_API void sqdbg_on_script_compile( HSQDEBUGSERVER dbg,
 		const SQChar *script, SQInteger scriptlen,
@@ -68,6 +97,32 @@ SQDBG_API void sqdbg_on_script_compile( HSQDEBUGSERVER dbg,
 // Returns 0 if there is no client connected
 SQDBG_API int sqdbg_is_client_connected( HSQDEBUGSERVER dbg );
 
+// Combine script output into a single output event until max_bytes are buffered,
+// the source line changes, or interval_ms passes. Buffered output is sent
+// from sqdbg_frame() every frame if interval_ms is 0. Pass 0 max_bytes to send
+// every print immediately
+// Returns 0 on success
+SQDBG_API int sqdbg_output_batching( HSQDEBUGSERVER dbg, int max_bytes, int interval_ms );
+
+// While suspended on a breakpoint, also process messages when fd becomes readable,
+// such as an eventfd or the read end of a pipe the host writes to from another thread.
+// The debugger reads from fd once to reset it. Pass -1 to unset
+// Not available on Windows
+// Returns 0 on success
+SQDBG_API int sqdbg_wakeup_fd( HSQDEBUGSERVER dbg, int fd );
+
+// Write every DAP message received and sent, with timestamps, to the file at path,
+// truncating it. Pass NULL path to stop. See tools/sqdbgreplay.cpp
+// Returns 0 on success
+SQDBG_API int sqdbg_record( HSQDEBUGSERVER dbg, const char *path );
+
+// Start the profiler and write the profiles of all threads to rotating files
+// in the existing directory dir every interval_ms, resetting them after each write.
+// Files are written from sqdbg_frame(). Pass NULL dir to stop, which also stops
+// the profiler if it was started by this and not by sqdbg_prof_start()
+// Returns 0 on success
+SQDBG_API int sqdbg_prof_continuous( HSQDEBUGSERVER dbg, const char *dir, int interval_ms );
+
 #ifdef __cplusplus
 }
 #endif
@@ -51,15 +51,35 @@ struct json_value_t
 struct json_field_t
 {
 	ostr_t key;
+	unsigned int hash;
 	json_value_t val;
 };
 
+// Tables with more fields than this are indexed by key hash
+#ifndef SQDBG_JSON_TABLE_INDEX_MIN
+#define SQDBG_JSON_TABLE_INDEX_MIN 8
+#endif
+
+// FNV-1a
+inline unsigned int JSONHashKey( const char *ptr, unsigned int len )
+{
+	unsigned int hash = 2166136261u;
+
+	for ( unsigned int i = 0; i < len; i++ )
+	{
+		hash ^= (unsigned char)ptr[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
 class json_array_t
 {
 public:
 	const char *m_pBase;
 	CScratch< true > *m_Allocator;
-	scratchindex_t *m_Elements;
+	json_value_t *m_Elements;
 	unsigned short m_nElementCount;
 	unsigned short m_nElementsSize;
 
@@ -77,19 +97,16 @@ public:
 		{
 			// doesn't free old ptr, this is an uncommon operation and extra allocation is fine
 			int oldsize = m_nElementsSize;
-			scratchindex_t *oldptr = m_Elements;
+			json_value_t *oldptr = m_Elements;
 
 			m_nElementsSize = !m_nElementsSize ? 8 : ( m_nElementsSize << 1 );
-			m_Elements = (scratchindex_t*)m_Allocator->Alloc( m_nElementsSize * sizeof(*m_Elements) );
+			m_Elements = (json_value_t*)m_Allocator->Alloc( m_nElementsSize * sizeof(*m_Elements) );
 
 			if ( oldsize )
 				memcpy( m_Elements, oldptr, oldsize * sizeof(*m_Elements) );
 		}
 
-		scratchindex_t index;
-		json_value_t *ret = (json_value_t*)m_Allocator->Alloc( sizeof(json_value_t), &index );
-		m_Elements[ m_nElementCount++ ] = index;
-		return ret;
+		return &m_Elements[ m_nElementCount++ ];
 	}
 
 	int Size() const
@@ -102,7 +119,7 @@ public:
 		Assert( m_nElementCount );
 		Assert( i >= 0 && i < m_nElementCount );
 
-		json_value_t *val = (json_value_t*)m_Allocator->Get( m_Elements[i] );
+		json_value_t *val = &m_Elements[i];
 
 		if ( val->type & JSON_STRING )
 		{
@@ -118,7 +135,7 @@ public:
 		Assert( m_nElementCount );
 		Assert( i >= 0 && i < m_nElementCount );
 
-		json_value_t *val = (json_value_t*)m_Allocator->Get( m_Elements[i] );
+		json_value_t *val = &m_Elements[i];
 
 		if ( val->type & JSON_TABLE )
 		{
@@ -135,7 +152,10 @@ class json_table_t
 public:
 	const char *m_pBase;
 	CScratch< true > *m_Allocator;
-	scratchindex_t *m_Elements;
+	json_field_t *m_Elements;
+	// Open addressed field indices + 1, NULL in small tables
+	unsigned short *m_pIndex;
+	unsigned int m_nIndexMask;
 	unsigned short m_nElementCount;
 	unsigned short m_nElementsSize;
 
@@ -143,17 +163,35 @@ public:
 	{
 		m_pBase = base;
 		m_Allocator = allocator;
+		m_pIndex = NULL;
+		m_nIndexMask = 0;
 		m_nElementCount = 0;
 		m_nElementsSize = 0;
 	}
 
 	json_value_t *Get( const string_t &key )
 	{
+		unsigned int hash = JSONHashKey( key.ptr, key.len );
+
+		if ( m_pIndex )
+		{
+			// Duplicate keys were inserted in order, the first one is found first
+			for ( unsigned int i = hash & m_nIndexMask; m_pIndex[i]; i = ( i + 1 ) & m_nIndexMask )
+			{
+				json_field_t *kv = &m_Elements[ m_pIndex[i] - 1 ];
+
+				if ( kv->hash == hash && key.IsEqualTo( m_pBase + kv->key.ofs, kv->key.len ) )
+					return &kv->val;
+			}
+
+			return NULL;
+		}
+
 		for ( int i = 0; i < m_nElementCount; i++ )
 		{
-			json_field_t *kv = (json_field_t*)m_Allocator->Get( m_Elements[i] );
+			json_field_t *kv = &m_Elements[i];
 
-			if ( key.IsEqualTo( m_pBase + kv->key.ofs, kv->key.len ) )
+			if ( kv->hash == hash && key.IsEqualTo( m_pBase + kv->key.ofs, kv->key.len ) )
 				return &kv->val;
 		}
 
@@ -170,19 +208,44 @@ public:
 		if ( m_nElementCount == m_nElementsSize )
 		{
 			int oldsize = m_nElementsSize;
-			scratchindex_t *oldptr = m_Elements;
+			json_field_t *oldptr = m_Elements;
 
 			m_nElementsSize = !m_nElementsSize ? 8 : ( m_nElementsSize << 1 );
-			m_Elements = (scratchindex_t*)m_Allocator->Alloc( m_nElementsSize * sizeof(*m_Elements) );
+			m_Elements = (json_field_t*)m_Allocator->Alloc( m_nElementsSize * sizeof(*m_Elements) );
 
 			if ( oldsize )
 				memcpy( m_Elements, oldptr, oldsize * sizeof(*m_Elements) );
 		}
 
-		scratchindex_t index;
-		json_field_t *ret = (json_field_t*)m_Allocator->Alloc( sizeof(json_field_t), &index );
-		m_Elements[ m_nElementCount++ ] = index;
-		return ret;
+		return &m_Elements[ m_nElementCount++ ];
+	}
+
+	// Called once all fields are parsed
+	void BuildIndex()
+	{
+		Assert( !m_pIndex );
+
+		if ( m_nElementCount <= SQDBG_JSON_TABLE_INDEX_MIN )
+			return;
+
+		// At most half full
+		unsigned int size = 16;
+		while ( size < (unsigned int)m_nElementCount * 2 )
+			size <<= 1;
+
+		m_pIndex = (unsigned short*)m_Allocator->Alloc( size * sizeof(*m_pIndex) );
+		memset( m_pIndex, 0, size * sizeof(*m_pIndex) );
+		m_nIndexMask = size - 1;
+
+		for ( int i = 0; i < m_nElementCount; i++ )
+		{
+			unsigned int slot = m_Elements[i].hash & m_nIndexMask;
+
+			while ( m_pIndex[slot] )
+				slot = ( slot + 1 ) & m_nIndexMask;
+
+			m_pIndex[slot] = (unsigned short)( i + 1 );
+		}
 	}
 
 	bool GetBool( const string_t &key, bool *out ) const
@@ -262,9 +325,169 @@ public:
 	bool Get( const string_t &key, json_array_t **out ) const { return GetArray( key, out ); }
 };
 
+// Returns the first quote or backslash in [ptr, end), or end
+inline char *JSONScanString( char *ptr, char *end )
+{
+#ifdef SQDBG_SSE2
+	const __m128i quote = _mm_set1_epi8( '\"' );
+	const __m128i backslash = _mm_set1_epi8( '\\' );
+
+	while ( end - ptr >= 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i*)ptr );
+		unsigned int mask = (unsigned int)_mm_movemask_epi8( _mm_or_si128(
+				_mm_cmpeq_epi8( v, quote ),
+				_mm_cmpeq_epi8( v, backslash ) ) );
+
+		if ( mask )
+			return ptr + ctz32( mask );
+
+		ptr += 16;
+	}
+#endif
+
+	while ( ptr < end && *ptr != '\"' && *ptr != '\\' )
+		ptr++;
+
+	return ptr;
+}
+
+// Unescapes [src, end) in place in a single pass, writes never pass reads.
+// Returns the new end
+inline char *JSONUnescape( char *src, char *end )
+{
+	char *dst = src;
+
+	for (;;)
+	{
+		char *next = JSONScanString( src, end );
+
+		if ( dst != src )
+			memmove( dst, src, next - src );
+
+		dst += next - src;
+		src = next;
+
+		if ( src >= end )
+			break;
+
+		Assert( src[0] == '\\' );
+
+		switch ( src[1] )
+		{
+			case '\\': *dst++ = '\\'; src += 2; break;
+			case '\"': *dst++ = '\"'; src += 2; break;
+			case '/': *dst++ = '/'; src += 2; break;
+			case 'b': *dst++ = '\b'; src += 2; break;
+			case 'f': *dst++ = '\f'; src += 2; break;
+			case 'n': *dst++ = '\n'; src += 2; break;
+			case 'r': *dst++ = '\r'; src += 2; break;
+			case 't': *dst++ = '\t'; src += 2; break;
+			// Not JSON, but written by PutStr
+			case 'a': *dst++ = '\a'; src += 2; break;
+			case 'v': *dst++ = '\v'; src += 2; break;
+			case 'u':
+			{
+				unsigned int val;
+				Verify( atox( { src + 2, 4 }, &val ) );
+
+				if ( val <= 0x7F )
+				{
+					*dst++ = (char)val;
+					src += 6;
+					break;
+				}
+				else if ( val <= 0x7FF )
+				{
+					UTF8_2_FROM_UTF32( (unsigned char*)dst, val );
+					dst += 2;
+					src += 6;
+					break;
+				}
+				else if ( UTF_SURROGATE(val) )
+				{
+					if ( UTF_SURROGATE_LEAD(val) )
+					{
+						if ( src + 11 < end &&
+								src[6] == '\\' && src[7] == 'u' &&
+								_isxdigit( src[8] ) && _isxdigit( src[9] ) &&
+								_isxdigit( src[10] ) && _isxdigit( src[11] ) )
+						{
+							unsigned int low;
+							Verify( atox( { src + 8, 4 }, &low ) );
+
+							if ( UTF_SURROGATE_TRAIL( low ) )
+							{
+								val = UTF32_FROM_UTF16_SURROGATE( val, low );
+								UTF8_4_FROM_UTF32( (unsigned char*)dst, val );
+								dst += 4;
+								src += 12;
+								break;
+							}
+						}
+					}
+				}
+
+				UTF8_3_FROM_UTF32( (unsigned char*)dst, val );
+				dst += 3;
+				src += 6;
+				break;
+			}
+			default: UNREACHABLE();
+		}
+	}
+
+	return dst;
+}
+
+// Returns the first char in [ptr, end) that is not printable ASCII or is a quote or backslash, or end
+inline const char *JSONScanEscapeScalar( const char *ptr, const char *end )
+{
+	while ( ptr < end && IN_RANGE_CHAR( *ptr, 0x20, 0x7E ) && *ptr != '\"' && *ptr != '\\' )
+		ptr++;
+
+	return ptr;
+}
+
+#ifdef SQDBG_SSE2
+inline const char *JSONScanEscapeSSE2( const char *ptr, const char *end )
+{
+	const __m128i quote = _mm_set1_epi8( '\"' );
+	const __m128i backslash = _mm_set1_epi8( '\\' );
+	const __m128i del = _mm_set1_epi8( 0x7F );
+	const __m128i space = _mm_set1_epi8( 0x20 );
+
+	while ( end - ptr >= 16 )
+	{
+		__m128i v = _mm_loadu_si128( (const __m128i*)ptr );
+
+		// Signed compare also catches bytes from 0x80
+		unsigned int mask = (unsigned int)_mm_movemask_epi8( _mm_or_si128(
+				_mm_or_si128( _mm_cmpeq_epi8( v, quote ), _mm_cmpeq_epi8( v, backslash ) ),
+				_mm_or_si128( _mm_cmpeq_epi8( v, del ), _mm_cmplt_epi8( v, space ) ) ) );
+
+		if ( mask )
+			return ptr + ctz32( mask );
+
+		ptr += 16;
+	}
+
+	return JSONScanEscapeScalar( ptr, end );
+}
+#endif
+
+inline const char *JSONScanEscape( const char *ptr, const char *end )
+{
+#ifdef SQDBG_SSE2
+	return JSONScanEscapeSSE2( ptr, end );
+#else
+	return JSONScanEscapeScalar( ptr, end );
+#endif
+}
+
 static inline void PutStr( CBuffer *buffer, const string_t &str )
 {
-	buffer->base.Ensure( buffer->Size() + str.len );
+	buffer->base.Ensure( buffer->offset + buffer->Size() + str.len );
 	memcpy( buffer->Base() + buffer->Size(), str.ptr, str.len );
 	buffer->size += str.len;
 
@@ -289,15 +512,16 @@ static inline void PutStr( CBuffer *buffer, const string_t &str )
 
 static inline void PutStr( CBuffer *buffer, const string_t &str, bool quote )
 {
-	const char *c = str.ptr;
-	unsigned int i = str.len;
+	const char *c;
+	const char *end = str.ptr + str.len;
 
-	unsigned int len = i;
+	unsigned int len = str.len;
 
 	if ( quote )
 		len += 4;
 
-	for ( ; i--; c++ )
+	// Only chars that need attention are visited
+	for ( c = JSONScanEscape( str.ptr, end ); c < end; c = JSONScanEscape( c + 1, end ) )
 	{
 		switch ( *c )
 		{
@@ -313,45 +537,49 @@ static inline void PutStr( CBuffer *buffer, const string_t &str, bool quote )
 				}
 				break;
 			default:
-				if ( !IN_RANGE_CHAR( *c, 0x20, 0x7E ) )
+			{
+				int ret = IsValidUTF8( c, end - c );
+				if ( ret != 0 )
+				{
+					c += ret - 1;
+				}
+				else
 				{
-					int ret = IsValidUTF8( c, i + 1 );
-					if ( ret != 0 )
+					if ( !quote )
 					{
-						i -= ret - 1;
-						c += ret - 1;
+						len += sizeof(uint16_t) * 2 + 1;
 					}
 					else
 					{
-						if ( !quote )
-						{
-							len += sizeof(uint16_t) * 2 + 1;
-						}
-						else
-						{
-							len += sizeof(SQChar) * 2 + 2;
-						}
+						len += sizeof(SQChar) * 2 + 2;
 					}
 				}
+			}
 		}
 	}
 
-	buffer->base.Ensure( buffer->Size() + len );
+	buffer->base.Ensure( buffer->offset + buffer->Size() + len );
 
 	char *mem = buffer->Base();
 	unsigned int idx = buffer->Size();
 
-	c = str.ptr;
-	i = str.len;
-
 	if ( quote )
 	{
 		mem[idx++] = '\\';
 		mem[idx++] = '\"';
 	}
 
-	for ( ; i--; c++ )
+	for ( c = str.ptr; ; c++ )
 	{
+		// Copy clean runs at once
+		const char *next = JSONScanEscape( c, end );
+		memcpy( mem + idx, c, next - c );
+		idx += next - c;
+		c = next;
+
+		if ( c >= end )
+			break;
+
 		mem[idx++] = *c;
 
 		switch ( *c )
@@ -409,46 +637,44 @@ static inline void PutStr( CBuffer *buffer, const string_t &str, bool quote )
 				mem[idx++] = 'v';
 				break;
 			default:
-				if ( !IN_RANGE_CHAR( *c, 0x20, 0x7E ) )
+			{
+				int ret = IsValidUTF8( c, end - c );
+				if ( ret != 0 )
 				{
-					int ret = IsValidUTF8( c, i + 1 );
-					if ( ret != 0 )
+					memcpy( mem + idx, c + 1, ret - 1 );
+					idx += ret - 1;
+					c += ret - 1;
+				}
+				else
+				{
+					mem[idx-1] = '\\';
+
+					if ( !quote )
 					{
-						memcpy( mem + idx, c + 1, ret - 1 );
-						idx += ret - 1;
-						i -= ret - 1;
-						c += ret - 1;
+						mem[idx++] = 'u';
+						uint16_t val = (uint16_t)*(unsigned char*)c;
+						idx += printhex< false >(
+								mem + idx,
+								buffer->Capacity() - idx,
+								val );
 					}
 					else
 					{
-						mem[idx-1] = '\\';
-
-						if ( !quote )
-						{
-							mem[idx++] = 'u';
-							uint16_t val = (uint16_t)*(unsigned char*)c;
-							idx += printhex< false >(
-									mem + idx,
-									buffer->Capacity() - idx,
-									val );
-						}
-						else
-						{
-							mem[idx++] = '\\';
+						mem[idx++] = '\\';
 #ifdef SQUNICODE
-							mem[idx++] = 'u';
-							uint16_t val = (uint16_t)*(unsigned char*)c;
+						mem[idx++] = 'u';
+						uint16_t val = (uint16_t)*(unsigned char*)c;
 #else
-							mem[idx++] = 'x';
-							unsigned char val = *(unsigned char*)c;
+						mem[idx++] = 'x';
+						unsigned char val = *(unsigned char*)c;
 #endif
-							idx += printhex< false >(
-									mem + idx,
-									buffer->Capacity() - idx,
-									val );
-						}
+						idx += printhex< false >(
+								mem + idx,
+								buffer->Capacity() - idx,
+								val );
 					}
 				}
+			}
 		}
 	}
 
@@ -475,7 +701,7 @@ static inline void PutStr( CBuffer *buffer, const sqstring_t &str, bool quote )
 		len = UTF8Length< kUTFEscapeQuoted >( str.ptr, str.len );
 	}
 
-	buffer->base.Ensure( buffer->Size() + len );
+	buffer->base.Ensure( buffer->offset + buffer->Size() + len );
 
 	if ( !quote )
 	{
@@ -500,14 +726,14 @@ static inline void PutStr( CBuffer *buffer, const sqstring_t &str, bool quote )
 
 static inline void PutChar( CBuffer *buffer, char c )
 {
-	buffer->base.Ensure( buffer->Size() + 1 );
+	buffer->base.Ensure( buffer->offset + buffer->Size() + 1 );
 	buffer->Base()[buffer->size++] = c;
 }
 
 template < typename I >
 static inline void PutInt( CBuffer *buffer, I val )
 {
-	buffer->base.Ensure( buffer->Size() + countdigits( val ) + 1 );
+	buffer->base.Ensure( buffer->offset + buffer->Size() + countdigits( val ) + 1 );
 	int len = printint( buffer->Base() + buffer->Size(), buffer->Capacity() - buffer->Size(), val );
 	buffer->size += len;
 }
@@ -516,26 +742,198 @@ template < typename I >
 static inline void PutHex( CBuffer *buffer, I val, bool padding )
 {
 	STATIC_ASSERT( IS_UNSIGNED( I ) );
-	buffer->base.Ensure( buffer->Size() + ( padding ? sizeof(I) * 2 : countdigits<16>( val ) ) + 2 );
+	buffer->base.Ensure( buffer->offset + buffer->Size() + ( padding ? sizeof(I) * 2 : countdigits<16>( val ) ) + 2 );
 	int len = printhex( buffer->Base() + buffer->Size(), buffer->Capacity() - buffer->Size(), val, -(int)padding );
 	buffer->size += len;
 }
 
-struct jstringbuf_t
+// CBOR (RFC 8949) is written by the same writers instantiated for it.
+// Strings are written as raw UTF-8, their content is what a JSON client
+// would decode from the escaped JSON string
+#define CBOR_UINT		0x00
+#define CBOR_NEGINT		0x20
+#define CBOR_TEXT		0x60
+#define CBOR_ARRAY		0x80
+#define CBOR_MAP		0xA0
+#define CBOR_FALSE		0xF4
+#define CBOR_TRUE		0xF5
+#define CBOR_NULL		0xF6
+#define CBOR_INDEFINITE	0x1F
+#define CBOR_BREAK		0xFF
+
+// Self-describe tag 55799, distinguishes CBOR bodies from JSON
+#define CBOR_MAGIC "\xD9\xD9\xF7"
+
+static inline void CBORPutHead( CBuffer *buffer, unsigned char major, unsigned int val )
 {
-	CBuffer *m_pBuffer;
+	buffer->base.Ensure( buffer->offset + buffer->Size() + 5 );
+	unsigned char *mem = (unsigned char*)buffer->Base() + buffer->Size();
 
-	jstringbuf_t( CBuffer *b ) : m_pBuffer(b)
+	if ( val < 24 )
 	{
-		::PutChar( m_pBuffer, '\"' );
+		mem[0] = major | val;
+		buffer->size += 1;
 	}
+	else if ( val <= 0xFF )
+	{
+		mem[0] = major | 24;
+		mem[1] = (unsigned char)val;
+		buffer->size += 2;
+	}
+	else if ( val <= 0xFFFF )
+	{
+		mem[0] = major | 25;
+		mem[1] = (unsigned char)( val >> 8 );
+		mem[2] = (unsigned char)val;
+		buffer->size += 3;
+	}
+	else
+	{
+		mem[0] = major | 26;
+		mem[1] = (unsigned char)( val >> 24 );
+		mem[2] = (unsigned char)( val >> 16 );
+		mem[3] = (unsigned char)( val >> 8 );
+		mem[4] = (unsigned char)val;
+		buffer->size += 5;
+	}
+}
 
-	~jstringbuf_t()
+static inline void CBORPutInt( CBuffer *buffer, int val )
+{
+	if ( val >= 0 )
 	{
-		::PutChar( m_pBuffer, '\"' );
+		CBORPutHead( buffer, CBOR_UINT, (unsigned int)val );
+	}
+	else
+	{
+		CBORPutHead( buffer, CBOR_NEGINT, (unsigned int)( -( val + 1 ) ) );
+	}
+}
+
+// Literal keys and values, no escapes
+static inline void CBORPutStr( CBuffer *buffer, const string_t &str )
+{
+	CBORPutHead( buffer, CBOR_TEXT, str.len );
+	PutStr( buffer, str );
+}
+
+// Reserves the largest head, returns where the content starts
+static inline unsigned int CBORStartText( CBuffer *buffer )
+{
+	buffer->base.Ensure( buffer->offset + buffer->Size() + 5 );
+	buffer->size += 5;
+	return buffer->Size();
+}
+
+// Moves the content written since CBORStartText after its head
+static inline void CBOREndText( CBuffer *buffer, unsigned int start )
+{
+	unsigned int len = buffer->Size() - start;
+
+	buffer->size = start - 5;
+	CBORPutHead( buffer, CBOR_TEXT, len );
+
+	if ( (unsigned int)buffer->Size() != start )
+		memmove( buffer->Base() + buffer->Size(), buffer->Base() + start, len );
+
+	buffer->size += len;
+}
+
+static inline void CBORPutBytes( CBuffer *buffer, const char *ptr, unsigned int len )
+{
+	buffer->base.Ensure( buffer->offset + buffer->Size() + len );
+	memcpy( buffer->Base() + buffer->Size(), ptr, len );
+	buffer->size += len;
+}
+
+// Text content as a JSON client decodes it from PutStr( str, quote )
+static inline void CBORPutText( CBuffer *buffer, const string_t &str, bool quote )
+{
+	const char *end = str.ptr + str.len;
+
+	if ( quote )
+		PutChar( buffer, '\"' );
+
+	for ( const char *c = str.ptr; ; c++ )
+	{
+		const char *next = JSONScanEscape( c, end );
+		CBORPutBytes( buffer, c, next - c );
+		c = next;
+
+		if ( c >= end )
+			break;
+
+		switch ( *c )
+		{
+			case '\\':
+			case '\"':
+				if ( quote )
+					PutChar( buffer, '\\' );
+				PutChar( buffer, *c );
+				break;
+			case '\a': case '\b': case '\f':
+			case '\n': case '\r': case '\t': case '\v':
+				if ( quote )
+				{
+					PutChar( buffer, '\\' );
+					PutChar( buffer, "abtnvfr"[ *c - '\a' ] );
+				}
+				else
+				{
+					PutChar( buffer, *c );
+				}
+				break;
+			default:
+			{
+				int ret = IsValidUTF8( c, end - c );
+				if ( ret != 0 )
+				{
+					CBORPutBytes( buffer, c, ret );
+					c += ret - 1;
+				}
+				else if ( !quote )
+				{
+					// Decoded from \u00XX
+					unsigned char val = *(unsigned char*)c;
+
+					if ( val <= 0x7F )
+					{
+						PutChar( buffer, (char)val );
+					}
+					else
+					{
+						PutChar( buffer, (char)( 0xC0 | ( val >> 6 ) ) );
+						PutChar( buffer, (char)( 0x80 | ( val & 0x3F ) ) );
+					}
+				}
+				else
+				{
+					PutChar( buffer, '\\' );
+#ifdef SQUNICODE
+					PutChar( buffer, 'u' );
+					uint16_t val = (uint16_t)*(unsigned char*)c;
+#else
+					PutChar( buffer, 'x' );
+					unsigned char val = *(unsigned char*)c;
+#endif
+					char hex[ sizeof(val) * 2 ];
+					CBORPutBytes( buffer, hex, printhex< false >( hex, sizeof(hex), val ) );
+				}
+			}
+		}
 	}
 
-	jstringbuf_t( const jstringbuf_t &src );
+	if ( quote )
+		PutChar( buffer, '\"' );
+}
+
+struct jstringbufbase_t
+{
+	CBuffer *m_pBuffer;
+
+	jstringbufbase_t( CBuffer *b ) : m_pBuffer(b)
+	{
+	}
 
 	void Seek( int i )
 	{
@@ -583,40 +981,158 @@ struct jstringbuf_t
 	}
 };
 
-class wjson_t
+// The encoding is a template parameter of the writers,
+// JSON writers compile without any CBOR checks
+template < bool CBOR >
+struct _jstringbuf_t;
+
+template <>
+struct _jstringbuf_t< false > : jstringbufbase_t
+{
+	_jstringbuf_t( CBuffer *b ) : jstringbufbase_t(b)
+	{
+		::PutChar( m_pBuffer, '\"' );
+	}
+
+	~_jstringbuf_t()
+	{
+		::PutChar( m_pBuffer, '\"' );
+	}
+
+	_jstringbuf_t( const _jstringbuf_t &src );
+};
+
+template <>
+struct _jstringbuf_t< true > : jstringbufbase_t
+{
+	unsigned int m_nStart;
+
+	_jstringbuf_t( CBuffer *b ) : jstringbufbase_t(b),
+		m_nStart( CBORStartText( b ) )
+	{
+	}
+
+	~_jstringbuf_t()
+	{
+		CBOREndText( m_pBuffer, m_nStart );
+	}
+
+	_jstringbuf_t( const _jstringbuf_t &src );
+
+	using jstringbufbase_t::Puts;
+
+	void Puts( const string_t &str, bool quote = false )
+	{
+		CBORPutText( m_pBuffer, str, quote );
+	}
+
+#ifdef SQUNICODE
+	// Converted with the escapes of the JSON writer and unescaped in place
+	void Puts( const sqstring_t &str, bool quote = false )
+	{
+		unsigned int start = m_pBuffer->Size();
+		::PutStr( m_pBuffer, str, quote );
+
+		char *ptr = m_pBuffer->Base() + start;
+		char *end = m_pBuffer->Base() + m_pBuffer->Size();
+
+		if ( JSONScanString( ptr, end ) != end )
+			m_pBuffer->size = JSONUnescape( ptr, end ) - m_pBuffer->Base();
+	}
+#endif
+};
+
+template < bool CBOR >
+class _wjson_t
 {
 public:
 	CBuffer *m_pBuffer;
 	int m_nElementCount;
 
-	wjson_t( CBuffer *b ) :
+	_wjson_t( CBuffer *b ) :
 		m_pBuffer(b),
 		m_nElementCount(0)
 	{
 	}
+
+	void Open( char json, unsigned char cbor )
+	{
+		if ( !CBOR )
+		{
+			PutChar( m_pBuffer, json );
+		}
+		else
+		{
+			PutChar( m_pBuffer, (char)( cbor | CBOR_INDEFINITE ) );
+		}
+	}
+
+	void Close( char json )
+	{
+		PutChar( m_pBuffer, !CBOR ? json : (char)CBOR_BREAK );
+	}
+
+	void PutInt( int val )
+	{
+		if ( !CBOR )
+		{
+			::PutInt( m_pBuffer, val );
+		}
+		else
+		{
+			CBORPutInt( m_pBuffer, val );
+		}
+	}
+
+	void PutLiteral( const string_t &val )
+	{
+		if ( !CBOR )
+		{
+			PutChar( m_pBuffer, '\"' );
+			PutStr( m_pBuffer, val );
+			PutChar( m_pBuffer, '\"' );
+		}
+		else
+		{
+			CBORPutStr( m_pBuffer, val );
+		}
+	}
 };
 
-class wjson_table_t : public wjson_t
+template < bool CBOR >
+class _wjson_table_t : public _wjson_t< CBOR >
 {
 public:
-	wjson_table_t( CBuffer &b ) : wjson_t(&b)
+	using _wjson_t< CBOR >::m_pBuffer;
+	using _wjson_t< CBOR >::m_nElementCount;
+
+	_wjson_table_t( CBuffer &b ) : _wjson_t< CBOR >(&b)
 	{
-		PutChar( m_pBuffer, '{' );
+		if ( CBOR )
+			PutStr( m_pBuffer, CBOR_MAGIC );
+
+		this->Open( '{', CBOR_MAP );
 	}
 
-	~wjson_table_t()
+	~_wjson_table_t()
 	{
-		PutChar( m_pBuffer, '}' );
+		this->Close( '}' );
 	}
 
-	wjson_table_t( const wjson_t &src ) : wjson_t(src)
+	_wjson_table_t( const _wjson_t< CBOR > &src ) : _wjson_t< CBOR >(src)
 	{
 	}
 
-	wjson_table_t( const wjson_table_t &src );
+	_wjson_table_t( const _wjson_table_t &src );
 
 	void PutKey( const string_t &key )
 	{
+		if ( CBOR )
+		{
+			CBORPutStr( m_pBuffer, key );
+			return;
+		}
+
 		if ( m_nElementCount++ )
 			PutChar( m_pBuffer, ',' );
 
@@ -629,22 +1145,38 @@ public:
 	void SetInt( const string_t &key, int val )
 	{
 		PutKey( key );
-		PutInt( m_pBuffer, val );
+		this->PutInt( val );
 	}
 
 	void SetNull( const string_t &key )
 	{
 		PutKey( key );
-		PutStr( m_pBuffer, "null" );
+
+		if ( !CBOR )
+		{
+			PutStr( m_pBuffer, "null" );
+		}
+		else
+		{
+			PutChar( m_pBuffer, (char)CBOR_NULL );
+		}
 	}
 
 	void SetBool( const string_t &key, bool val )
 	{
 		PutKey( key );
-		PutStr( m_pBuffer, val ? string_t("true") : string_t("false") );
+
+		if ( !CBOR )
+		{
+			PutStr( m_pBuffer, val ? string_t("true") : string_t("false") );
+		}
+		else
+		{
+			PutChar( m_pBuffer, (char)( val ? CBOR_TRUE : CBOR_FALSE ) );
+		}
 	}
 
-	jstringbuf_t SetStringAsBuf( const string_t &key )
+	_jstringbuf_t< CBOR > SetStringAsBuf( const string_t &key )
 	{
 		PutKey( key );
 		return { m_pBuffer };
@@ -653,75 +1185,74 @@ public:
 	template < int SIZE >
 	void SetString( const string_t &key, const char (&val)[SIZE] )
 	{
+		PutKey( key );
+		this->PutLiteral( val );
+	}
+
+	// Empty string whose escaped content is inserted at the returned buffer offset
+	int SetStringPlaceholder( const string_t &key )
+	{
+		STATIC_ASSERT( !CBOR );
 		PutKey( key );
 		PutChar( m_pBuffer, '\"' );
-		PutStr( m_pBuffer, val );
+		int offset = m_pBuffer->Size();
 		PutChar( m_pBuffer, '\"' );
+		return offset;
 	}
 
 	void SetString( const string_t &key, const conststring_t &val )
 	{
 		PutKey( key );
-		PutChar( m_pBuffer, '\"' );
-		PutStr( m_pBuffer, val );
-		PutChar( m_pBuffer, '\"' );
+		this->PutLiteral( val );
 	}
 
 	void SetString( const string_t &key, const string_t &val, bool quote = false )
 	{
-		PutKey( key );
-		PutChar( m_pBuffer, '\"' );
-		PutStr( m_pBuffer, val, quote );
-		PutChar( m_pBuffer, '\"' );
+		_jstringbuf_t< CBOR > buf = SetStringAsBuf( key );
+		buf.Puts( val, quote );
 	}
 
 #ifdef SQUNICODE
 	void SetString( const string_t &key, const sqstring_t &val, bool quote = false )
 	{
-		PutKey( key );
-		PutChar( m_pBuffer, '\"' );
-		PutStr( m_pBuffer, val, quote );
-		PutChar( m_pBuffer, '\"' );
+		_jstringbuf_t< CBOR > buf = SetStringAsBuf( key );
+		buf.Puts( val, quote );
 	}
 #endif
 
 	void SetIntString( const string_t &key, int val )
 	{
-		PutKey( key );
-		PutChar( m_pBuffer, '\"' );
-		PutInt( m_pBuffer, val );
-		PutChar( m_pBuffer, '\"' );
+		_jstringbuf_t< CBOR > buf = SetStringAsBuf( key );
+		buf.PutInt( val );
 	}
 
 	template < typename I >
 	void SetIntBrackets( const string_t &key, I val, bool hex = false )
 	{
-		PutKey( key );
-		PutChar( m_pBuffer, '\"' );
-		PutChar( m_pBuffer, '[' );
+		_jstringbuf_t< CBOR > buf = SetStringAsBuf( key );
+		buf.Put( '[' );
 		if ( !hex )
 		{
-			PutInt( m_pBuffer, val );
+			buf.PutInt( val );
 		}
 		else
 		{
-			PutHex( m_pBuffer, cast_unsigned( val ), false );
+			buf.PutHex( cast_unsigned( val ), false );
 		}
-		PutChar( m_pBuffer, ']' );
-		PutChar( m_pBuffer, '\"' );
+		buf.Put( ']' );
 	}
 
-	wjson_t SetArray( const string_t &key )
+	_wjson_t< CBOR > SetArray( const string_t &key )
 	{
 		PutKey( key );
-		PutChar( m_pBuffer, '[' );
+		this->Open( '[', CBOR_ARRAY );
 		return { m_pBuffer };
 	}
 
-	wjson_t SetTable( const string_t &key )
+	_wjson_t< CBOR > SetTable( const string_t &key )
 	{
 		PutKey( key );
-		PutChar( m_pBuffer, '{' );
+		this->Open( '{', CBOR_MAP );
 		return { m_pBuffer };
 	}
 
@@ -731,58 +1262,68 @@ public:
 	void Set( const string_t &key, const string_t &val ) { SetString( key, val ); }
 };
 
-class wjson_array_t : public wjson_t
+template < bool CBOR >
+class _wjson_array_t : public _wjson_t< CBOR >
 {
 public:
-	wjson_array_t( CBuffer &b ) : wjson_t(&b)
+	using _wjson_t< CBOR >::m_pBuffer;
+	using _wjson_t< CBOR >::m_nElementCount;
+
+	_wjson_array_t( CBuffer &b ) : _wjson_t< CBOR >(&b)
 	{
-		PutChar( m_pBuffer, '[' );
+		this->Open( '[', CBOR_ARRAY );
 	}
 
-	~wjson_array_t()
+	~_wjson_array_t()
 	{
-		PutChar( m_pBuffer, ']' );
+		this->Close( ']' );
 	}
 
-	wjson_array_t( const wjson_t &src ) : wjson_t(src)
+	_wjson_array_t( const _wjson_t< CBOR > &src ) : _wjson_t< CBOR >(src)
 	{
 	}
 
-	wjson_array_t( const wjson_array_t &src );
+	_wjson_array_t( const _wjson_array_t &src );
 
 	int Size()
 	{
 		return m_nElementCount;
 	}
 
-	wjson_t AppendTable()
+	void PutComma()
 	{
-		if ( m_nElementCount++ )
+		if ( m_nElementCount++ && !CBOR )
 			PutChar( m_pBuffer, ',' );
+	}
 
-		PutChar( m_pBuffer, '{' );
+	_wjson_t< CBOR > AppendTable()
+	{
+		PutComma();
+		this->Open( '{', CBOR_MAP );
 		return { m_pBuffer };
 	}
 
 	void Append( int val )
 	{
-		if ( m_nElementCount++ )
-			PutChar( m_pBuffer, ',' );
-
-		PutInt( m_pBuffer, val );
+		PutComma();
+		this->PutInt( val );
 	}
 
 	void Append( const string_t &val )
 	{
-		if ( m_nElementCount++ )
-			PutChar( m_pBuffer, ',' );
-
-		PutChar( m_pBuffer, '\"' );
-		PutStr( m_pBuffer, val );
-		PutChar( m_pBuffer, '\"' );
+		PutComma();
+		this->PutLiteral( val );
 	}
 };
 
+typedef _jstringbuf_t< false > jstringbuf_t;
+typedef _wjson_t< false > wjson_t;
+typedef _wjson_table_t< false > wjson_table_t;
+typedef _wjson_array_t< false > wjson_array_t;
+
+typedef _wjson_table_t< true > wcbor_table_t;
+typedef _wjson_array_t< true > wcbor_array_t;
+
 class JSONParser
 {
 private:
@@ -974,6 +1515,8 @@ private:
 
 		for (;;)
 		{
+			m_cur = JSONScanString( m_cur, m_end );
+
 			if ( m_cur >= m_end )
 			{
 				SetError( "unfinished string @ %i", Index() );
@@ -987,12 +1530,6 @@ private:
 				break;
 			}
 
-			if ( *m_cur != '\\' )
-			{
-				m_cur++;
-				continue;
-			}
-
 			m_cur++;
 
 			if ( m_cur >= m_end )
@@ -1032,94 +1569,7 @@ private:
 
 		if ( bEscape )
 		{
-			char *cur = pStart;
-			char *end = pStart + token.len;
-
-			do
-			{
-				if ( cur[0] != '\\' )
-				{
-					cur++;
-					continue;
-				}
-
-#define _shift( bytesWritten, bytesRead ) \
-do { \
-	Assert( (bytesWritten) < (bytesRead) ); \
-	memmove( cur + (bytesWritten), cur + (bytesRead), end - ( cur + (bytesRead) ) ); \
-	cur += (bytesWritten); \
-	end -= (bytesRead) - (bytesWritten); \
-} while (0)
-
-				switch ( cur[1] )
-				{
-					case '\\':
-shift_one:
-						_shift( 1, 2 );
-						break;
-					case '\"': cur[0] = '\"'; goto shift_one;
-					case '/': cur[0] = '/'; goto shift_one;
-					case 'b': cur[0] = '\b'; goto shift_one;
-					case 'f': cur[0] = '\f'; goto shift_one;
-					case 'n': cur[0] = '\n'; goto shift_one;
-					case 'r': cur[0] = '\r'; goto shift_one;
-					case 't': cur[0] = '\t'; goto shift_one;
-					case 'u':
-					{
-						unsigned int val;
-						Verify( atox( { cur + 2, 4 }, &val ) );
-
-						if ( val <= 0x7F )
-						{
-							cur[0] = (char)val;
-
-							_shift( 1, 6 );
-							break;
-						}
-						else if ( val <= 0x7FF )
-						{
-							UTF8_2_FROM_UTF32( (unsigned char*)cur, val );
-
-							_shift( 2, 6 );
-							break;
-						}
-						else if ( UTF_SURROGATE(val) )
-						{
-							if ( UTF_SURROGATE_LEAD(val) )
-							{
-								if ( cur + 11 < end &&
-										cur[6] == '\\' && cur[7] == 'u' &&
-										_isxdigit( cur[8] ) && _isxdigit( cur[9] ) &&
-										_isxdigit( cur[10] ) && _isxdigit( cur[11] ) )
-								{
-									unsigned int low;
-									Verify( atox( { cur + 8, 4 }, &low ) );
-
-									if ( UTF_SURROGATE_TRAIL( low ) )
-									{
-										val = UTF32_FROM_UTF16_SURROGATE( val, low );
-										UTF8_4_FROM_UTF32( (unsigned char*)cur, val );
-
-										_shift( 4, 12 );
-										break;
-									}
-								}
-							}
-						}
-
-						UTF8_3_FROM_UTF32( (unsigned char*)cur, val );
-
-						_shift( 3, 6 );
-						break;
-					}
-					default: UNREACHABLE();
-				}
-
-#undef _shift
-			}
-			while ( cur < end );
-
-			token.len = end - pStart;
+			token.len = JSONUnescape( pStart, pStart + token.len ) - pStart;
 			token.ptr[token.len] = 0;
 		}
 
@@ -1229,6 +1679,7 @@ err_eof:
 
 			kv->key.ofs = token.ptr - m_start;
 			kv->key.len = (ostr_t::index_t)token.len;
+			kv->hash = JSONHashKey( token.ptr, token.len );
 
 			type = NextToken( token );
 			type = ParseValue( type, token, &kv->val );
@@ -1247,6 +1698,7 @@ err_eof:
 			}
 			else if ( type == '}' )
 			{
+				pTable->BuildIndex();
 				return Token_Table;
 			}
 			else
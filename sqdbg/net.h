@@ -53,11 +53,15 @@
 #else
 	#include <sys/types.h>
 	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <sys/stat.h>
 	#include <sys/ioctl.h>
 	#include <sys/fcntl.h>
 	#include <arpa/inet.h>
 	#include <netinet/tcp.h>
 	#include <netdb.h>
+	#include <sys/uio.h>
+	#include <poll.h>
 	#include <unistd.h>
 	#include <errno.h>
 	#include <string.h>
@@ -66,12 +70,35 @@
 	#define ioctlsocket ioctl
 	#define strerr(e) strerror(e)
 
+	// The I/O thread polls its own sockets
+	#if defined(__linux__) && !defined(SQDBG_NET_DISABLE_EPOLL) && !defined(SQDBG_NET_THREAD)
+		#define SQDBG_NET_EPOLL
+		#include <sys/epoll.h>
+		#include <atomic>
+		#include <mutex>
+	#endif
+
+	// Needs -lrt with glibc older than 2.34
+	#if defined(__linux__) && defined(SQDBG_NET_ENABLE_SHM)
+		#define SQDBG_NET_SHM
+		#include "shm.h"
+	#endif
+
 	typedef int SOCKET;
 	#define INVALID_SOCKET -1
 	#define SOCKET_ERROR -1
 	#define SD_BOTH SHUT_RDWR
 #endif
 
+#include <chrono>
+
+#ifdef SQDBG_NET_THREAD
+	#include <thread>
+	#include <atomic>
+	#include <mutex>
+	#include <condition_variable>
+#endif
+
 #ifdef _DEBUG
 	class CEntryCounter
 	{
@@ -92,10 +119,61 @@ void *sqdbg_malloc( unsigned int size );
 void *sqdbg_realloc( void *p, unsigned int oldsize, unsigned int size );
 void sqdbg_free( void *p, unsigned int size );
 
+// Initial receive buffer size, grows up to max message size
 #ifndef SQDBG_NET_BUF_SIZE
 #define SQDBG_NET_BUF_SIZE ( 16 * 1024 )
 #endif
 
+#ifndef SQDBG_NET_MAX_MESSAGE_SIZE
+#define SQDBG_NET_MAX_MESSAGE_SIZE ( 8 * 1024 * 1024 )
+#endif
+
+// Outgoing bytes that can be queued while the client isn't reading,
+// droppable messages are dropped after half of it is used
+#ifndef SQDBG_NET_SEND_QUEUE_SIZE
+#define SQDBG_NET_SEND_QUEUE_SIZE ( 4 * 1024 * 1024 )
+#endif
+
+#ifndef SQDBG_NET_MAX_OBSERVERS
+#define SQDBG_NET_MAX_OBSERVERS 4
+#endif
+
+#ifndef SQDBG_NET_OBSERVER_QUEUE_SIZE
+#define SQDBG_NET_OBSERVER_QUEUE_SIZE ( 1024 * 1024 )
+#endif
+
+// Observer requests larger than this are skipped without a response
+#ifndef SQDBG_NET_OBSERVER_RECV_SIZE
+#define SQDBG_NET_OBSERVER_RECV_SIZE 2048
+#endif
+
+// Room given to the host to write a response to an observer request
+#define SQDBG_NET_OBSERVER_RESPONSE_SIZE 4096
+
+// Segments of a message that are written with a single call
+#define SQDBG_NET_MAX_SEGMENTS 8
+
+struct netbuf_t
+{
+	const char *ptr;
+	unsigned int len;
+};
+
+// Unsent bytes of a connection
+struct sendqueue_t
+{
+	char *ptr;
+	unsigned int size;
+	unsigned int start;
+	unsigned int end;
+};
+
+//
+// Messages are allocated in power of 2 spans of MEM_CACHE_CHUNKSIZE blocks,
+// bump allocated from chunks and recycled through per size class free lists.
+// The arena is reset when the queue drains. Messages larger than the largest
+// span are allocated separately, their block holds the pointer.
+//
 class CMessagePool
 {
 public:
@@ -106,7 +184,7 @@ public:
 	{
 		index_t next;
 		index_t prev;
-		unsigned short len;
+		unsigned int len;
 		char ptr[1];
 	};
 #pragma pack(pop)
@@ -115,6 +193,18 @@ public:
 	{
 		char *ptr;
 		int count;
+		int used;
+	};
+
+	struct stats_t
+	{
+		int chunks;
+		int blocks;
+		int usedBlocks;
+		int peakBlocks;
+		int messages;
+		unsigned int allocs;
+		unsigned int reused;
 	};
 
 	static const index_t INVALID_INDEX = 0x80000000;
@@ -127,6 +217,12 @@ public:
 	// only exceeding it on long file paths and long evaluate strings
 	static const int MEM_CACHE_CHUNKSIZE = 256;
 
+	// Spans of up to 2^12 blocks (1 MiB)
+	static const int SIZE_CLASS_COUNT = 13;
+
+	static const unsigned int MAX_POOLED_LENGTH =
+		( 1u << ( SIZE_CLASS_COUNT - 1 ) ) * MEM_CACHE_CHUNKSIZE - sizeof(message_t);
+
 	message_t *Get( index_t index )
 	{
 		Assert( index != INVALID_INDEX );
@@ -138,7 +234,7 @@ public:
 		Assert( chunkIdx < m_MemChunkCount );
 
 		chunk_t *chunk = &m_Memory[ chunkIdx ];
-		Assert( msgIdx < chunk->count );
+		Assert( msgIdx < chunk->used );
 
 		return (message_t*)&chunk->ptr[ msgIdx * MEM_CACHE_CHUNKSIZE ];
 	}
@@ -150,66 +246,64 @@ public:
 	index_t m_Head;
 	index_t m_Tail;
 
-	index_t NewMessage( char *pcsMsg, int nLength )
+private:
+	index_t m_FreeList[ SIZE_CLASS_COUNT ];
+	int m_CurChunk;
+
+	int m_UsedBlocks;
+	int m_PeakBlocks;
+	unsigned int m_Allocs;
+	unsigned int m_Reused;
+
+	static int GetSizeClass( unsigned int nLength )
+	{
+		if ( nLength > MAX_POOLED_LENGTH )
+			return 0;
+
+		unsigned int blocks = ( sizeof(message_t) + nLength - 1 ) / MEM_CACHE_CHUNKSIZE + 1;
+		int sizeClass = 0;
+
+		while ( ( 1u << sizeClass ) < blocks )
+			sizeClass++;
+
+		Assert( sizeClass < SIZE_CLASS_COUNT );
+		return sizeClass;
+	}
+
+	index_t AllocSpan( int span )
 	{
 		if ( !m_Memory )
 		{
 			m_Memory = (chunk_t*)sqdbg_malloc( m_MemChunkCount * sizeof(chunk_t) );
 			AssertOOM( m_Memory, m_MemChunkCount * sizeof(chunk_t) );
 			memset( (char*)m_Memory, 0, m_MemChunkCount * sizeof(chunk_t) );
-
-			chunk_t *chunk = &m_Memory[0];
-			chunk->count = MEM_CACHE_CHUNKS_ALIGN;
-			chunk->ptr = (char*)sqdbg_malloc( chunk->count * MEM_CACHE_CHUNKSIZE );
-			AssertOOM( chunk->ptr, chunk->count * MEM_CACHE_CHUNKSIZE );
-			memset( chunk->ptr, 0, chunk->count * MEM_CACHE_CHUNKSIZE );
 		}
 
-		int requiredChunks = ( sizeof(message_t) + nLength - 1 ) / MEM_CACHE_CHUNKSIZE + 1;
-		int matchedChunks = 0;
-		int msgIdx = 0;
-		int chunkIdx = 0;
-
 		for (;;)
 		{
-			chunk_t *chunk = &m_Memory[ chunkIdx ];
-			Assert( chunk->count && chunk->ptr );
-
-			message_t *msg = (message_t*)&chunk->ptr[ msgIdx * MEM_CACHE_CHUNKSIZE ];
+			chunk_t *chunk = &m_Memory[ m_CurChunk ];
 
-			if ( msg->len == 0 )
+			if ( chunk->count == 0 )
 			{
-				if ( ++matchedChunks == requiredChunks )
-				{
-					msgIdx = msgIdx - matchedChunks + 1;
-					msg = (message_t*)&chunk->ptr[ msgIdx * MEM_CACHE_CHUNKSIZE ];
-
-					Assert( nLength >= 0 );
-					Assert( nLength < ( 1 << ( sizeof(message_t::len) * 8 ) ) );
-
-					msg->next = msg->prev = INVALID_INDEX;
-					msg->len = (unsigned short)nLength;
-					memcpy( msg->ptr, pcsMsg, nLength );
+				Assert( chunk->ptr == NULL );
 
-					return ( chunkIdx << 16 ) | msgIdx;
-				}
-			}
-			else
-			{
-				matchedChunks = 0;
+				chunk->count = ( span + ( MEM_CACHE_CHUNKS_ALIGN - 1 ) ) & ~( MEM_CACHE_CHUNKS_ALIGN - 1 );
+				chunk->ptr = (char*)sqdbg_malloc( chunk->count * MEM_CACHE_CHUNKSIZE );
+				AssertOOM( chunk->ptr, chunk->count * MEM_CACHE_CHUNKSIZE );
+				chunk->used = 0;
 			}
 
-			msgIdx += ( sizeof(message_t) + msg->len - 1 ) / MEM_CACHE_CHUNKSIZE + 1;
-
-			Assert( msgIdx < 0x0000ffff );
-
-			if ( msgIdx < chunk->count )
-				continue;
+			if ( chunk->count - chunk->used >= span )
+			{
+				int msgIdx = chunk->used;
+				chunk->used += span;
 
-			msgIdx = 0;
-			matchedChunks = 0;
+				Assert( chunk->used <= 0x0000ffff );
+				return ( m_CurChunk << 16 ) | msgIdx;
+			}
 
-			if ( ++chunkIdx >= m_MemChunkCount )
+			// Rest of this chunk is unused until the pool drains
+			if ( ++m_CurChunk >= m_MemChunkCount )
 			{
 				int oldcount = m_MemChunkCount;
 				m_MemChunkCount += 4;
@@ -222,43 +316,103 @@ public:
 						(m_MemChunkCount - oldcount) * sizeof(chunk_t) );
 			}
 
-			chunk = &m_Memory[ chunkIdx ];
+			Assert( m_CurChunk < 0x00007fff );
+		}
+	}
+
+	static char *GetData( message_t *msg )
+	{
+		if ( msg->len <= MAX_POOLED_LENGTH )
+			return msg->ptr;
 
-			if ( chunk->count == 0 )
-			{
-				Assert( chunk->ptr == NULL );
+		char *ptr;
+		memcpy( &ptr, msg->ptr, sizeof(ptr) );
+		return ptr;
+	}
 
-				chunk->count = ( requiredChunks + ( MEM_CACHE_CHUNKS_ALIGN - 1 ) ) & ~( MEM_CACHE_CHUNKS_ALIGN - 1 );
-				chunk->ptr = (char*)sqdbg_malloc( chunk->count * MEM_CACHE_CHUNKSIZE );
-				AssertOOM( chunk->ptr, chunk->count * MEM_CACHE_CHUNKSIZE );
-				memset( chunk->ptr, 0, chunk->count * MEM_CACHE_CHUNKSIZE );
-			}
+	index_t NewMessage( char *pcsMsg, int nLength )
+	{
+		Assert( nLength >= 0 );
+
+		int sizeClass = GetSizeClass( nLength );
+		index_t index = m_FreeList[ sizeClass ];
+
+		m_Allocs++;
+
+		if ( index != INVALID_INDEX )
+		{
+			m_FreeList[ sizeClass ] = Get( index )->next;
+			m_Reused++;
+		}
+		else
+		{
+			index = AllocSpan( 1 << sizeClass );
+		}
 
-			Assert( chunkIdx < 0x00007fff );
+		m_UsedBlocks += 1 << sizeClass;
+
+		if ( m_PeakBlocks < m_UsedBlocks )
+			m_PeakBlocks = m_UsedBlocks;
+
+		message_t *msg = Get( index );
+		msg->next = msg->prev = INVALID_INDEX;
+		msg->len = (unsigned int)nLength;
+
+		if ( msg->len <= MAX_POOLED_LENGTH )
+		{
+			memcpy( msg->ptr, pcsMsg, nLength );
 		}
+		else
+		{
+			char *ptr = (char*)sqdbg_malloc( nLength );
+			AssertOOM( ptr, nLength );
+			memcpy( ptr, pcsMsg, nLength );
+			memcpy( msg->ptr, &ptr, sizeof(ptr) );
+		}
+
+		return index;
 	}
 
-	void DeleteMessage( message_t *pMsg )
+	void DeleteMessage( index_t index )
 	{
+		message_t *pMsg = Get( index );
+
 		if ( pMsg->len == 0 )
 			return;
 
-		Assert( pMsg->len > 0 );
 		Assert( m_ElemCount > 0 );
 		m_ElemCount--;
 
-		int msgIdx = ( ( sizeof(message_t) + pMsg->len +
-					( MEM_CACHE_CHUNKSIZE - 1 ) ) & ~( MEM_CACHE_CHUNKSIZE - 1 ) ) / MEM_CACHE_CHUNKSIZE;
+		if ( pMsg->len > MAX_POOLED_LENGTH )
+			sqdbg_free( GetData( pMsg ), pMsg->len );
 
-		do
-		{
-			pMsg->next = pMsg->prev = INVALID_INDEX;
-			pMsg->len = 0;
-			pMsg->ptr[0] = 0;
+		int sizeClass = GetSizeClass( pMsg->len );
+		m_UsedBlocks -= 1 << sizeClass;
+
+		pMsg->len = 0;
+		pMsg->ptr[0] = 0;
+		pMsg->prev = INVALID_INDEX;
 
-			pMsg = (message_t*)( (char*)pMsg + MEM_CACHE_CHUNKSIZE );
+		if ( m_ElemCount == 0 )
+		{
+			Assert( m_UsedBlocks == 0 );
+			ResetArena();
+			return;
 		}
-		while ( --msgIdx > 0 );
+
+		pMsg->next = m_FreeList[ sizeClass ];
+		m_FreeList[ sizeClass ] = index;
+	}
+
+	void ResetArena()
+	{
+		for ( int i = 0; i < SIZE_CLASS_COUNT; i++ )
+			m_FreeList[i] = INVALID_INDEX;
+
+		for ( int chunkIdx = 0; chunkIdx <= m_CurChunk && chunkIdx < m_MemChunkCount; chunkIdx++ )
+			m_Memory[ chunkIdx ].used = 0;
+
+		m_CurChunk = 0;
 	}
 
 public:
@@ -267,33 +421,54 @@ public:
 		m_MemChunkCount( 4 ),
 		m_ElemCount( 0 ),
 		m_Head( INVALID_INDEX ),
-		m_Tail( INVALID_INDEX )
+		m_Tail( INVALID_INDEX ),
+		m_CurChunk( 0 ),
+		m_UsedBlocks( 0 ),
+		m_PeakBlocks( 0 ),
+		m_Allocs( 0 ),
+		m_Reused( 0 )
 	{
+		for ( int i = 0; i < SIZE_CLASS_COUNT; i++ )
+			m_FreeList[i] = INVALID_INDEX;
 	}
 
 	~CMessagePool()
 	{
+		Assert( m_ElemCount == 0 );
+
 		if ( m_Memory )
 		{
 			for ( int chunkIdx = 0; chunkIdx < m_MemChunkCount; chunkIdx++ )
 			{
 				chunk_t *chunk = &m_Memory[ chunkIdx ];
 
-				for ( int msgIdx = 0; msgIdx < chunk->count; )
-				{
-					message_t *msg = (message_t*)&chunk->ptr[ msgIdx * MEM_CACHE_CHUNKSIZE ];
-					Assert( msg->len == 0 && msg->ptr[0] == 0 );
-					msgIdx += ( sizeof(message_t) + msg->len - 1 ) / MEM_CACHE_CHUNKSIZE + 1;
-					DeleteMessage( msg );
-				}
-
-				sqdbg_free( chunk->ptr, chunk->count * MEM_CACHE_CHUNKSIZE );
+				if ( chunk->count )
+					sqdbg_free( chunk->ptr, chunk->count * MEM_CACHE_CHUNKSIZE );
 			}
 
 			sqdbg_free( m_Memory, m_MemChunkCount * sizeof(chunk_t) );
 		}
+	}
 
-		Assert( m_ElemCount == 0 );
+	void GetStats( stats_t *stats )
+	{
+		stats->chunks = 0;
+		stats->blocks = 0;
+
+		for ( int chunkIdx = 0; m_Memory && chunkIdx < m_MemChunkCount; chunkIdx++ )
+		{
+			if ( m_Memory[ chunkIdx ].count )
+			{
+				stats->chunks++;
+				stats->blocks += m_Memory[ chunkIdx ].count;
+			}
+		}
+
+		stats->usedBlocks = m_UsedBlocks;
+		stats->peakBlocks = m_PeakBlocks;
+		stats->messages = m_ElemCount;
+		stats->allocs = m_Allocs;
+		stats->reused = m_Reused;
 	}
 
 	void Shrink()
@@ -309,14 +484,7 @@ public:
 
 			if ( chunk->count )
 			{
-#ifdef _DEBUG
-				for ( int msgIdx = 0; msgIdx < chunk->count; )
-				{
-					message_t *msg = (message_t*)&chunk->ptr[ msgIdx * MEM_CACHE_CHUNKSIZE ];
-					Assert( msg->len == 0 && msg->ptr[0] == 0 );
-					msgIdx += ( sizeof(message_t) + msg->len - 1 ) / MEM_CACHE_CHUNKSIZE + 1;
-				}
-#endif
+				Assert( chunk->used == 0 );
 				sqdbg_free( chunk->ptr, chunk->count * MEM_CACHE_CHUNKSIZE );
 
 				chunk->count = 0;
@@ -333,6 +501,10 @@ public:
 					m_MemChunkCount * sizeof(chunk_t) );
 			AssertOOM( m_Memory, m_MemChunkCount * sizeof(chunk_t) );
 		}
+
+		m_PeakBlocks = 0;
+		m_Allocs = 0;
+		m_Reused = 0;
 	}
 
 	void Add( char *pcsMsg, int nLength )
@@ -355,8 +527,10 @@ public:
 		}
 	}
 
+	// Stops after the message during which deadline passes, if there is one.
+	// Returns false if messages were left
 	template < typename T, void (T::*callback)( char *ptr, int len ) >
-	void Service( T *ctx )
+	bool Service( T *ctx, const std::chrono::steady_clock::time_point *deadline = NULL )
 	{
 		TRACK_ENTRIES();
 
@@ -397,13 +571,23 @@ public:
 				m_Tail = INVALID_INDEX;
 			}
 
-			(ctx->*callback)( pMsg->ptr, pMsg->len );
+			(ctx->*callback)( GetData( pMsg ), pMsg->len );
 
 			Assert( Get(msg) == pMsg );
 
-			DeleteMessage( pMsg );
-			msg = next;
+			DeleteMessage( msg );
+
+			// Re-entry could have executed or reused the next message
+			msg = m_Head;
+
+			if ( deadline && msg != INVALID_INDEX && Get(msg)->len &&
+					std::chrono::steady_clock::now() >= *deadline )
+			{
+				return false;
+			}
 		}
+
+		return true;
 	}
 
 	void Clear()
@@ -435,7 +619,7 @@ public:
 				m_Tail = INVALID_INDEX;
 			}
 
-			DeleteMessage( pMsg );
+			DeleteMessage( msg );
 			msg = next;
 		}
 
@@ -462,395 +646,2725 @@ static inline void CloseSocket( SOCKET *sock )
 	}
 }
 
+// Host wakeup fds are not watched more often than this
+// where they cannot be waited on together with the client
+#ifndef SQDBG_NET_WAKE_INTERVAL
+#define SQDBG_NET_WAKE_INTERVAL 10
+#endif
 
-class CServerSocket
+#ifndef _WIN32
+// Returns true if the host wakeup fd was readable, and resets it
+// by reading once, which works for an eventfd or the read end of a pipe
+static inline bool CheckWakeFd( int fd, int timeout_ms )
 {
-private:
-	SOCKET m_Socket;
-	SOCKET m_ServerSocket;
+	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
 
-	CMessagePool m_MessagePool;
+	if ( poll( &pfd, 1, timeout_ms ) <= 0 || !( pfd.revents & POLLIN ) )
+		return false;
+
+	char buf[64];
+	(void)!read( fd, buf, sizeof(buf) );
+	return true;
+}
+#endif
 
-	char *m_pRecvBufPtr;
-	char m_pRecvBuf[ SQDBG_NET_BUF_SIZE ];
 
+#ifdef SQDBG_NET_EPOLL
+//
+// Single edge triggered epoll instance shared by all servers in the process,
+// which may be serviced from different threads.
+// Readiness is latched in each socket's entry and cleared by the socket
+// when the operation would block, so known states cost no syscalls.
+// A new wait is issued at most once per process frame, by the first socket to ask.
+//
+class CSocketPoller
+{
 public:
-	const char *m_pszLastMsgFmt;
-	const char *m_pszLastMsg;
+	struct entry_t
+	{
+		// Set by whichever thread drains the instance
+		std::atomic< unsigned int > events;
+		bool added;
+	};
 
-#ifdef _WIN32
 private:
-	bool m_bWSAInit;
-#endif
+	std::mutex m_Lock;
+	int m_Epoll;
+	int m_nSockets;
+	int m_nWaiters;
+	unsigned int m_nFrame;
+	unsigned int m_nPolledFrame;
+
+	CSocketPoller() : m_Epoll( -1 ), m_nSockets( 0 ), m_nWaiters( 0 ), m_nFrame( 1 ), m_nPolledFrame( 0 ) {}
 
 public:
-	bool IsListening()
+	static CSocketPoller &Get()
 	{
-		return m_ServerSocket != INVALID_SOCKET;
+		static CSocketPoller s_Poller;
+		return s_Poller;
 	}
 
-	bool IsClientConnected()
+	bool Add( SOCKET sock, entry_t *entry, unsigned int events )
 	{
-		return m_Socket != INVALID_SOCKET;
-	}
+		Assert( !entry->added );
 
-	unsigned short GetServerPort()
-	{
-		if ( m_ServerSocket != INVALID_SOCKET )
+		std::lock_guard< std::mutex > lock( m_Lock );
+
+		if ( m_Epoll == -1 )
 		{
-			sockaddr_in addr;
-			socklen_t len = sizeof(addr);
+			m_Epoll = epoll_create1( EPOLL_CLOEXEC );
 
-			if ( getsockname( m_ServerSocket, (sockaddr*)&addr, &len ) != SOCKET_ERROR )
-				return ntohs( addr.sin_port );
+			if ( m_Epoll == -1 )
+				return false;
 		}
 
-		return 0;
+		epoll_event ev;
+		ev.events = events | EPOLLET;
+		ev.data.ptr = entry;
+
+		if ( epoll_ctl( m_Epoll, EPOLL_CTL_ADD, sock, &ev ) == -1 )
+		{
+			int err = errno;
+			CloseIfUnused();
+			errno = err;
+			return false;
+		}
+
+		entry->added = true;
+		m_nSockets++;
+		return true;
 	}
 
-	bool ListenSocket( unsigned short port )
+	void Remove( SOCKET sock, entry_t *entry )
 	{
-		if ( m_ServerSocket != INVALID_SOCKET )
-			return true;
+		entry->events = 0;
+
+		if ( !entry->added )
+			return;
+
+		entry->added = false;
+
+		// Drained events are not delivered to removed entries after this
+		std::lock_guard< std::mutex > lock( m_Lock );
+
+		Assert( m_Epoll != -1 && m_nSockets > 0 );
+
+		epoll_ctl( m_Epoll, EPOLL_CTL_DEL, sock, NULL );
+		m_nSockets--;
+		CloseIfUnused();
+	}
+
+	//
+	// Allows one more poll. A process frame ends when a server that was
+	// already serviced in it starts another, so servicing N servers per
+	// host frame polls once. frame is the server's own counter
+	//
+	void NextFrame( unsigned int *frame )
+	{
+		std::lock_guard< std::mutex > lock( m_Lock );
+
+		if ( *frame == m_nFrame )
+			m_nFrame++;
+
+		*frame = m_nFrame;
+	}
+
+	void Poll()
+	{
+		std::lock_guard< std::mutex > lock( m_Lock );
+
+		// Results of this frame's poll are already latched
+		if ( m_nPolledFrame == m_nFrame )
+			return;
+
+		m_nPolledFrame = m_nFrame;
+
+		if ( m_Epoll == -1 )
+			return;
+
+		Drain();
+	}
+
+	//
+	// Blocks until any socket has new events, wakefd is readable or timeout_ms passes.
+	// Counts as a poll for all sockets
+	//
+	void Wait( int timeout_ms, int wakefd )
+	{
+		pollfd fds[2];
+		int count = 0;
 
-#ifdef _WIN32
-		if ( !m_bWSAInit )
 		{
-			WSADATA wsadata;
-			if ( WSAStartup( MAKEWORD(2,2), &wsadata ) != 0 )
+			std::lock_guard< std::mutex > lock( m_Lock );
+
+			// Not closed while waited on
+			if ( m_Epoll != -1 )
 			{
-				int err = errno;
-				m_pszLastMsgFmt = "(sqdbg) WSA startup failed";
-				m_pszLastMsg = strerr(err);
-				return false;
+				m_nWaiters++;
+				fds[count].fd = m_Epoll;
+				fds[count].events = POLLIN;
+				fds[count++].revents = 0;
 			}
-			m_bWSAInit = true;
 		}
-#endif
 
-		m_ServerSocket = socket( AF_INET, SOCK_STREAM, 0 );
+		bool epoll = count != 0;
 
-		if ( m_ServerSocket == INVALID_SOCKET )
+		if ( wakefd != -1 )
 		{
-			int err = errno;
-			Shutdown();
-			m_pszLastMsgFmt = "(sqdbg) Failed to open socket";
-			m_pszLastMsg = strerr(err);
-			return false;
+			fds[count].fd = wakefd;
+			fds[count].events = POLLIN;
+			fds[count++].revents = 0;
 		}
 
-		u_long iMode = 1;
-#ifdef _WIN32
-		if ( ioctlsocket( m_ServerSocket, FIONBIO, &iMode ) == SOCKET_ERROR )
-#else
-		int f = fcntl( m_ServerSocket, F_GETFL );
-		if ( f == -1 || fcntl( m_ServerSocket, F_SETFL, f | O_NONBLOCK ) == -1 )
-#endif
+		int ret = poll( fds, count, timeout_ms );
+
+		if ( ret > 0 && wakefd != -1 && ( fds[count-1].revents & POLLIN ) )
+			CheckWakeFd( wakefd, 0 );
+
+		if ( !epoll )
+			return;
+
+		std::lock_guard< std::mutex > lock( m_Lock );
+
+		m_nWaiters--;
+
+		if ( ret > 0 && fds[0].revents )
 		{
-			int err = errno;
-			Shutdown();
-			m_pszLastMsgFmt = "(sqdbg) Failed to set socket non-blocking";
-			m_pszLastMsg = strerr(err);
-			return false;
+			m_nPolledFrame = m_nFrame;
+			Drain();
 		}
 
-		iMode = 1;
+		CloseIfUnused();
+	}
 
-		if ( setsockopt( m_ServerSocket, IPPROTO_TCP, TCP_NODELAY, (char*)&iMode, sizeof(iMode) ) == SOCKET_ERROR )
+private:
+	void CloseIfUnused()
+	{
+		if ( m_nSockets == 0 && m_nWaiters == 0 && m_Epoll != -1 )
 		{
-			int err = errno;
-			Shutdown();
-			m_pszLastMsgFmt = "(sqdbg) Failed to set TCP nodelay";
-			m_pszLastMsg = strerr(err);
-			return false;
+			close( m_Epoll );
+			m_Epoll = -1;
 		}
+	}
 
-		linger ln;
-		ln.l_onoff = 0;
-		ln.l_linger = 0;
+	void Drain()
+	{
+		const int maxevents = 16;
+		epoll_event events[ maxevents ];
+		int count;
 
-		if ( setsockopt( m_ServerSocket, SOL_SOCKET, SO_LINGER, (char*)&ln, sizeof(ln) ) == SOCKET_ERROR )
+		do
+		{
+			count = epoll_wait( m_Epoll, events, maxevents, 0 );
+
+			for ( int i = 0; i < count; i++ )
+			{
+				entry_t *entry = (entry_t*)events[i].data.ptr;
+				entry->events |= events[i].events;
+			}
+		}
+		while ( count == maxevents );
+	}
+};
+#endif
+
+class CServerSocket
+{
+private:
+	SOCKET m_Socket;
+	SOCKET m_ServerSocket;
+
+	// Same as m_Socket except for stdio where the client reads stdout
+	SOCKET m_OutSocket;
+
+#ifndef _WIN32
+	// Unlinked on shutdown
+	char m_szUnixPath[ sizeof( ((sockaddr_un*)0)->sun_path ) ];
+
+	// Stdio is connected on the next Listen, there is a single connection
+	bool m_bStdio;
+	bool m_bStdioPending;
+
+	// Stdio dups share their file description with the host,
+	// flags are restored on detach. -1 if unchanged
+	int m_nStdioFlags[2];
+#endif
+
+#ifdef SQDBG_NET_SHM
+	shmheader_t *m_pShm;
+	unsigned int m_nShmSerial;
+	bool m_bShmConnected;
+	char m_szShmName[64];
+#endif
+
+#ifdef SQDBG_NET_EPOLL
+	CSocketPoller::entry_t m_ServerPoll;
+	CSocketPoller::entry_t m_ClientPoll;
+	CSocketPoller::entry_t m_OutPoll;
+	unsigned int m_nPollFrame;
+#endif
+
+	CMessagePool m_MessagePool;
+
+	// Received bytes are parsed in place, only the partial message at the end
+	// is moved to the front when the buffer runs out of space
+	char *m_pRecvBuf;
+	unsigned int m_nRecvBufSize;
+	unsigned int m_nRecvStart;
+	unsigned int m_nRecvEnd;
+
+	sendqueue_t m_SendQueue;
+	unsigned int m_nDroppedMessages;
+
+	// Connections accepted while a client is connected, only sent broadcast messages
+	// and responses to their requests
+	struct observer_t
+	{
+		SOCKET socket;
+		sendqueue_t queue;
+		char recv[ SQDBG_NET_OBSERVER_RECV_SIZE ];
+		unsigned int recvEnd;
+		// Remaining bytes of a request that did not fit
+		unsigned int recvSkip;
+#ifdef SQDBG_NET_EPOLL
+		CSocketPoller::entry_t poll;
+#endif
+	};
+
+	// Entries are not moved, epoll points to them
+	observer_t m_Observers[ SQDBG_NET_MAX_OBSERVERS ];
+
+	// Sent to observers when they are accepted, the state they missed
+	sendqueue_t m_ObserverState;
+
+public:
+	const char *m_pszLastMsgFmt;
+	const char *m_pszLastMsg;
+
+#ifdef _WIN32
+private:
+	bool m_bWSAInit;
+#endif
+
+public:
+	bool IsListening()
+	{
+#ifndef _WIN32
+		if ( m_bStdio )
+			return true;
+#endif
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+			return true;
+#endif
+		return m_ServerSocket != INVALID_SOCKET;
+	}
+
+	bool IsClientConnected()
+	{
+#ifndef _WIN32
+		if ( m_bStdioPending )
+			return false;
+#endif
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+			return m_bShmConnected;
+#endif
+		return m_Socket != INVALID_SOCKET;
+	}
+
+	unsigned short GetServerPort()
+	{
+		if ( m_ServerSocket != INVALID_SOCKET )
+		{
+			sockaddr_in addr;
+			socklen_t len = sizeof(addr);
+
+			if ( getsockname( m_ServerSocket, (sockaddr*)&addr, &len ) != SOCKET_ERROR &&
+					addr.sin_family == AF_INET )
+				return ntohs( addr.sin_port );
+		}
+
+		return 0;
+	}
+
+	bool ListenUnix( const char *path )
+	{
+#ifdef _WIN32
+		(void)path;
+		m_pszLastMsgFmt = "(sqdbg) Failed to open socket";
+		m_pszLastMsg = "Unix domain sockets are not supported";
+		return false;
+#else
+		if ( IsListening() )
+			return true;
+
+		sockaddr_un addr;
+		unsigned int len = strlen( path );
+
+		if ( !len || len >= sizeof(addr.sun_path) )
+		{
+			m_pszLastMsgFmt = "(sqdbg) Failed to bind socket";
+			m_pszLastMsg = "invalid path length";
+			return false;
+		}
+
+		m_ServerSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+
+		if ( m_ServerSocket == INVALID_SOCKET )
 		{
 			int err = errno;
 			Shutdown();
-			m_pszLastMsgFmt = "(sqdbg) Failed to set don't linger";
+			m_pszLastMsgFmt = "(sqdbg) Failed to open socket";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		int f = fcntl( m_ServerSocket, F_GETFL );
+		if ( f == -1 || fcntl( m_ServerSocket, F_SETFL, f | O_NONBLOCK ) == -1 )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to set socket non-blocking";
 			m_pszLastMsg = strerr(err);
 			return false;
 		}
 
-		sockaddr_in addr;
 		memset( &addr, 0, sizeof(addr) );
-		addr.sin_family = AF_INET;
-		addr.sin_port = htons( port );
-		addr.sin_addr.s_addr = htonl( INADDR_ANY );
+		addr.sun_family = AF_UNIX;
+		memcpy( addr.sun_path, path, len + 1 );
+
+		// Remove the socket file of a previous run,
+		// anything else on the path is left alone
+		struct stat st;
+		if ( lstat( path, &st ) == 0 )
+		{
+			if ( !S_ISSOCK( st.st_mode ) )
+			{
+				Shutdown();
+				m_pszLastMsgFmt = "(sqdbg) Failed to bind socket";
+				m_pszLastMsg = strerr(EADDRINUSE);
+				return false;
+			}
+
+			unlink( path );
+		}
+
+		if ( bind( m_ServerSocket, (sockaddr*)&addr, sizeof(addr) ) == SOCKET_ERROR )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to bind socket";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		memcpy( m_szUnixPath, path, len + 1 );
+
+		if ( listen( m_ServerSocket, 0 ) == SOCKET_ERROR )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to listen to socket";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+#ifdef SQDBG_NET_EPOLL
+		if ( !CSocketPoller::Get().Add( m_ServerSocket, &m_ServerPoll, EPOLLIN ) )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to poll socket";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+#endif
+
+		return true;
+#endif
+	}
+
+	//
+	// Messages are exchanged with a local adapter through shared memory rings
+	//
+	bool ListenShm( const char *name )
+	{
+#ifndef SQDBG_NET_SHM
+		(void)name;
+		m_pszLastMsgFmt = "(sqdbg) Failed to open shared memory";
+		m_pszLastMsg = "not supported";
+		return false;
+#else
+		if ( IsListening() )
+			return true;
+
+		unsigned int len = strlen( name );
+
+		if ( len < 2 || len >= sizeof(m_szShmName) || name[0] != '/' )
+		{
+			m_pszLastMsgFmt = "(sqdbg) Failed to open shared memory";
+			m_pszLastMsg = "name needs to start with '/'";
+			return false;
+		}
+
+		shmheader_t *shm = ShmMap( name, true );
+
+		if ( !shm )
+		{
+			int err = errno;
+			shm_unlink( name );
+			m_pszLastMsgFmt = "(sqdbg) Failed to open shared memory";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		// Adapters attached to a previous instance start over
+		shm->magic = SQDBG_SHM_MAGIC;
+		shm->version = SQDBG_SHM_VERSION;
+		shm->ringsize = SQDBG_SHM_RING_SIZE;
+		shm->connected = 0;
+		__atomic_store_n( &shm->state, 0, __ATOMIC_RELEASE );
+
+		memcpy( m_szShmName, name, len + 1 );
+		m_pShm = shm;
+		m_nShmSerial = shm->serial;
+		return true;
+#endif
+	}
+
+	//
+	// Messages are read from stdin and written to stdout.
+	// stdout is redirected to stderr to keep other output out of the stream
+	//
+	bool AttachStdio()
+	{
+#ifdef _WIN32
+		m_pszLastMsgFmt = "(sqdbg) Failed to attach stdio";
+		m_pszLastMsg = "not supported";
+		return false;
+#else
+		if ( IsListening() )
+			return true;
+
+		m_Socket = dup( STDIN_FILENO );
+		m_OutSocket = dup( STDOUT_FILENO );
+
+		if ( m_Socket == INVALID_SOCKET || m_OutSocket == INVALID_SOCKET ||
+				dup2( STDERR_FILENO, STDOUT_FILENO ) == -1 )
+		{
+			int err = errno;
+			DisconnectClient();
+			m_pszLastMsgFmt = "(sqdbg) Failed to attach stdio";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		SOCKET fds[2] = { m_Socket, m_OutSocket };
+
+		for ( int i = 0; i < 2; i++ )
+		{
+			int f = fcntl( fds[i], F_GETFL );
+			if ( f == -1 || fcntl( fds[i], F_SETFL, f | O_NONBLOCK ) == -1 )
+			{
+				int err = errno;
+				DisconnectClient();
+				m_pszLastMsgFmt = "(sqdbg) Failed to set stdio non-blocking";
+				m_pszLastMsg = strerr(err);
+				return false;
+			}
+
+			m_nStdioFlags[i] = f;
+		}
+
+#ifdef SQDBG_NET_EPOLL
+		// Regular files cannot be polled, they are always ready
+		if ( !CSocketPoller::Get().Add( m_Socket, &m_ClientPoll, EPOLLIN ) )
+			m_ClientPoll.events = EPOLLIN;
+
+		if ( !CSocketPoller::Get().Add( m_OutSocket, &m_OutPoll, EPOLLOUT ) )
+			m_OutPoll.events = EPOLLOUT;
+
+		m_OutPoll.events |= EPOLLOUT;
+#endif
+
+		m_bStdio = true;
+		m_bStdioPending = true;
+		return true;
+#endif
+	}
+
+	bool ListenSocket( unsigned short port )
+	{
+		if ( m_ServerSocket != INVALID_SOCKET )
+			return true;
+
+#ifdef _WIN32
+		if ( !m_bWSAInit )
+		{
+			WSADATA wsadata;
+			if ( WSAStartup( MAKEWORD(2,2), &wsadata ) != 0 )
+			{
+				int err = errno;
+				m_pszLastMsgFmt = "(sqdbg) WSA startup failed";
+				m_pszLastMsg = strerr(err);
+				return false;
+			}
+			m_bWSAInit = true;
+		}
+#endif
+
+		m_ServerSocket = socket( AF_INET, SOCK_STREAM, 0 );
+
+		if ( m_ServerSocket == INVALID_SOCKET )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to open socket";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		u_long iMode = 1;
+#ifdef _WIN32
+		if ( ioctlsocket( m_ServerSocket, FIONBIO, &iMode ) == SOCKET_ERROR )
+#else
+		int f = fcntl( m_ServerSocket, F_GETFL );
+		if ( f == -1 || fcntl( m_ServerSocket, F_SETFL, f | O_NONBLOCK ) == -1 )
+#endif
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to set socket non-blocking";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		iMode = 1;
+
+		if ( setsockopt( m_ServerSocket, IPPROTO_TCP, TCP_NODELAY, (char*)&iMode, sizeof(iMode) ) == SOCKET_ERROR )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to set TCP nodelay";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		linger ln;
+		ln.l_onoff = 0;
+		ln.l_linger = 0;
+
+		if ( setsockopt( m_ServerSocket, SOL_SOCKET, SO_LINGER, (char*)&ln, sizeof(ln) ) == SOCKET_ERROR )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to set don't linger";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		sockaddr_in addr;
+		memset( &addr, 0, sizeof(addr) );
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons( port );
+		addr.sin_addr.s_addr = htonl( INADDR_ANY );
+
+		if ( bind( m_ServerSocket, (sockaddr*)&addr, sizeof(addr) ) == SOCKET_ERROR )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to bind socket on port";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		if ( listen( m_ServerSocket, 0 ) == SOCKET_ERROR )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to listen to socket";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+#ifdef SQDBG_NET_EPOLL
+		if ( !CSocketPoller::Get().Add( m_ServerSocket, &m_ServerPoll, EPOLLIN ) )
+		{
+			int err = errno;
+			Shutdown();
+			m_pszLastMsgFmt = "(sqdbg) Failed to poll socket";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+#endif
+
+		return true;
+	}
+
+	bool Listen()
+	{
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+		{
+			// Accept each attach of the adapter once
+			if ( __atomic_load_n( &m_pShm->state, __ATOMIC_ACQUIRE ) != 1 ||
+					m_pShm->serial == m_nShmSerial )
+				return false;
+
+			m_nShmSerial = m_pShm->serial;
+			m_bShmConnected = true;
+			__atomic_store_n( &m_pShm->connected, 1, __ATOMIC_RELEASE );
+
+			m_pszLastMsg = m_szShmName;
+			return true;
+		}
+#endif
+
+#ifndef _WIN32
+		if ( m_bStdioPending )
+		{
+			m_bStdioPending = false;
+
+			if ( m_Socket == INVALID_SOCKET )
+				return false;
+
+			m_pszLastMsg = "stdio";
+			return true;
+		}
+#endif
+
+		sockaddr_in addr;
+
+		m_Socket = Accept( &addr );
+		m_OutSocket = m_Socket;
+
+		if ( m_Socket == INVALID_SOCKET )
+			return false;
+
+#ifndef _WIN32
+		int f = fcntl( m_Socket, F_GETFL );
+		if ( f == -1 || fcntl( m_Socket, F_SETFL, f | O_NONBLOCK ) == -1 )
+		{
+			int err = errno;
+			DisconnectClient();
+			m_pszLastMsgFmt = "(sqdbg) Failed to set socket non-blocking";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+#endif
+
+#ifdef SQDBG_NET_EPOLL
+		if ( !CSocketPoller::Get().Add( m_Socket, &m_ClientPoll, EPOLLIN | EPOLLOUT ) )
+		{
+			int err = errno;
+			DisconnectClient();
+			m_pszLastMsgFmt = "(sqdbg) Failed to poll socket";
+			m_pszLastMsg = strerr(err);
+			return false;
+		}
+
+		// New connections are writable, reported on the first edge
+		m_ClientPoll.events |= EPOLLOUT;
+#endif
+
+#ifndef _WIN32
+		if ( m_szUnixPath[0] )
+		{
+			m_pszLastMsg = m_szUnixPath;
+			return true;
+		}
+#endif
+
+		m_pszLastMsg = inet_ntoa( addr.sin_addr );
+		return true;
+	}
+
+	//
+	// Accepts observers while a client is connected, answers their requests
+	// and writes their queued messages.
+	//
+	// respond writes a complete message to out and returns its length,
+	// 0 to leave the request unanswered. Observers are read-only,
+	// the host only has what the request contains
+	//
+	template < bool (readHeader)( char **ppMsg, int *pLength ), int (respond)( char *ptr, int len, char *out, int size ) >
+	void ServiceObservers()
+	{
+		if ( m_ServerSocket == INVALID_SOCKET || !IsClientConnected() )
+			return;
+
+		sockaddr_in addr;
+		SOCKET sock = Accept( &addr );
+
+		if ( sock != INVALID_SOCKET )
+			AddObserver( sock );
+
+		for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+		{
+			observer_t *obs = &m_Observers[i];
+
+			if ( obs->socket != INVALID_SOCKET &&
+					( !ReadObserver< readHeader, respond >( obs ) || !FlushObserver( obs ) ) )
+				RemoveObserver( obs );
+		}
+	}
+
+	// Replaces the state sent to observers that are accepted later, count 0 to clear
+	void SetObserverState( const netbuf_t *bufs, int count )
+	{
+		m_ObserverState.start = m_ObserverState.end = 0;
+		QueueSegments( &m_ObserverState, bufs, count, 0 );
+	}
+
+	int GetObserverCount()
+	{
+		int count = 0;
+
+		for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+		{
+			if ( m_Observers[i].socket != INVALID_SOCKET )
+				count++;
+		}
+
+		return count;
+	}
+
+	void Shutdown()
+	{
+		DisconnectClient();
+
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+		{
+			ShmUnmap( m_pShm );
+			shm_unlink( m_szShmName );
+			m_pShm = NULL;
+		}
+#endif
+
+#ifdef SQDBG_NET_EPOLL
+		CSocketPoller::Get().Remove( m_ServerSocket, &m_ServerPoll );
+#endif
+		CloseSocket( &m_ServerSocket );
+
+#ifndef _WIN32
+		if ( m_szUnixPath[0] )
+		{
+			unlink( m_szUnixPath );
+			m_szUnixPath[0] = 0;
+		}
+
+		m_bStdio = false;
+		m_bStdioPending = false;
+#endif
+
+#ifdef _WIN32
+		if ( m_bWSAInit )
+		{
+			WSACleanup();
+			m_bWSAInit = false;
+		}
+#endif
+
+		m_MessagePool.Clear();
+
+		FreeRecvBuf();
+		FreeSendQueue();
+	}
+
+	void DisconnectClient()
+	{
+		for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+		{
+			if ( m_Observers[i].socket != INVALID_SOCKET )
+				RemoveObserver( &m_Observers[i] );
+		}
+
+#ifdef SQDBG_NET_EPOLL
+		CSocketPoller::Get().Remove( m_Socket, &m_ClientPoll );
+#endif
+#ifndef _WIN32
+		SOCKET stdiofds[2] = { m_Socket, m_OutSocket };
+
+		for ( int i = 0; i < 2; i++ )
+		{
+			if ( m_nStdioFlags[i] != -1 )
+			{
+				fcntl( stdiofds[i], F_SETFL, m_nStdioFlags[i] );
+				m_nStdioFlags[i] = -1;
+			}
+		}
+#endif
+
+		if ( m_OutSocket != m_Socket )
+		{
+#ifdef SQDBG_NET_EPOLL
+			CSocketPoller::Get().Remove( m_OutSocket, &m_OutPoll );
+#endif
+#ifdef _WIN32
+			CloseSocket( &m_OutSocket );
+#else
+			if ( m_OutSocket != INVALID_SOCKET )
+				close( m_OutSocket );
+#endif
+		}
+
+		m_OutSocket = INVALID_SOCKET;
+		CloseSocket( &m_Socket );
+
+#ifdef SQDBG_NET_SHM
+		if ( m_bShmConnected )
+		{
+			m_bShmConnected = false;
+			__atomic_store_n( &m_pShm->connected, 0, __ATOMIC_RELEASE );
+		}
+#endif
+
+		m_MessagePool.Clear();
+
+		FreeRecvBuf();
+		FreeSendQueue();
+		FreeQueue( &m_ObserverState );
+	}
+
+	//
+	// Sends what the socket accepts without blocking and queues the rest.
+	// Droppable messages are discarded if the queue is backed up
+	//
+	bool Send( const char *buf, int len, bool droppable = false, bool broadcast = false )
+	{
+		netbuf_t seg = { buf, (unsigned int)len };
+		return Send( &seg, 1, droppable, broadcast );
+	}
+
+	// Broadcast messages are also sent to observers
+	bool Send( const netbuf_t *bufs, int count, bool droppable = false, bool broadcast = false )
+	{
+		if ( !SendClient( bufs, count, droppable ) )
+			return false;
+
+		if ( broadcast )
+			SendObservers( bufs, count, droppable );
+
+		return true;
+	}
+
+private:
+	bool SendClient( const netbuf_t *bufs, int count, bool droppable )
+	{
+		Assert( count > 0 && count <= SQDBG_NET_MAX_SEGMENTS );
+
+		unsigned int len = 0;
+
+		for ( int i = 0; i < count; i++ )
+			len += bufs[i].len;
+
+		unsigned int sent = 0;
+
+		// Preserve message order, only write directly when nothing is queued
+		if ( m_SendQueue.start == m_SendQueue.end )
+		{
+			int bytesSend = DoSend( bufs, count );
+
+			if ( bytesSend == (int)len )
+				return true;
+
+			if ( bytesSend < 0 )
+				return false;
+
+			// Partially sent messages cannot be dropped
+			if ( bytesSend )
+				droppable = false;
+
+			sent = bytesSend;
+		}
+
+		unsigned int queued = m_SendQueue.end - m_SendQueue.start;
+		unsigned int remaining = len - sent;
+
+		if ( droppable && queued + remaining > SQDBG_NET_SEND_QUEUE_SIZE / 2 )
+		{
+			m_nDroppedMessages++;
+			return true;
+		}
+
+		if ( queued + remaining > SQDBG_NET_SEND_QUEUE_SIZE )
+		{
+			DisconnectClient();
+			m_pszLastMsgFmt = "(sqdbg) Client disconnected";
+			m_pszLastMsg = "send queue is full";
+			return false;
+		}
+
+		QueueSegments( &m_SendQueue, bufs, count, sent );
+		return true;
+	}
+
+	void SendObservers( const netbuf_t *bufs, int count, bool droppable )
+	{
+		unsigned int len = 0;
+
+		for ( int i = 0; i < count; i++ )
+			len += bufs[i].len;
+
+		for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+		{
+			observer_t *obs = &m_Observers[i];
+
+			if ( obs->socket != INVALID_SOCKET && !SendObserver( obs, bufs, count, len, droppable ) )
+				RemoveObserver( obs );
+		}
+	}
+
+	// Returns false if the observer needs to be removed
+	bool SendObserver( observer_t *obs, const netbuf_t *bufs, int count, unsigned int len, bool droppable )
+	{
+		unsigned int sent = 0;
+
+		if ( obs->queue.start == obs->queue.end )
+		{
+			bool blocked;
+			int ret = WriteSegments( obs->socket, bufs, count, &blocked );
+
+			if ( ret < 0 )
+				return false;
+
+			if ( ret == (int)len )
+				return true;
+
+#ifdef SQDBG_NET_EPOLL
+			if ( blocked )
+				obs->poll.events &= ~EPOLLOUT;
+#endif
+			sent = ret;
+		}
+
+		unsigned int queued = obs->queue.end - obs->queue.start;
+		unsigned int remaining = len - sent;
+
+		if ( !sent && droppable && queued + remaining > SQDBG_NET_OBSERVER_QUEUE_SIZE / 2 )
+			return true;
+
+		// Slow observers are dropped instead of holding memory
+		if ( queued + remaining > SQDBG_NET_OBSERVER_QUEUE_SIZE )
+			return false;
+
+		QueueSegments( &obs->queue, bufs, count, sent );
+		return true;
+	}
+
+	// Queue unsent parts of the segments
+	static void QueueSegments( sendqueue_t *queue, const netbuf_t *bufs, int count, unsigned int sent )
+	{
+		for ( int i = 0; i < count; i++ )
+		{
+			if ( sent >= bufs[i].len )
+			{
+				sent -= bufs[i].len;
+				continue;
+			}
+
+			QueueSend( queue, bufs[i].ptr + sent, bufs[i].len - sent );
+			sent = 0;
+		}
+	}
+
+	// Returns the next pending connection or INVALID_SOCKET
+	SOCKET Accept( sockaddr_in *addr )
+	{
+		if ( m_ServerSocket == INVALID_SOCKET )
+			return INVALID_SOCKET;
+
+#ifdef SQDBG_NET_EPOLL
+		if ( !( m_ServerPoll.events & EPOLLIN ) )
+		{
+			CSocketPoller::Get().Poll();
+
+			if ( !( m_ServerPoll.events & EPOLLIN ) )
+				return INVALID_SOCKET;
+		}
+#else
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+
+		fd_set rfds;
+		FD_ZERO( &rfds );
+		FD_SET( m_ServerSocket, &rfds );
+
+		select( 0, &rfds, NULL, NULL, &tv );
+
+		if ( !FD_ISSET( m_ServerSocket, &rfds ) )
+			return INVALID_SOCKET;
+
+		FD_CLR( m_ServerSocket, &rfds );
+#endif
+
+		socklen_t addrlen = sizeof(*addr);
+
+		// Unix domain addresses are truncated, path is known
+		SOCKET sock = accept( m_ServerSocket, (sockaddr*)addr, &addrlen );
+
+#ifdef SQDBG_NET_EPOLL
+		// Wait for the next edge
+		if ( sock == INVALID_SOCKET && SocketWouldBlock() )
+			m_ServerPoll.events &= ~EPOLLIN;
+#endif
+
+		return sock;
+	}
+
+	void AddObserver( SOCKET sock )
+	{
+		observer_t *obs = NULL;
+
+		for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+		{
+			if ( m_Observers[i].socket == INVALID_SOCKET )
+			{
+				obs = &m_Observers[i];
+				break;
+			}
+		}
+
+#ifndef _WIN32
+		int f = fcntl( sock, F_GETFL );
+		if ( f == -1 || fcntl( sock, F_SETFL, f | O_NONBLOCK ) == -1 )
+			obs = NULL;
+#endif
+
+		if ( !obs )
+		{
+			CloseSocket( &sock );
+			return;
+		}
+
+#ifdef SQDBG_NET_EPOLL
+		if ( !CSocketPoller::Get().Add( sock, &obs->poll, EPOLLIN | EPOLLOUT ) )
+		{
+			CloseSocket( &sock );
+			return;
+		}
+
+		obs->poll.events |= EPOLLOUT;
+#endif
+
+		obs->socket = sock;
+		obs->recvEnd = 0;
+		obs->recvSkip = 0;
+
+		if ( m_ObserverState.start != m_ObserverState.end )
+		{
+			QueueSend( &obs->queue, m_ObserverState.ptr + m_ObserverState.start,
+					m_ObserverState.end - m_ObserverState.start );
+		}
+	}
+
+	void RemoveObserver( observer_t *obs )
+	{
+#ifdef SQDBG_NET_EPOLL
+		CSocketPoller::Get().Remove( obs->socket, &obs->poll );
+#endif
+		CloseSocket( &obs->socket );
+		FreeQueue( &obs->queue );
+	}
+
+	// Requests are answered in order. Returns false if closed
+	template < bool (readHeader)( char **ppMsg, int *pLength ), int (respond)( char *ptr, int len, char *out, int size ) >
+	bool ReadObserver( observer_t *obs )
+	{
+#ifdef SQDBG_NET_EPOLL
+		const unsigned int readable = EPOLLIN | EPOLLHUP | EPOLLERR;
+
+		if ( !( obs->poll.events & readable ) )
+			return true;
+#endif
+
+		for (;;)
+		{
+			int bytesRecv = recv( obs->socket, obs->recv + obs->recvEnd, sizeof(obs->recv) - obs->recvEnd, 0 );
+
+			if ( bytesRecv == SOCKET_ERROR )
+			{
+				if ( SocketWouldBlock() )
+				{
+#ifdef SQDBG_NET_EPOLL
+					obs->poll.events &= ~readable;
+#endif
+					return true;
+				}
+
+				return false;
+			}
+
+			if ( !bytesRecv )
+				return false;
+
+			obs->recvEnd += bytesRecv;
+
+			unsigned int start = 0;
+
+			while ( start < obs->recvEnd )
+			{
+				if ( obs->recvSkip )
+				{
+					unsigned int skip = obs->recvEnd - start;
+
+					if ( skip > obs->recvSkip )
+						skip = obs->recvSkip;
+
+					obs->recvSkip -= skip;
+					start += skip;
+					continue;
+				}
+
+				char *pMsg = obs->recv + start;
+				int nLength = (int)( obs->recvEnd - start );
+
+				if ( !readHeader( &pMsg, &nLength ) )
+					break;
+
+				if ( nLength == -1 )
+					return false;
+
+				unsigned int msgStart = (unsigned int)( pMsg - obs->recv );
+
+				if ( msgStart - start + nLength > sizeof(obs->recv) )
+				{
+					obs->recvSkip = nLength;
+					start = msgStart;
+					continue;
+				}
+
+				if ( msgStart + nLength > obs->recvEnd )
+					break;
+
+				char out[ SQDBG_NET_OBSERVER_RESPONSE_SIZE ];
+				int len = respond( pMsg, nLength, out, sizeof(out) );
+
+				if ( len > 0 )
+				{
+					netbuf_t seg = { out, (unsigned int)len };
+
+					if ( !SendObserver( obs, &seg, 1, len, false ) )
+						return false;
+				}
+
+				start = msgStart + nLength;
+			}
+
+			// Header doesn't fit
+			if ( start == 0 && obs->recvEnd == sizeof(obs->recv) )
+				return false;
+
+			obs->recvEnd -= start;
+			memmove( obs->recv, obs->recv + start, obs->recvEnd );
+		}
+	}
+
+	bool FlushObserver( observer_t *obs )
+	{
+		if ( obs->queue.start == obs->queue.end )
+			return true;
+
+#ifdef SQDBG_NET_EPOLL
+		if ( !( obs->poll.events & EPOLLOUT ) )
+			return true;
+#endif
+
+		netbuf_t seg = { obs->queue.ptr + obs->queue.start, obs->queue.end - obs->queue.start };
+		bool blocked;
+		int ret = WriteSegments( obs->socket, &seg, 1, &blocked );
+
+		if ( ret < 0 )
+			return false;
+
+#ifdef SQDBG_NET_EPOLL
+		if ( blocked )
+			obs->poll.events &= ~EPOLLOUT;
+#endif
+
+		obs->queue.start += ret;
+
+		if ( obs->queue.start == obs->queue.end )
+			obs->queue.start = obs->queue.end = 0;
+
+		return true;
+	}
+
+public:
+
+	// Write queued messages if the socket is writable
+	bool Flush()
+	{
+		if ( m_SendQueue.start == m_SendQueue.end )
+			return true;
+
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+			return SendQueued();
+#endif
+
+#ifdef SQDBG_NET_EPOLL
+		CSocketPoller::entry_t &out = ( m_OutSocket == m_Socket ) ? m_ClientPoll : m_OutPoll;
+
+		if ( !( out.events & EPOLLOUT ) )
+		{
+			CSocketPoller::Get().Poll();
+
+			if ( !( out.events & EPOLLOUT ) )
+				return true;
+		}
+#else
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+
+		fd_set wfds;
+		FD_ZERO( &wfds );
+		FD_SET( m_OutSocket, &wfds );
+
+		select( (int)m_OutSocket + 1, NULL, &wfds, NULL, &tv );
+
+		if ( !FD_ISSET( m_OutSocket, &wfds ) )
+			return true;
+
+		FD_CLR( m_OutSocket, &wfds );
+#endif
+
+		return SendQueued();
+	}
+
+private:
+	bool SendQueued()
+	{
+		netbuf_t seg = { m_SendQueue.ptr + m_SendQueue.start, m_SendQueue.end - m_SendQueue.start };
+		int bytesSend = DoSend( &seg, 1 );
+
+		if ( bytesSend < 0 )
+			return false;
+
+		m_SendQueue.start += bytesSend;
+
+		if ( m_SendQueue.start == m_SendQueue.end )
+			m_SendQueue.start = m_SendQueue.end = 0;
+
+		return true;
+	}
+
+public:
+	// Sockets are polled at most once between calls
+	void BeginFrame()
+	{
+#ifdef SQDBG_NET_EPOLL
+		CSocketPoller::Get().NextFrame( &m_nPollFrame );
+#endif
+	}
+
+	bool IsSendQueueEmpty()
+	{
+		return m_SendQueue.start == m_SendQueue.end;
+	}
+
+	//
+	// Blocks until the client sends data, queued messages can be written,
+	// the host wakeup fd is readable or timeout_ms passes
+	//
+	void Wait( int timeout_ms, int wakefd = -1 )
+	{
+		if ( !IsClientConnected() )
+			return;
+
+		bool pending = !IsSendQueueEmpty();
+
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+		{
+			// Written data is read on the next frame, there is nothing to wait for
+			if ( pending )
+				timeout_ms = 1;
+
+#ifndef _WIN32
+			if ( wakefd != -1 )
+			{
+				if ( CheckWakeFd( wakefd, 0 ) )
+					return;
+
+				if ( timeout_ms > SQDBG_NET_WAKE_INTERVAL )
+					timeout_ms = SQDBG_NET_WAKE_INTERVAL;
+			}
+#endif
+
+			ShmRingWait( &m_pShm->toServer, timeout_ms );
+			return;
+		}
+#endif
+
+#ifdef SQDBG_NET_EPOLL
+		const unsigned int readable = EPOLLIN | EPOLLHUP | EPOLLERR;
+
+		// Latched states are not reported again
+		if ( ( m_ClientPoll.events & readable ) ||
+				( pending && ( ( m_OutSocket == m_Socket ? m_ClientPoll : m_OutPoll ).events & EPOLLOUT ) ) )
+			return;
+
+		CSocketPoller::Get().Wait( timeout_ms, wakefd );
+#elif !defined(_WIN32)
+		pollfd fds[ 4 + SQDBG_NET_MAX_OBSERVERS ];
+		int count = 0;
+
+		fds[count].fd = m_Socket;
+		fds[count].events = POLLIN;
+		fds[count++].revents = 0;
+
+		if ( pending )
+		{
+			fds[count].fd = m_OutSocket;
+			fds[count].events = POLLOUT;
+			fds[count++].revents = 0;
+		}
+
+		// Observers are accepted and serviced while suspended
+		if ( m_ServerSocket != INVALID_SOCKET )
+		{
+			fds[count].fd = m_ServerSocket;
+			fds[count].events = POLLIN;
+			fds[count++].revents = 0;
+		}
+
+		for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+		{
+			observer_t *obs = &m_Observers[i];
+
+			if ( obs->socket != INVALID_SOCKET )
+			{
+				fds[count].fd = obs->socket;
+				fds[count].events = POLLIN;
+
+				if ( obs->queue.start != obs->queue.end )
+					fds[count].events |= POLLOUT;
+
+				fds[count++].revents = 0;
+			}
+		}
+
+		if ( wakefd != -1 )
+		{
+			fds[count].fd = wakefd;
+			fds[count].events = POLLIN;
+			fds[count++].revents = 0;
+		}
+
+		if ( poll( fds, count, timeout_ms ) > 0 && wakefd != -1 && ( fds[count-1].revents & POLLIN ) )
+			CheckWakeFd( wakefd, 0 );
+#else
+		(void)wakefd;
+
+		timeval tv;
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = ( timeout_ms % 1000 ) * 1000;
+
+		fd_set rfds, wfds;
+		FD_ZERO( &rfds );
+		FD_ZERO( &wfds );
+		FD_SET( m_Socket, &rfds );
+
+		if ( pending )
+			FD_SET( m_Socket, &wfds );
+
+		if ( m_ServerSocket != INVALID_SOCKET )
+			FD_SET( m_ServerSocket, &rfds );
+
+		for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+		{
+			observer_t *obs = &m_Observers[i];
+
+			if ( obs->socket != INVALID_SOCKET )
+			{
+				FD_SET( obs->socket, &rfds );
+
+				if ( obs->queue.start != obs->queue.end )
+					FD_SET( obs->socket, &wfds );
+			}
+		}
+
+		select( 0, &rfds, &wfds, NULL, &tv );
+#endif
+	}
+
+#if defined(SQDBG_NET_THREAD) && !defined(_WIN32)
+	//
+	// Blocks until the listening socket, the client or an observer is ready,
+	// wakefd is readable or timeout_ms passes. Used by the I/O thread
+	//
+	void WaitAll( int timeout_ms, int wakefd )
+	{
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+		{
+			if ( CheckWakeFd( wakefd, 0 ) )
+				return;
+
+			if ( timeout_ms > SQDBG_NET_WAKE_INTERVAL )
+				timeout_ms = SQDBG_NET_WAKE_INTERVAL;
+
+			if ( IsClientConnected() )
+			{
+				ShmRingWait( &m_pShm->toServer, IsSendQueueEmpty() ? timeout_ms : 1 );
+			}
+			else
+			{
+				CheckWakeFd( wakefd, timeout_ms );
+			}
+
+			return;
+		}
+#endif
+
+		pollfd fds[ 4 + SQDBG_NET_MAX_OBSERVERS ];
+		int count = 0;
+
+		fds[count].fd = wakefd;
+		fds[count].events = POLLIN;
+		fds[count++].revents = 0;
+
+		if ( m_ServerSocket != INVALID_SOCKET )
+		{
+			fds[count].fd = m_ServerSocket;
+			fds[count].events = POLLIN;
+			fds[count++].revents = 0;
+		}
+
+		if ( IsClientConnected() )
+		{
+			fds[count].fd = m_Socket;
+			fds[count].events = POLLIN;
+			fds[count++].revents = 0;
+
+			if ( !IsSendQueueEmpty() )
+			{
+				fds[count].fd = m_OutSocket;
+				fds[count].events = POLLOUT;
+				fds[count++].revents = 0;
+			}
+
+			for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+			{
+				observer_t *obs = &m_Observers[i];
+
+				if ( obs->socket != INVALID_SOCKET )
+				{
+					fds[count].fd = obs->socket;
+					fds[count].events = POLLIN;
+
+					if ( obs->queue.start != obs->queue.end )
+						fds[count].events |= POLLOUT;
+
+					fds[count++].revents = 0;
+				}
+			}
+		}
+
+		if ( poll( fds, count, timeout_ms ) > 0 && ( fds[0].revents & POLLIN ) )
+			CheckWakeFd( wakefd, 0 );
+	}
+#endif
+
+	void GetMessagePoolStats( CMessagePool::stats_t *stats )
+	{
+		m_MessagePool.GetStats( stats );
+	}
+
+	// Returns and resets the number of messages dropped since last call
+	unsigned int GetDroppedMessageCount()
+	{
+		unsigned int count = m_nDroppedMessages;
+		m_nDroppedMessages = 0;
+		return count;
+	}
+
+private:
+	// Returns bytes sent, -1 on error
+	int DoSend( const netbuf_t *bufs, int count )
+	{
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+		{
+			unsigned int total = 0;
+
+			for ( int i = 0; i < count; i++ )
+			{
+				unsigned int written = ShmRingWrite( &m_pShm->toClient, bufs[i].ptr, bufs[i].len );
+				total += written;
+
+				if ( written != bufs[i].len )
+					break;
+			}
+
+			return (int)total;
+		}
+#endif
+
+		bool blocked;
+		int ret = WriteSegments( m_OutSocket, bufs, count, &blocked );
+
+		if ( ret < 0 )
+		{
+			int err = errno;
+			DisconnectClient();
+			m_pszLastMsgFmt = "(sqdbg) Network error";
+			m_pszLastMsg = strerr(err);
+			return -1;
+		}
+
+#ifdef SQDBG_NET_EPOLL
+		if ( blocked )
+			( m_OutSocket == m_Socket ? m_ClientPoll : m_OutPoll ).events &= ~EPOLLOUT;
+#endif
+
+		return ret;
+	}
+
+	// Writes segments in order until the socket would block.
+	// Returns bytes sent, -1 on error
+	static int WriteSegments( SOCKET sock, const netbuf_t *bufs, int count, bool *blocked )
+	{
+#ifdef _WIN32
+		WSABUF vec[SQDBG_NET_MAX_SEGMENTS];
+		#define VEC_PTR( v ) (v).buf
+		#define VEC_LEN( v ) (v).len
+#else
+		iovec vec[SQDBG_NET_MAX_SEGMENTS];
+		#define VEC_PTR( v ) (v).iov_base
+		#define VEC_LEN( v ) (v).iov_len
+#endif
+		int total = 0;
+		int first = 0;
+
+		*blocked = false;
+
+		for ( int i = 0; i < count; i++ )
+		{
+			VEC_PTR( vec[i] ) = (char*)bufs[i].ptr;
+			VEC_LEN( vec[i] ) = bufs[i].len;
+		}
+
+		for (;;)
+		{
+			// Skip written segments
+			while ( first < count && VEC_LEN( vec[first] ) == 0 )
+				first++;
+
+			if ( first == count )
+				break;
+
+#ifdef _WIN32
+			DWORD bytesSend;
+			int ret = WSASend( sock, vec + first, count - first, &bytesSend, 0, NULL, NULL );
+
+			if ( ret != SOCKET_ERROR )
+				ret = (int)bytesSend;
+#else
+			int ret = (int)writev( sock, vec + first, count - first );
+#endif
+
+			if ( ret == SOCKET_ERROR )
+			{
+				if ( SocketWouldBlock() )
+				{
+					*blocked = true;
+					break;
+				}
+
+				return -1;
+			}
+
+			total += ret;
+
+			for ( unsigned int bytes = ret; bytes; first++ )
+			{
+				if ( bytes < VEC_LEN( vec[first] ) )
+				{
+					VEC_PTR( vec[first] ) = (char*)VEC_PTR( vec[first] ) + bytes;
+					VEC_LEN( vec[first] ) -= bytes;
+					break;
+				}
+
+				bytes -= VEC_LEN( vec[first] );
+				VEC_LEN( vec[first] ) = 0;
+			}
+		}
+
+		#undef VEC_PTR
+		#undef VEC_LEN
+
+		return total;
+	}
+
+	static void QueueSend( sendqueue_t *queue, const char *buf, int len )
+	{
+		Assert( len > 0 );
+
+		// Move unsent bytes to the front
+		if ( queue->start && queue->end + len > queue->size )
+		{
+			queue->end -= queue->start;
+			memmove( queue->ptr, queue->ptr + queue->start, queue->end );
+			queue->start = 0;
+		}
+
+		if ( queue->end + len > queue->size )
+		{
+			unsigned int oldsize = queue->size;
+			unsigned int size = oldsize ? oldsize * 2 : SQDBG_NET_BUF_SIZE;
+
+			while ( size < queue->end + len )
+				size *= 2;
+
+			if ( queue->ptr )
+			{
+				queue->ptr = (char*)sqdbg_realloc( queue->ptr, oldsize, size );
+			}
+			else
+			{
+				queue->ptr = (char*)sqdbg_malloc( size );
+			}
+
+			AssertOOM( queue->ptr, size );
+			queue->size = size;
+		}
+
+		memcpy( queue->ptr + queue->end, buf, len );
+		queue->end += len;
+	}
+
+	// Make space for at least size bytes after received data
+#ifdef SQDBG_NET_SHM
+	bool RecvShm()
+	{
+		if ( __atomic_load_n( &m_pShm->state, __ATOMIC_ACQUIRE ) != 1 ||
+				m_pShm->serial != m_nShmSerial )
+		{
+			DisconnectClient();
+			m_pszLastMsgFmt = "(sqdbg) Client disconnected";
+			m_pszLastMsg = "adapter detached";
+			return false;
+		}
+
+		if ( ShmRingIsEmpty( &m_pShm->toServer ) )
+			return true;
+
+		if ( !ReserveRecv( 1 ) )
+		{
+			DisconnectClient();
+			m_pszLastMsgFmt = "(sqdbg) Net message buffer is full";
+			m_pszLastMsg = NULL;
+			return false;
+		}
+
+		m_nRecvEnd += ShmRingRead( &m_pShm->toServer,
+				m_pRecvBuf + m_nRecvEnd, m_nRecvBufSize - m_nRecvEnd );
+		return true;
+	}
+#endif
+
+	bool ReserveRecv( unsigned int size )
+	{
+		if ( m_nRecvBufSize - m_nRecvEnd >= size )
+			return true;
+
+		// Move the partial message to the front
+		if ( m_nRecvStart )
+		{
+			m_nRecvEnd -= m_nRecvStart;
+			memmove( m_pRecvBuf, m_pRecvBuf + m_nRecvStart, m_nRecvEnd );
+			m_nRecvStart = 0;
+
+			if ( m_nRecvBufSize - m_nRecvEnd >= size )
+				return true;
+		}
+
+		const unsigned int maxsize = SQDBG_NET_MAX_MESSAGE_SIZE + SQDBG_NET_BUF_SIZE;
+
+		if ( m_nRecvEnd + size > maxsize )
+			return false;
+
+		unsigned int oldsize = m_nRecvBufSize;
+		unsigned int newsize = oldsize ? oldsize * 2 : SQDBG_NET_BUF_SIZE;
+
+		while ( newsize < m_nRecvEnd + size )
+			newsize *= 2;
+
+		if ( newsize > maxsize )
+			newsize = maxsize;
+
+		if ( m_pRecvBuf )
+		{
+			m_pRecvBuf = (char*)sqdbg_realloc( m_pRecvBuf, oldsize, newsize );
+		}
+		else
+		{
+			m_pRecvBuf = (char*)sqdbg_malloc( newsize );
+		}
+
+		AssertOOM( m_pRecvBuf, newsize );
+		m_nRecvBufSize = newsize;
+		return true;
+	}
+
+	void FreeRecvBuf()
+	{
+		if ( m_pRecvBuf )
+		{
+			sqdbg_free( m_pRecvBuf, m_nRecvBufSize );
+			m_pRecvBuf = NULL;
+			m_nRecvBufSize = 0;
+		}
+
+		m_nRecvStart = m_nRecvEnd = 0;
+	}
+
+	static void FreeQueue( sendqueue_t *queue )
+	{
+		if ( queue->ptr )
+		{
+			sqdbg_free( queue->ptr, queue->size );
+			queue->ptr = NULL;
+			queue->size = 0;
+		}
+
+		queue->start = queue->end = 0;
+	}
+
+	void FreeSendQueue()
+	{
+		FreeQueue( &m_SendQueue );
+		m_nDroppedMessages = 0;
+	}
+
+public:
+
+	bool Recv()
+	{
+#ifdef SQDBG_NET_SHM
+		if ( m_pShm )
+			return RecvShm();
+#endif
+
+#ifdef SQDBG_NET_EPOLL
+		const unsigned int readable = EPOLLIN | EPOLLHUP | EPOLLERR;
+
+		if ( !( m_ClientPoll.events & readable ) )
+		{
+			CSocketPoller::Get().Poll();
+
+			if ( !( m_ClientPoll.events & readable ) )
+				return true;
+		}
+
+		if ( !ReserveRecv( 1 ) )
+#else
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+
+		fd_set rfds;
+		FD_ZERO( &rfds );
+		FD_SET( m_Socket, &rfds );
+
+		select( 0, &rfds, NULL, NULL, &tv );
+
+		if ( !FD_ISSET( m_Socket, &rfds ) )
+			return true;
+
+		FD_CLR( m_Socket, &rfds );
+
+		u_long readlen = 0;
+		ioctlsocket( m_Socket, FIONREAD, &readlen );
+
+		if ( !ReserveRecv( readlen < SQDBG_NET_BUF_SIZE ? ( readlen ? (unsigned int)readlen : 1 ) : SQDBG_NET_BUF_SIZE ) )
+#endif
+		{
+			DisconnectClient();
+			m_pszLastMsgFmt = "(sqdbg) Net message buffer is full";
+			m_pszLastMsg = NULL;
+			return false;
+		}
+
+		// Unread data is left in the socket until parsed messages free space
+		while ( m_nRecvEnd < m_nRecvBufSize )
+		{
+#ifdef _WIN32
+			int bytesRecv = recv( m_Socket, m_pRecvBuf + m_nRecvEnd, m_nRecvBufSize - m_nRecvEnd, 0 );
+#else
+			// Also reads stdin
+			int bytesRecv = (int)read( m_Socket, m_pRecvBuf + m_nRecvEnd, m_nRecvBufSize - m_nRecvEnd );
+#endif
+
+			if ( bytesRecv == SOCKET_ERROR )
+			{
+				if ( SocketWouldBlock() )
+				{
+#ifdef SQDBG_NET_EPOLL
+					m_ClientPoll.events &= ~readable;
+#endif
+					break;
+				}
+
+				int err = errno;
+				DisconnectClient();
+				m_pszLastMsgFmt = "(sqdbg) Network error";
+				m_pszLastMsg = strerr(err);
+				return false;
+			}
+
+			if ( !bytesRecv )
+			{
+#ifdef _WIN32
+				WSASetLastError( WSAECONNRESET );
+#else
+				errno = ECONNRESET;
+#endif
+				int err = errno;
+				DisconnectClient();
+				m_pszLastMsgFmt = "(sqdbg) Client disconnected";
+				m_pszLastMsg = strerr(err);
+				return false;
+			}
+
+			m_nRecvEnd += bytesRecv;
+		}
+
+		return true;
+	}
+
+	//
+	// Header reader sets message pointer to the content start
+	//
+	template < bool (readHeader)( char **ppMsg, int *pLength ) >
+	bool Parse()
+	{
+		while ( m_nRecvStart < m_nRecvEnd )
+		{
+			char *pMsg = m_pRecvBuf + m_nRecvStart;
+			int nLength = (int)( m_nRecvEnd - m_nRecvStart );
+
+			// Header wasn't received entirely
+			if ( !readHeader( &pMsg, &nLength ) )
+				break;
+
+			if ( nLength == -1 || (unsigned int)nLength > SQDBG_NET_MAX_MESSAGE_SIZE )
+			{
+				DisconnectClient();
+				m_pszLastMsgFmt = "(sqdbg) Client disconnected";
+
+				if ( nLength == -1 )
+				{
+					m_pszLastMsg = "malformed message";
+				}
+				else
+				{
+					m_pszLastMsg = "content is too large";
+				}
+
+				return false;
+			}
+
+			unsigned int msgEnd = (unsigned int)( pMsg - m_pRecvBuf ) + (unsigned int)nLength;
+
+			// Entire message wasn't received, make room for it and wait
+			if ( m_nRecvEnd < msgEnd )
+			{
+				if ( !ReserveRecv( msgEnd - m_nRecvEnd ) )
+				{
+					DisconnectClient();
+					m_pszLastMsgFmt = "(sqdbg) Net message buffer is full";
+					m_pszLastMsg = NULL;
+					return false;
+				}
+
+				break;
+			}
+
+			m_MessagePool.Add( pMsg, nLength );
+			m_nRecvStart = msgEnd;
+		}
+
+		if ( m_nRecvStart == m_nRecvEnd )
+			m_nRecvStart = m_nRecvEnd = 0;
+
+		return true;
+	}
+
+	bool HasMessages()
+	{
+		return m_MessagePool.m_ElemCount != 0;
+	}
+
+	template < typename T, void (T::*callback)( char *ptr, int len ) >
+	bool Execute( T *ctx, const std::chrono::steady_clock::time_point *deadline = NULL )
+	{
+		bool done = m_MessagePool.Service< T, callback >( ctx, deadline );
+
+		if ( !IsClientConnected() && m_MessagePool.m_ElemCount == 0 )
+		{
+			m_MessagePool.Shrink();
+		}
+
+		return done;
+	}
+
+public:
+	CServerSocket() :
+		m_Socket( INVALID_SOCKET ),
+		m_ServerSocket( INVALID_SOCKET ),
+		m_OutSocket( INVALID_SOCKET ),
+#ifndef _WIN32
+		m_bStdio( false ),
+		m_bStdioPending( false ),
+#endif
+#ifdef SQDBG_NET_SHM
+		m_pShm( NULL ),
+		m_nShmSerial( 0 ),
+		m_bShmConnected( false ),
+#endif
+		m_pRecvBuf( NULL ),
+		m_nRecvBufSize( 0 ),
+		m_nRecvStart( 0 ),
+		m_nRecvEnd( 0 ),
+		m_nDroppedMessages( 0 )
+#ifdef _WIN32
+		, m_bWSAInit( false )
+#endif
+	{
+		// Message pool indexes 256 byte blocks with 16 bits
+		STATIC_ASSERT( ( 1 << ( CMessagePool::SIZE_CLASS_COUNT - 1 ) ) +
+				CMessagePool::MEM_CACHE_CHUNKS_ALIGN <= 0xffff );
+
+		memset( &m_SendQueue, 0, sizeof(m_SendQueue) );
+		memset( &m_ObserverState, 0, sizeof(m_ObserverState) );
+
+		for ( int i = 0; i < SQDBG_NET_MAX_OBSERVERS; i++ )
+		{
+			observer_t *obs = &m_Observers[i];
+			obs->socket = INVALID_SOCKET;
+			memset( &obs->queue, 0, sizeof(obs->queue) );
+			obs->recvEnd = 0;
+			obs->recvSkip = 0;
+#ifdef SQDBG_NET_EPOLL
+			obs->poll.events = 0;
+			obs->poll.added = false;
+#endif
+		}
+#ifdef SQDBG_NET_EPOLL
+		m_nPollFrame = 0;
+		m_ServerPoll.events = 0;
+		m_ServerPoll.added = false;
+		m_ClientPoll.events = 0;
+		m_ClientPoll.added = false;
+		m_OutPoll.events = 0;
+		m_OutPoll.added = false;
+#endif
+#ifndef _WIN32
+		m_szUnixPath[0] = 0;
+		m_nStdioFlags[0] = m_nStdioFlags[1] = -1;
+#endif
+	}
+};
+
+#ifdef SQDBG_NET_THREAD
+//
+// Bounded single producer single consumer queue
+//
+template < typename T, unsigned int SIZE >
+class CSPSCQueue
+{
+private:
+	T m_Items[ SIZE ];
+	std::atomic< unsigned int > m_Head;
+	std::atomic< unsigned int > m_Tail;
+
+public:
+	CSPSCQueue() : m_Head( 0 ), m_Tail( 0 )
+	{
+		STATIC_ASSERT( ( SIZE & ( SIZE - 1 ) ) == 0 );
+	}
+
+	// Producer
+	bool Push( const T &item )
+	{
+		unsigned int tail = m_Tail.load( std::memory_order_relaxed );
+
+		if ( tail - m_Head.load( std::memory_order_acquire ) == SIZE )
+			return false;
+
+		m_Items[ tail & ( SIZE - 1 ) ] = item;
+		m_Tail.store( tail + 1, std::memory_order_release );
+		return true;
+	}
+
+	// Consumer
+	bool Peek( T *item )
+	{
+		unsigned int head = m_Head.load( std::memory_order_relaxed );
+
+		if ( head == m_Tail.load( std::memory_order_acquire ) )
+			return false;
+
+		*item = m_Items[ head & ( SIZE - 1 ) ];
+		return true;
+	}
+
+	// Consumer
+	void Pop()
+	{
+		unsigned int head = m_Head.load( std::memory_order_relaxed );
+		Assert( head != m_Tail.load( std::memory_order_acquire ) );
+		m_Head.store( head + 1, std::memory_order_release );
+	}
+
+	bool IsEmpty()
+	{
+		return m_Head.load( std::memory_order_acquire ) == m_Tail.load( std::memory_order_acquire );
+	}
+};
+
+#ifndef SQDBG_NET_THREAD_QUEUE_SIZE
+#define SQDBG_NET_THREAD_QUEUE_SIZE 1024
+#endif
+
+//
+// Runs CServerSocket on a background thread. Accept, receive, header parsing
+// and send happen on the I/O thread, complete messages and connection events
+// are exchanged with the VM thread through SPSC queues.
+// Exposes the same interface as CServerSocket to the VM thread.
+//
+// Memory functions need to be thread safe.
+//
+// isUrgent is called on the I/O thread for each received message,
+// the VM thread can poll IsPauseRequested() to process it before the next frame.
+// Observer requests are answered by respond on the I/O thread.
+//
+template < bool (readHeader)( char **ppMsg, int *pLength ), bool (isUrgent)( const char *ptr, int len ),
+		 int (respond)( char *ptr, int len, char *out, int size ) >
+class CServerThread
+{
+private:
+	enum
+	{
+		kMessage = 0,
+		kConnect,
+		kDisconnect,
+		kObserverState,
+	};
+
+	struct netmsg_t
+	{
+		int type;
+		unsigned int connection;
+		const char *pszMsgFmt;
+		const char *pszMsg;
+		bool droppable;
+		bool broadcast;
+		int len;
+		char ptr[1];
+	};
+
+	CServerSocket m_Socket;
+
+	std::thread m_Thread;
+	std::atomic< bool > m_bStop;
+	std::atomic< bool > m_bPauseRequested;
+	std::atomic< unsigned int > m_nDroppedMessages;
+
+	std::mutex m_WaitMutex;
+	std::condition_variable m_WaitCond;
+
+	CSPSCQueue< netmsg_t*, SQDBG_NET_THREAD_QUEUE_SIZE > m_Inbound;
+	CSPSCQueue< netmsg_t*, SQDBG_NET_THREAD_QUEUE_SIZE > m_Outbound;
+
+#ifndef _WIN32
+	// Written by the VM thread when it queues outbound messages while the I/O thread waits
+	int m_WakePipe[2];
+	std::atomic< bool > m_bIOWaiting;
+#endif
+
+	// I/O thread
+	unsigned int m_nConnection;
+
+	// VM thread
+	unsigned int m_nClientConnection;
+	bool m_bClientConnected;
+	char m_szClientAddress[64];
+
+public:
+	const char *m_pszLastMsgFmt;
+	const char *m_pszLastMsg;
+
+private:
+	static netmsg_t *NewMessage( int type, unsigned int connection, const char *buf, int len )
+	{
+		unsigned int size = sizeof(netmsg_t) + len;
+		netmsg_t *msg = (netmsg_t*)sqdbg_malloc( size );
+		AssertOOM( msg, size );
+
+		msg->type = type;
+		msg->connection = connection;
+		msg->pszMsgFmt = NULL;
+		msg->pszMsg = NULL;
+		msg->droppable = false;
+		msg->broadcast = false;
+		msg->len = len;
+
+		if ( buf && len )
+			memcpy( msg->ptr, buf, len );
+
+		msg->ptr[len] = 0;
+		return msg;
+	}
+
+	static void FreeMessage( netmsg_t *msg )
+	{
+		sqdbg_free( msg, sizeof(netmsg_t) + msg->len );
+	}
+
+	static void FreeQueue( CSPSCQueue< netmsg_t*, SQDBG_NET_THREAD_QUEUE_SIZE > &queue )
+	{
+		netmsg_t *msg;
+
+		while ( queue.Peek( &msg ) )
+		{
+			queue.Pop();
+			FreeMessage( msg );
+		}
+	}
+
+	//
+	// I/O thread
+	//
+
+	// Received messages are never dropped, wait for the VM thread
+	void PushInbound( netmsg_t *msg )
+	{
+		while ( !m_Inbound.Push( msg ) )
+		{
+			if ( m_bStop.load( std::memory_order_acquire ) )
+			{
+				FreeMessage( msg );
+				return;
+			}
+
+			std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+		}
+
+		// Wake the VM thread if it is suspended
+		std::lock_guard< std::mutex > lock( m_WaitMutex );
+		m_WaitCond.notify_one();
+	}
+
+	void OnDisconnected()
+	{
+		netmsg_t *msg = NewMessage( kDisconnect, m_nConnection, NULL, 0 );
+		msg->pszMsgFmt = m_Socket.m_pszLastMsgFmt;
+		msg->pszMsg = m_Socket.m_pszLastMsg;
+		PushInbound( msg );
+	}
+
+	void OnMessageReceived( char *ptr, int len )
+	{
+		if ( isUrgent( ptr, len ) )
+			m_bPauseRequested.store( true, std::memory_order_release );
+
+		PushInbound( NewMessage( kMessage, m_nConnection, ptr, len ) );
+	}
+
+	void ThreadMain()
+	{
+		while ( !m_bStop.load( std::memory_order_acquire ) )
+		{
+			bool idle = true;
+			netmsg_t *msg;
+
+			while ( m_Outbound.Peek( &msg ) )
+			{
+				m_Outbound.Pop();
+				idle = false;
+
+				// Stale messages of a previous client are dropped
+				if ( msg->connection == m_nConnection && m_Socket.IsClientConnected() )
+				{
+					if ( msg->type == kDisconnect )
+					{
+						m_Socket.DisconnectClient();
+					}
+					else if ( msg->type == kObserverState )
+					{
+						netbuf_t seg = { msg->ptr, (unsigned int)msg->len };
+						m_Socket.SetObserverState( &seg, msg->len ? 1 : 0 );
+					}
+					else if ( !m_Socket.Send( msg->ptr, msg->len, msg->droppable, msg->broadcast ) )
+					{
+						OnDisconnected();
+					}
+				}
+
+				FreeMessage( msg );
+			}
+
+			if ( m_Socket.IsClientConnected() )
+			{
+				if ( !m_Socket.Flush() ||
+						!m_Socket.Recv() ||
+						!m_Socket.template Parse< readHeader >() )
+				{
+					OnDisconnected();
+				}
+				else
+				{
+					if ( m_Socket.HasMessages() )
+						idle = false;
+
+					m_Socket.template Execute< CServerThread, &CServerThread::OnMessageReceived >( this );
+					m_Socket.template ServiceObservers< readHeader, respond >();
+				}
+
+				unsigned int dropped = m_Socket.GetDroppedMessageCount();
+				if ( dropped )
+					m_nDroppedMessages.fetch_add( dropped, std::memory_order_relaxed );
+			}
+			else if ( m_Socket.Listen() )
+			{
+				m_nConnection++;
+				const char *addr = m_Socket.m_pszLastMsg;
+				PushInbound( NewMessage( kConnect, m_nConnection, addr, addr ? strlen(addr) : 0 ) );
+				idle = false;
+			}
+
+			if ( idle )
+				WaitIO();
+		}
+	}
+
+	void WaitIO()
+	{
+#ifndef _WIN32
+		m_bIOWaiting.store( true, std::memory_order_seq_cst );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+
+		// Stop and outbound messages write to the pipe after this
+		if ( m_Outbound.IsEmpty() && !m_bStop.load( std::memory_order_acquire ) )
+			m_Socket.WaitAll( 100, m_WakePipe[0] );
+
+		m_bIOWaiting.store( false, std::memory_order_relaxed );
+#else
+		std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+#endif
+	}
+
+	// VM thread
+	void WakeIOThread()
+	{
+#ifndef _WIN32
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+
+		if ( m_bIOWaiting.exchange( false, std::memory_order_seq_cst ) )
+			(void)!write( m_WakePipe[1], "", 1 );
+#endif
+	}
 
-		if ( bind( m_ServerSocket, (sockaddr*)&addr, sizeof(addr) ) == SOCKET_ERROR )
+	static void ThreadEntry( CServerThread *self )
+	{
+		self->ThreadMain();
+	}
+
+	void StartThread()
+	{
+#ifndef _WIN32
+		// Without the pipe the I/O thread waits out its timeout
+		if ( pipe( m_WakePipe ) == 0 )
 		{
-			int err = errno;
-			Shutdown();
-			m_pszLastMsgFmt = "(sqdbg) Failed to bind socket on port";
-			m_pszLastMsg = strerr(err);
-			return false;
+			for ( int i = 0; i < 2; i++ )
+			{
+				fcntl( m_WakePipe[i], F_SETFL, fcntl( m_WakePipe[i], F_GETFL ) | O_NONBLOCK );
+				fcntl( m_WakePipe[i], F_SETFD, FD_CLOEXEC );
+			}
 		}
-
-		if ( listen( m_ServerSocket, 0 ) == SOCKET_ERROR )
+		else
 		{
-			int err = errno;
-			Shutdown();
-			m_pszLastMsgFmt = "(sqdbg) Failed to listen to socket";
-			m_pszLastMsg = strerr(err);
-			return false;
+			m_WakePipe[0] = m_WakePipe[1] = -1;
 		}
 
-		return true;
+		m_bIOWaiting.store( false, std::memory_order_relaxed );
+#endif
+
+		m_bStop.store( false, std::memory_order_relaxed );
+		m_Thread = std::thread( ThreadEntry, this );
 	}
 
-	bool Listen()
+	void StopThread()
 	{
-		if ( m_ServerSocket == INVALID_SOCKET )
-			return false;
+		if ( m_Thread.joinable() )
+		{
+			m_bStop.store( true, std::memory_order_release );
+			WakeIOThread();
+			m_Thread.join();
 
-		timeval tv;
-		tv.tv_sec = 0;
-		tv.tv_usec = 0;
+#ifndef _WIN32
+			if ( m_WakePipe[0] != -1 )
+			{
+				close( m_WakePipe[0] );
+				close( m_WakePipe[1] );
+				m_WakePipe[0] = m_WakePipe[1] = -1;
+			}
+#endif
+		}
 
-		fd_set rfds;
-		FD_ZERO( &rfds );
-		FD_SET( m_ServerSocket, &rfds );
+		FreeQueue( m_Inbound );
+		FreeQueue( m_Outbound );
+	}
 
-		select( 0, &rfds, NULL, NULL, &tv );
+public:
+	//
+	// VM thread
+	//
 
-		if ( !FD_ISSET( m_ServerSocket, &rfds ) )
-			return false;
+	bool IsListening()
+	{
+		return m_Socket.IsListening();
+	}
 
-		FD_CLR( m_ServerSocket, &rfds );
+	bool IsClientConnected()
+	{
+		return m_bClientConnected;
+	}
 
-		sockaddr_in addr;
-		socklen_t addrlen = sizeof(addr);
+	unsigned short GetServerPort()
+	{
+		return m_Socket.GetServerPort();
+	}
 
-		m_Socket = accept( m_ServerSocket, (sockaddr*)&addr, &addrlen );
+	bool ListenSocket( unsigned short port )
+	{
+		if ( m_Socket.IsListening() )
+			return true;
 
-		if ( m_Socket == INVALID_SOCKET )
+		if ( !m_Socket.ListenSocket( port ) )
+		{
+			m_pszLastMsgFmt = m_Socket.m_pszLastMsgFmt;
+			m_pszLastMsg = m_Socket.m_pszLastMsg;
 			return false;
+		}
 
-#ifndef _WIN32
-		int f = fcntl( m_Socket, F_GETFL );
-		if ( f == -1 || fcntl( m_Socket, F_SETFL, f | O_NONBLOCK ) == -1 )
+		StartThread();
+		return true;
+	}
+
+	bool ListenUnix( const char *path )
+	{
+		if ( m_Socket.IsListening() )
+			return true;
+
+		if ( !m_Socket.ListenUnix( path ) )
 		{
-			int err = errno;
-			DisconnectClient();
-			m_pszLastMsgFmt = "(sqdbg) Failed to set socket non-blocking";
-			m_pszLastMsg = strerr(err);
+			m_pszLastMsgFmt = m_Socket.m_pszLastMsgFmt;
+			m_pszLastMsg = m_Socket.m_pszLastMsg;
 			return false;
 		}
-#endif
 
-		m_pszLastMsg = inet_ntoa( addr.sin_addr );
+		StartThread();
 		return true;
 	}
 
-	void Shutdown()
+	bool ListenShm( const char *name )
 	{
-		CloseSocket( &m_Socket );
-		CloseSocket( &m_ServerSocket );
+		if ( m_Socket.IsListening() )
+			return true;
 
-#ifdef _WIN32
-		if ( m_bWSAInit )
+		if ( !m_Socket.ListenShm( name ) )
 		{
-			WSACleanup();
-			m_bWSAInit = false;
+			m_pszLastMsgFmt = m_Socket.m_pszLastMsgFmt;
+			m_pszLastMsg = m_Socket.m_pszLastMsg;
+			return false;
 		}
-#endif
 
-		m_MessagePool.Clear();
-		m_pRecvBufPtr = m_pRecvBuf;
-		memset( m_pRecvBuf, -1, sizeof( m_pRecvBuf ) );
+		StartThread();
+		return true;
 	}
 
-	void DisconnectClient()
+	bool AttachStdio()
 	{
-		CloseSocket( &m_Socket );
+		if ( m_Socket.IsListening() )
+			return true;
 
-		m_MessagePool.Clear();
-		m_pRecvBufPtr = m_pRecvBuf;
-		memset( m_pRecvBuf, -1, sizeof( m_pRecvBuf ) );
+		if ( !m_Socket.AttachStdio() )
+		{
+			m_pszLastMsgFmt = m_Socket.m_pszLastMsgFmt;
+			m_pszLastMsg = m_Socket.m_pszLastMsg;
+			return false;
+		}
+
+		StartThread();
+		return true;
 	}
 
-	bool Send( const char *buf, int len )
+	// Returns true once per accepted connection, address is in m_pszLastMsg
+	bool Listen()
 	{
-		for (;;)
-		{
-			int bytesSend = send( m_Socket, buf, len, 0 );
+		netmsg_t *msg;
 
-			if ( bytesSend == SOCKET_ERROR )
+		while ( m_Inbound.Peek( &msg ) )
+		{
+			if ( msg->type == kConnect )
 			{
-				// Keep blocking
-				if ( SocketWouldBlock() )
-					continue;
+				m_Inbound.Pop();
 
-				int err = errno;
-				DisconnectClient();
-				m_pszLastMsgFmt = "(sqdbg) Network error";
-				m_pszLastMsg = strerr(err);
-				return false;
-			}
+				int len = msg->len < (int)sizeof(m_szClientAddress) ? msg->len : (int)sizeof(m_szClientAddress) - 1;
+				memcpy( m_szClientAddress, msg->ptr, len );
+				m_szClientAddress[len] = 0;
+
+				m_nClientConnection = msg->connection;
+				m_bClientConnected = true;
+				m_pszLastMsg = m_szClientAddress;
 
-			if ( len == bytesSend )
+				FreeMessage( msg );
 				return true;
+			}
 
-			len -= bytesSend;
+			// Leftovers of the previous client
+			m_Inbound.Pop();
+			FreeMessage( msg );
 		}
+
+		return false;
 	}
 
-	bool Recv()
+	void Shutdown()
 	{
-		timeval tv;
-		tv.tv_sec = 0;
-		tv.tv_usec = 0;
+		StopThread();
+		m_Socket.Shutdown();
+		m_bClientConnected = false;
+		m_bPauseRequested.store( false, std::memory_order_relaxed );
+		m_nDroppedMessages.store( 0, std::memory_order_relaxed );
+	}
 
-		fd_set rfds;
-		FD_ZERO( &rfds );
-		FD_SET( m_Socket, &rfds );
+	void DisconnectClient()
+	{
+		if ( !m_bClientConnected )
+			return;
 
-		select( 0, &rfds, NULL, NULL, &tv );
+		m_bClientConnected = false;
 
-		if ( !FD_ISSET( m_Socket, &rfds ) )
-			return true;
+		netmsg_t *msg = NewMessage( kDisconnect, m_nClientConnection, NULL, 0 );
 
-		FD_CLR( m_Socket, &rfds );
+		while ( !m_Outbound.Push( msg ) )
+			std::this_thread::sleep_for( std::chrono::milliseconds(1) );
 
-		u_long readlen = 0;
-		ioctlsocket( m_Socket, FIONREAD, &readlen );
+		WakeIOThread();
+	}
 
-		int bufsize = m_pRecvBuf + sizeof(m_pRecvBuf) - m_pRecvBufPtr;
+	bool Send( const char *buf, int len, bool droppable = false, bool broadcast = false )
+	{
+		netbuf_t seg = { buf, (unsigned int)len };
+		return Send( &seg, 1, droppable, broadcast );
+	}
 
-		if ( bufsize <= 0 || (unsigned int)bufsize < readlen )
-		{
-			DisconnectClient();
-			m_pszLastMsgFmt = "(sqdbg) Net message buffer is full";
-			m_pszLastMsg = NULL;
-			return false;
-		}
+	// Segments are joined into one message for the I/O thread
+	bool Send( const netbuf_t *bufs, int count, bool droppable = false, bool broadcast = false )
+	{
+		if ( !m_bClientConnected )
+			return true;
 
-		for (;;)
-		{
-			int bytesRecv = recv( m_Socket, m_pRecvBufPtr, bufsize, 0 );
+		unsigned int len = 0;
 
-			if ( bytesRecv == SOCKET_ERROR )
-			{
-				if ( SocketWouldBlock() )
-					break;
+		for ( int i = 0; i < count; i++ )
+			len += bufs[i].len;
 
-				int err = errno;
-				DisconnectClient();
-				m_pszLastMsgFmt = "(sqdbg) Network error";
-				m_pszLastMsg = strerr(err);
-				return false;
-			}
+		netmsg_t *msg = NewMessage( kMessage, m_nClientConnection, NULL, len );
+		msg->droppable = droppable;
+		msg->broadcast = broadcast;
 
-			if ( !bytesRecv )
+		for ( int i = 0, offset = 0; i < count; offset += bufs[i].len, i++ )
+			memcpy( msg->ptr + offset, bufs[i].ptr, bufs[i].len );
+
+		while ( !m_Outbound.Push( msg ) )
+		{
+			if ( droppable )
 			{
-#ifdef _WIN32
-				WSASetLastError( WSAECONNRESET );
-#else
-				errno = ECONNRESET;
-#endif
-				int err = errno;
-				DisconnectClient();
-				m_pszLastMsgFmt = "(sqdbg) Client disconnected";
-				m_pszLastMsg = strerr(err);
-				return false;
+				FreeMessage( msg );
+				m_nDroppedMessages.fetch_add( 1, std::memory_order_relaxed );
+				return true;
 			}
 
-			m_pRecvBufPtr += bytesRecv;
-			bufsize -= bytesRecv;
+			std::this_thread::sleep_for( std::chrono::milliseconds(1) );
 		}
 
+		WakeIOThread();
 		return true;
 	}
 
-	//
-	// Header reader sets message pointer to the content start
-	//
-	template < bool (readHeader)( char **ppMsg, int *pLength ) >
-	bool Parse()
+	// Sent from the I/O thread
+	bool Flush()
 	{
-		// Nothing to parse
-		if ( m_pRecvBufPtr == m_pRecvBuf )
-			return true;
+		return true;
+	}
+
+	// Serviced on the I/O thread
+	template < bool (header)( char **ppMsg, int *pLength ), int (response)( char *ptr, int len, char *out, int size ) >
+	void ServiceObservers()
+	{
+	}
+
+	void SetObserverState( const netbuf_t *bufs, int count )
+	{
+		if ( !m_bClientConnected )
+			return;
+
+		unsigned int len = 0;
+
+		for ( int i = 0; i < count; i++ )
+			len += bufs[i].len;
+
+		netmsg_t *msg = NewMessage( kObserverState, m_nClientConnection, NULL, len );
+
+		for ( int i = 0, offset = 0; i < count; offset += bufs[i].len, i++ )
+			memcpy( msg->ptr + offset, bufs[i].ptr, bufs[i].len );
+
+		while ( !m_Outbound.Push( msg ) )
+			std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+
+		WakeIOThread();
+	}
 
-		char *pMsg = m_pRecvBuf;
-		int nLength = sizeof(m_pRecvBuf);
+	void BeginFrame()
+	{
+	}
+
+	bool IsSendQueueEmpty()
+	{
+		return m_Outbound.IsEmpty();
+	}
+
+	// Blocks until the I/O thread receives a message, wakefd is readable or timeout_ms passes
+	void Wait( int timeout_ms, int wakefd = -1 )
+	{
+		if ( !m_bClientConnected )
+			return;
 
-		while ( readHeader( &pMsg, &nLength ) )
+#ifndef _WIN32
+		if ( wakefd != -1 )
 		{
-			char *pMsgEnd = pMsg + (unsigned int)nLength;
+			if ( CheckWakeFd( wakefd, 0 ) )
+				return;
 
-			if ( pMsgEnd >= m_pRecvBuf + sizeof(m_pRecvBuf) )
-			{
-				DisconnectClient();
-				m_pszLastMsgFmt = "(sqdbg) Client disconnected";
+			if ( timeout_ms > SQDBG_NET_WAKE_INTERVAL )
+				timeout_ms = SQDBG_NET_WAKE_INTERVAL;
+		}
+#else
+		(void)wakefd;
+#endif
 
-				if ( nLength == -1 )
-				{
-					m_pszLastMsg = "malformed message";
-				}
-				else
-				{
-					m_pszLastMsg = "content is too large";
-				}
+		std::unique_lock< std::mutex > lock( m_WaitMutex );
+		m_WaitCond.wait_for( lock, std::chrono::milliseconds( timeout_ms ),
+				[this]() { return !m_Inbound.IsEmpty(); } );
+	}
 
-				return false;
-			}
+	unsigned int GetDroppedMessageCount()
+	{
+		return m_nDroppedMessages.exchange( 0, std::memory_order_relaxed );
+	}
 
-			// Entire message wasn't received, wait for it
-			if ( m_pRecvBufPtr < pMsgEnd )
-				break;
+	bool IsPauseRequested()
+	{
+		return m_bPauseRequested.exchange( false, std::memory_order_acquire );
+	}
 
-			m_MessagePool.Add( pMsg, nLength );
+	// Returns false if the I/O thread lost the client, reason is in m_pszLastMsgFmt
+	bool Recv()
+	{
+		netmsg_t *msg;
+
+		while ( m_Inbound.Peek( &msg ) && msg->type == kDisconnect )
+		{
+			m_Inbound.Pop();
 
-			// Last message
-			if ( m_pRecvBufPtr == pMsgEnd )
+			if ( msg->connection == m_nClientConnection && m_bClientConnected )
 			{
-				memset( m_pRecvBuf, 0, m_pRecvBufPtr - m_pRecvBuf );
-				m_pRecvBufPtr = m_pRecvBuf;
-				break;
+				m_bClientConnected = false;
+				m_pszLastMsgFmt = msg->pszMsgFmt;
+				m_pszLastMsg = msg->pszMsg;
+				FreeMessage( msg );
+				return false;
 			}
 
-			// Next message
-			int shift = m_pRecvBufPtr - pMsgEnd;
-			memmove( m_pRecvBuf, pMsgEnd, shift );
-			memset( m_pRecvBuf + shift, 0, m_pRecvBufPtr - ( m_pRecvBuf + shift ) );
-			m_pRecvBufPtr = m_pRecvBuf + shift;
-			pMsg = m_pRecvBuf;
-			nLength = sizeof(m_pRecvBuf);
+			FreeMessage( msg );
 		}
 
 		return true;
 	}
 
+	// Parsed on the I/O thread
+	template < bool (header)( char **ppMsg, int *pLength ) >
+	bool Parse()
+	{
+		return true;
+	}
+
+	bool HasMessages()
+	{
+		netmsg_t *msg;
+		return m_bClientConnected && m_Inbound.Peek( &msg ) && msg->type == kMessage;
+	}
+
 	template < typename T, void (T::*callback)( char *ptr, int len ) >
-	void Execute( T *ctx )
+	bool Execute( T *ctx, const std::chrono::steady_clock::time_point *deadline = NULL )
 	{
-		m_MessagePool.Service< T, callback >( ctx );
+		netmsg_t *msg;
 
-		if ( m_Socket == INVALID_SOCKET && m_MessagePool.m_ElemCount == 0 )
+		while ( m_bClientConnected && m_Inbound.Peek( &msg ) && msg->type == kMessage )
 		{
-			m_MessagePool.Shrink();
+			m_Inbound.Pop();
+
+			if ( msg->connection == m_nClientConnection )
+				(ctx->*callback)( msg->ptr, msg->len );
+
+			FreeMessage( msg );
+
+			if ( deadline && std::chrono::steady_clock::now() >= *deadline )
+				return !HasMessages();
 		}
+
+		return true;
 	}
 
 public:
-	CServerSocket() :
-		m_Socket( INVALID_SOCKET ),
-		m_ServerSocket( INVALID_SOCKET ),
-		m_pRecvBufPtr( m_pRecvBuf )
-#ifdef _WIN32
-		, m_bWSAInit( false )
+	CServerThread() :
+		m_bStop( false ),
+		m_bPauseRequested( false ),
+		m_nDroppedMessages( 0 ),
+#ifndef _WIN32
+		m_bIOWaiting( false ),
+#endif
+		m_nConnection( 0 ),
+		m_nClientConnection( 0 ),
+		m_bClientConnected( false ),
+		m_pszLastMsgFmt( NULL ),
+		m_pszLastMsg( NULL )
+	{
+		m_szClientAddress[0] = 0;
+#ifndef _WIN32
+		m_WakePipe[0] = m_WakePipe[1] = -1;
 #endif
+	}
+
+	~CServerThread()
 	{
-		STATIC_ASSERT( sizeof(m_pRecvBuf) <= ( 1 << ( sizeof(CMessagePool::message_t::len) * 8 ) ) );
+		StopThread();
 	}
 };
+#endif
 
 #endif // SQDBG_NET_H
@@ -10,46 +10,41 @@
 #define DAP_HEADER_END "\r\n\r\n"
 #define DAP_HEADER_MAXSIZE ( STRLEN(DAP_HEADER_CONTENTLENGTH) + STRLEN(DAP_HEADER_END) + FMT_UINT32_LEN )
 
-inline void DAP_Serialise( CBuffer *buffer )
+// Header is written after the content is complete, returns its length
+inline int DAP_WriteHeader( char (&header)[DAP_HEADER_MAXSIZE], unsigned int contentSize )
 {
-	Assert( buffer->Size() > 0 && buffer->Size() < INT_MAX );
+	Assert( contentSize > 0 && contentSize < INT_MAX );
 
-	char *mem = buffer->Base();
-	int contentSize = buffer->Size() - DAP_HEADER_MAXSIZE;
-	int digits = countdigits( contentSize );
-	int padding = FMT_UINT32_LEN - digits;
+	memcpy( header, DAP_HEADER_CONTENTLENGTH, STRLEN(DAP_HEADER_CONTENTLENGTH) );
 
-	int nearest = 10;
-	while ( contentSize >= nearest )
-		nearest *= 10;
+	int idx = STRLEN(DAP_HEADER_CONTENTLENGTH) + countdigits( contentSize );
 
-	contentSize += padding;
-
-	if ( contentSize >= nearest )
+	for ( int i = idx - 1; contentSize; )
 	{
-		// Padding between header and content increased content size digits,
-		// add padding in the end to match
-		padding--;
-		digits++;
-		buffer->base.Ensure( buffer->Size() + 1 );
-		mem[buffer->size++] = ' ';
+		char c = contentSize % 10;
+		contentSize /= 10;
+		header[i--] = '0' + c;
 	}
 
-	memcpy( mem, DAP_HEADER_CONTENTLENGTH, STRLEN(DAP_HEADER_CONTENTLENGTH) );
+	memcpy( header + idx, DAP_HEADER_END, STRLEN(DAP_HEADER_END) );
+	return idx + STRLEN(DAP_HEADER_END);
+}
 
-	int idx = STRLEN(DAP_HEADER_CONTENTLENGTH) + digits;
+#ifdef SQDBG_NET_THREAD
+// Hint for the I/O thread, pause requests are checked in the debug hook
+inline bool DAP_IsPauseRequest( const char *ptr, int len )
+{
+	const int keylen = STRLEN("\"pause\"");
 
-	for ( int i = idx - 1; contentSize; )
+	for ( const char *end = ptr + len - keylen; ptr <= end; ptr++ )
 	{
-		char c = contentSize % 10;
-		contentSize /= 10;
-		mem[i--] = '0' + c;
+		if ( *ptr == '"' && !memcmp( ptr, "\"pause\"", keylen ) )
+			return true;
 	}
 
-	memcpy( mem + idx, DAP_HEADER_END, STRLEN(DAP_HEADER_END) );
-	idx += STRLEN(DAP_HEADER_END);
-	memset( mem + idx, ' ', padding );
+	return false;
 }
+#endif
 
 inline void DAP_Free( CBuffer *buffer )
 {
@@ -200,18 +195,21 @@ invalid:
 #ifdef SQDBG_VALIDATE_SENT_MSG
 inline void DAP_Test( CScratch< true > *scratch, CBuffer *buffer )
 {
-	char *pMsg = buffer->Base();
-	int nLength = buffer->Size();
+	char header[DAP_HEADER_MAXSIZE];
+	int headerLen = DAP_WriteHeader( header, buffer->Size() );
+
+	char *pMsg = header;
+	int nLength = headerLen;
 
 	bool res = DAP_ReadHeader( &pMsg, &nLength );
-	Assert( res && nLength < buffer->Size() );
+	Assert( res && pMsg == header + headerLen && nLength == buffer->Size() );
 
-	if ( res )
+	if ( res && memcmp( buffer->Base(), CBOR_MAGIC, STRLEN(CBOR_MAGIC) ) != 0 )
 	{
 		CScratch_Restore_Auto _sr( scratch );
 
 		json_table_t table;
-		JSONParser parser( scratch, pMsg, nLength, &table );
+		JSONParser parser( scratch, buffer->Base(), buffer->Size(), &table );
 
 		AssertMsg1( !parser.GetError(), "%s", parser.GetError() );
 	}
@@ -220,9 +218,10 @@ inline void DAP_Test( CScratch< true > *scratch, CBuffer *buffer )
 #define DAP_Test(...) (void)0
 #endif
 
+// Buffered output is sent first to keep the order of events
 #define _DAP_INIT_BUF( _buf ) \
+	FlushOutput(); \
 	CBufTmpCache _bufcache( (_buf) ); \
-	(_buf)->size = DAP_HEADER_MAXSIZE; \
 	(void)0
 
 #define DAP_START_REQUEST( _seq, _cmd ) \
@@ -235,12 +234,12 @@ inline void DAP_Test( CScratch< true > *scratch, CBuffer *buffer )
 		packet.SetString( "command", _cmd ); \
 		(void)0
 
-#define _DAP_START_RESPONSE( _seq, _cmd, _suc ) \
+#define _DAP_START_RESPONSE( _seq, _cmd, _suc, _table_t ) \
 if ( IsClientConnected() ) \
 { \
 	_DAP_INIT_BUF( &m_SendBuf ); \
 	{ \
-		wjson_table_t packet( m_SendBuf ); \
+		_table_t packet( m_SendBuf ); \
 		packet.SetInt( "request_seq", _seq ); \
 		packet.SetString( "type", "response" ); \
 		packet.SetString( "command", _cmd ); \
@@ -248,39 +247,83 @@ if ( IsClientConnected() ) \
 		(void)0
 
 #define DAP_START_RESPONSE( _seq, _cmd ) \
-		_DAP_START_RESPONSE( _seq, _cmd, true )
+		_DAP_START_RESPONSE( _seq, _cmd, true, wjson_table_t )
 
 #define DAP_ERROR_RESPONSE( _seq, _cmd ) \
-		_DAP_START_RESPONSE( _seq, _cmd, false )
+		_DAP_START_RESPONSE( _seq, _cmd, false, wjson_table_t )
 
-#define DAP_ERROR_BODY( _id, _fmt ) \
-		wjson_table_t body = packet.SetTable( "body" ); \
-		wjson_table_t error = body.SetTable( "error" ); \
+// Responses to sqdbg specific requests, written by wtable_t.
+// Handlers are templated on it and instantiated with wcbor_table_t
+// if the client negotiated CBOR
+#define DAP_START_RESPONSE_EXT( _seq, _cmd ) \
+		_DAP_START_RESPONSE( _seq, _cmd, true, wtable_t )
+
+#define DAP_ERROR_RESPONSE_EXT( _seq, _cmd ) \
+		_DAP_START_RESPONSE( _seq, _cmd, false, wtable_t )
+
+#define _DAP_ERROR_BODY( _id, _fmt, _table_t ) \
+		_table_t body = packet.SetTable( "body" ); \
+		_table_t error = body.SetTable( "error" ); \
 		error.SetInt( "id", _id ); \
 		error.SetString( "format", _fmt ); \
 		(void)0
 
-#define DAP_START_EVENT( _seq, _ev ) \
+#define DAP_ERROR_BODY( _id, _fmt ) \
+		_DAP_ERROR_BODY( _id, _fmt, wjson_table_t )
+
+#define DAP_ERROR_BODY_EXT( _id, _fmt ) \
+		_DAP_ERROR_BODY( _id, _fmt, wtable_t )
+
+#define _DAP_START_EVENT( _seq, _ev, _table_t ) \
 { \
 	_DAP_INIT_BUF( &m_SendBuf ); \
 	{ \
-		wjson_table_t packet( m_SendBuf ); \
+		_table_t packet( m_SendBuf ); \
 		packet.SetInt( "seq", _seq ); \
 		packet.SetString( "type", "event" ); \
 		packet.SetString( "event", _ev ); \
 		(void)0
 
+#define DAP_START_EVENT( _seq, _ev ) \
+		_DAP_START_EVENT( _seq, _ev, wjson_table_t )
+
+// sqdbg specific events, written by wtable_t as above. Not broadcast
+#define DAP_START_EVENT_EXT( _seq, _ev ) \
+		_DAP_START_EVENT( _seq, _ev, wtable_t )
+
 #define DAP_SET( _key, _val ) \
 		packet.Set( _key, _val )
 
 #define DAP_SET_TABLE( _val ) \
 		wjson_table_t _val = packet.SetTable( #_val )
 
+#define _DAP_SEND( _droppable, _broadcast ) \
+	} \
+\
+	Send( m_SendBuf.Base(), m_SendBuf.Size(), _droppable, _broadcast ); \
+	DAP_Test( &m_Scratch, &m_SendBuf ); \
+	DAP_Free( &m_SendBuf ); \
+} \
+(void)0
+
 #define DAP_SEND() \
+	_DAP_SEND( false, false )
+
+// Also sent to observers
+#define DAP_SEND_BROADCAST() \
+	_DAP_SEND( false, true )
+
+// Can be dropped if the client isn't keeping up
+#define DAP_SEND_BROADCAST_DROPPABLE() \
+	_DAP_SEND( true, true )
+
+// Broadcast, and sent to observers accepted later until the state is replaced.
+// The state is set first, observers accepted in between get both
+#define DAP_SEND_BROADCAST_STATE() \
 	} \
 \
-	DAP_Serialise( &m_SendBuf ); \
-	Send( m_SendBuf.Base(), m_SendBuf.Size() ); \
+	SetObserverState( m_SendBuf.Base(), m_SendBuf.Size() ); \
+	Send( m_SendBuf.Base(), m_SendBuf.Size(), false, true ); \
 	DAP_Test( &m_Scratch, &m_SendBuf ); \
 	DAP_Free( &m_SendBuf ); \
 } \
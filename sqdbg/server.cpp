@@ -17,9 +17,9 @@
 #include <stdio.h> // snprintf
 #include <stdarg.h>
 #include <new>
+#include <chrono> // steady_clock
 #ifndef SQDBG_DISABLE_PROFILER
 #include <math.h> // isfinite
-#include <chrono> // steady_clock
 #endif
 
 #ifdef SQDBG_NATIVE_STACKTRACE
@@ -86,22 +86,6 @@ STATIC_ASSERT( sizeof(int) == sizeof(int32_t) );
 STATIC_ASSERT( sizeof(short) == sizeof(int16_t) );
 STATIC_ASSERT( sizeof(char) == sizeof(int8_t) );
 
-#ifdef _WIN32
-void sqdbg_sleep( int ms )
-{
-	::Sleep( (DWORD)ms );
-}
-#else
-#include <time.h>
-void sqdbg_sleep( int ms )
-{
-	timespec t;
-	t.tv_nsec = ms * 1000000;
-	t.tv_sec = 0;
-	nanosleep( &t, NULL );
-}
-#endif
-
 #if defined(_MSC_VER)
 	#if !defined(_CPPRTTI)
 		#define SQDBG_NO_RTTI
@@ -749,6 +733,7 @@ private:
 		unsigned int calls;
 		sample_t samples;
 		sample_t sampleStart;
+		sample_t suspended;
 		hnode_t id;
 	};
 
@@ -757,6 +742,24 @@ private:
 		SQString *funcsrc;
 		SQString *funcname;
 	};
+
+	// Generator that yielded from a node
+	struct yieldednode_t
+	{
+		void *generator;
+		hnode_t id;
+		sample_t sampleStart;
+	};
+
+	// Per function totals for butterfly report
+	struct bfnode_t
+	{
+		void *func;
+		hnode_t id;
+		unsigned int calls;
+		sample_t samples;
+		sample_t self;
+	};
 #endif
 
 	struct group_t
@@ -767,6 +770,9 @@ private:
 		sample_t peak;
 		sample_t sampleStart;
 		SQString *tag;
+		hgroup_t parent;
+		hgroup_t next; // hash chain
+		hgroup_t id;
 	};
 
 	static real_t Real( const sample_t &sample )
@@ -806,11 +812,15 @@ private:
 	int m_nPauseLevel;
 	sample_t m_BaseSample;
 #ifndef SQDBG_DISABLE_PROFILER_AUTO
+	bool m_bThreadSuspended;
+	sample_t m_SuspendStart;
 	vector< node_t > m_Nodes;
 	vector< hnode_t > m_CallStack;
+	vector< yieldednode_t > m_YieldedNodes;
 #endif
 	vector< group_t > m_Groups;
 	vector< hgroup_t > m_GroupStack;
+	vector< hgroup_t > m_GroupHash;
 #ifndef SQDBG_DISABLE_PROFILER_AUTO
 	vector< nodetag_t > m_NodeTags;
 #endif
@@ -845,21 +855,102 @@ private:
 	}
 #endif
 
-	group_t *FindGroup( SQString *tag, hgroup_t *idx )
+	static unsigned int HashGroup( hgroup_t parent, SQString *tag )
+	{
+		return (unsigned int)tag->_hash ^ ( parent * 0x9E3779B1u );
+	}
+
+	group_t *FindGroup( hgroup_t parent, SQString *tag, hgroup_t *idx )
 	{
-		for ( hgroup_t i = m_Groups.Size(); i--; )
+		if ( !m_GroupHash.Size() )
+			return NULL;
+
+		hgroup_t i = m_GroupHash[ HashGroup( parent, tag ) & ( m_GroupHash.Size() - 1 ) ];
+
+		while ( i != INVALID_HANDLE )
 		{
 			group_t &group = m_Groups[i];
-			if ( group.tag == tag )
+			if ( group.tag == tag && group.parent == parent )
 			{
 				*idx = i;
 				return &group;
 			}
+
+			i = group.next;
 		}
 
 		return NULL;
 	}
 
+	void HashGroups()
+	{
+		unsigned int size = m_GroupHash.Size() ? m_GroupHash.Size() * 2 : 16;
+
+		while ( size < m_Groups.Size() )
+			size *= 2;
+
+		m_GroupHash.Clear();
+		m_GroupHash.Reserve( size );
+
+		for ( unsigned int i = 0; i < size; i++ )
+			m_GroupHash.Append( INVALID_HANDLE );
+
+		for ( hgroup_t i = 0; i < m_Groups.Size(); i++ )
+		{
+			group_t &group = m_Groups[i];
+			hgroup_t &head = m_GroupHash[ HashGroup( group.parent, group.tag ) & ( size - 1 ) ];
+			group.next = head;
+			head = i;
+		}
+	}
+
+	// Time of a block nested in itself is already in the outer block
+	bool IsNestedInSelf( const group_t &group )
+	{
+		for ( hgroup_t i = group.parent; i != INVALID_HANDLE; i = m_Groups[i].parent )
+		{
+			if ( m_Groups[i].tag == group.tag )
+				return true;
+		}
+
+		return false;
+	}
+
+	bool IsGroupOpen( hgroup_t idx )
+	{
+		for ( unsigned int i = 0; i < m_GroupStack.Size(); i++ )
+		{
+			if ( m_GroupStack[i] == idx )
+				return true;
+		}
+
+		return false;
+	}
+
+public:
+	// Function or group totals detached from the profiler
+	struct snapshotnode_t
+	{
+		SQString *funcname; // group tag
+		SQString *funcsrc; // NULL for groups
+		unsigned int calls;
+		sample_t samples;
+	};
+
+	struct snapshot_t
+	{
+		SQString *name;
+		vector< snapshotnode_t > nodes;
+	};
+
+private:
+	struct diffnode_t
+	{
+		const snapshotnode_t *a;
+		const snapshotnode_t *b;
+		real_t delta;
+	};
+
 public:
 	bool IsEnabled()
 	{
@@ -930,12 +1021,15 @@ public:
 		}
 
 #ifndef SQDBG_DISABLE_PROFILER_AUTO
+		m_bThreadSuspended = false;
 		m_Nodes.Purge();
 		m_NodeTags.Purge();
 		m_CallStack.Purge();
+		m_YieldedNodes.Purge();
 #endif
 		m_Groups.Purge();
 		m_GroupStack.Purge();
+		m_GroupHash.Purge();
 	}
 
 	void Reset( HSQUIRRELVM vm, SQString *tag )
@@ -944,16 +1038,25 @@ public:
 
 		if ( tag )
 		{
-			hgroup_t idx;
-			group_t *group = FindGroup( tag, &idx );
+			// Reset the block in every parent, including where it is nested in itself
+			// so the tree report does not keep stale times
+			sample_t sample = Sample();
 
-			if ( group )
+			for ( hgroup_t i = 0; i < m_Groups.Size(); i++ )
 			{
-				group->hits = 0;
-				group->peakHit = 0;
-				Zero( group->samples );
-				Zero( group->peak );
-				Zero( group->sampleStart );
+				group_t *group = &m_Groups[i];
+
+				if ( group->tag == tag )
+				{
+					group->hits = 0;
+					group->peakHit = 0;
+					Zero( group->samples );
+					Zero( group->peak );
+
+					// Open blocks count from now
+					if ( m_State != kProfPaused && IsGroupOpen( i ) )
+						group->sampleStart = sample;
+				}
 			}
 		}
 #ifndef SQDBG_DISABLE_PROFILER_AUTO
@@ -969,6 +1072,7 @@ public:
 			m_Nodes.Clear();
 			m_NodeTags.Clear();
 			m_CallStack.Clear();
+			m_YieldedNodes.Clear();
 
 			for ( int i = 0; i < vm->_callsstacksize; i++ )
 			{
@@ -986,8 +1090,10 @@ public:
 	{
 		Assert( IsActive() );
 
+		hgroup_t parent = m_GroupStack.Size() ? m_GroupStack.Top() : INVALID_HANDLE;
+
 		hgroup_t idx;
-		group_t *group = FindGroup( tag, &idx );
+		group_t *group = FindGroup( parent, tag, &idx );
 
 		if ( group )
 		{
@@ -997,12 +1103,27 @@ public:
 			return;
 		}
 
-		m_GroupStack.Append( m_Groups.Size() );
+		idx = m_Groups.Size();
+		m_GroupStack.Append( idx );
 
 		group = &m_Groups.Append();
 		group->tag = tag;
 		__ObjAddRef( tag );
+		group->parent = parent;
+		group->id = idx;
 		group->hits = 1;
+
+		if ( m_Groups.Size() > m_GroupHash.Size() )
+		{
+			HashGroups();
+		}
+		else
+		{
+			hgroup_t &head = m_GroupHash[ HashGroup( parent, tag ) & ( m_GroupHash.Size() - 1 ) ];
+			group->next = head;
+			head = idx;
+		}
+
 		group->sampleStart = Sample();
 	}
 
@@ -1144,6 +1265,7 @@ public:
 		node->caller = caller;
 		node->calls = 1;
 		Zero( node->samples );
+		Zero( node->suspended );
 
 #ifdef NO_GARBAGE_COLLECTOR
 		SQSharedState *ss = m_ss;
@@ -1234,8 +1356,302 @@ public:
 		while ( m_CallStack.Size() )
 			CallEnd();
 	}
+
+	// Generator yielded, its frame is suspended until it is resumed
+	void CallYield( void *generator )
+	{
+		Assert( IsActive() );
+
+		if ( !m_CallStack.Size() )
+		{
+			CallEnd();
+			return;
+		}
+
+		hnode_t id = m_CallStack.Top();
+
+		CallEnd();
+
+		// Generators that are never resumed again are not tracked,
+		// drop the oldest
+		if ( m_YieldedNodes.Size() >= 256 )
+			m_YieldedNodes.Remove(0);
+
+		yieldednode_t &yielded = m_YieldedNodes.Append();
+		yielded.generator = generator;
+		yielded.id = id;
+		yielded.sampleStart = Sample();
+	}
+
+	void CallResume( SQFunctionProto *func, void *generator )
+	{
+		Assert( IsActive() );
+
+		for ( unsigned int i = m_YieldedNodes.Size(); i--; )
+		{
+			const yieldednode_t &yielded = m_YieldedNodes[i];
+			if ( yielded.generator == generator )
+			{
+				m_Nodes[ yielded.id ].suspended += Sample() - yielded.sampleStart;
+				m_YieldedNodes.Remove(i);
+				break;
+			}
+		}
+
+		CallBegin( func );
+	}
+
+	// Thread suspended itself, stop its frames until it is woken up
+	void ThreadSuspend()
+	{
+		Assert( IsActive() );
+
+		Pause();
+
+		m_bThreadSuspended = true;
+		m_SuspendStart = Sample();
+	}
+
+	void ThreadWakeup()
+	{
+		Assert( m_bThreadSuspended );
+
+		sample_t dt = Sample() - m_SuspendStart;
+
+		for ( unsigned int i = 0; i < m_CallStack.Size(); i++ )
+		{
+			node_t *node = &m_Nodes[ m_CallStack[i] ];
+			node->suspended += dt;
+		}
+
+		m_bThreadSuspended = false;
+
+		Resume();
+	}
+
+	bool IsThreadSuspended()
+	{
+		return m_bThreadSuspended;
+	}
+#endif
+
+	// Merges all calls of identical functions
+	void Snapshot( snapshot_t *snapshot )
+	{
+		Assert( IsEnabled() );
+		Assert( snapshot->nodes.Size() == 0 );
+
+		sample_t sample = {};
+
+		if ( m_State != kProfPaused )
+			sample = Sample();
+
+#ifndef SQDBG_DISABLE_PROFILER_AUTO
+		snapshot->nodes.Reserve( m_Nodes.Size() + m_Groups.Size() );
+
+		for ( hnode_t i = 0; i < m_Nodes.Size(); i++ )
+		{
+			const node_t &node = m_Nodes[i];
+			const nodetag_t &tag = m_NodeTags[i];
+
+			sample_t samples = node.samples;
+
+			// Within the call frame, take current time
+			if ( m_State != kProfPaused )
+			{
+				for ( unsigned int j = 0; j < m_CallStack.Size(); j++ )
+				{
+					if ( m_CallStack[j] == i )
+					{
+						samples += sample - node.sampleStart;
+						break;
+					}
+				}
+			}
+
+			snapshotnode_t *sn = NULL;
+
+			for ( unsigned int j = 0; j < snapshot->nodes.Size(); j++ )
+			{
+				snapshotnode_t &nj = snapshot->nodes[j];
+				if ( nj.funcname == tag.funcname && nj.funcsrc == tag.funcsrc )
+				{
+					sn = &nj;
+					break;
+				}
+			}
+
+			if ( sn )
+			{
+				sn->calls += node.calls;
+				sn->samples += samples;
+				continue;
+			}
+
+			sn = &snapshot->nodes.Append();
+			sn->funcname = tag.funcname;
+			sn->funcsrc = tag.funcsrc;
+			sn->calls = node.calls;
+			sn->samples = samples;
+
+			__ObjAddRef( sn->funcname );
+			__ObjAddRef( sn->funcsrc );
+		}
+#else
+		snapshot->nodes.Reserve( m_Groups.Size() );
 #endif
 
+		for ( hgroup_t i = 0; i < m_Groups.Size(); i++ )
+		{
+			const group_t &group = m_Groups[i];
+
+			if ( IsNestedInSelf( group ) )
+				continue;
+
+			sample_t samples = group.samples;
+
+			if ( m_State != kProfPaused && IsGroupOpen( i ) )
+				samples += sample - group.sampleStart;
+
+			snapshotnode_t *sn = NULL;
+
+			// Merge the block from all parents
+			for ( unsigned int j = 0; j < snapshot->nodes.Size(); j++ )
+			{
+				snapshotnode_t &nj = snapshot->nodes[j];
+				if ( nj.funcname == group.tag && nj.funcsrc == NULL )
+				{
+					sn = &nj;
+					break;
+				}
+			}
+
+			if ( sn )
+			{
+				sn->calls += group.hits;
+				sn->samples += samples;
+				continue;
+			}
+
+			sn = &snapshot->nodes.Append();
+			sn->funcname = group.tag;
+			sn->funcsrc = NULL;
+			sn->calls = group.hits;
+			sn->samples = samples;
+
+			__ObjAddRef( sn->funcname );
+		}
+	}
+
+	void ResetGroups()
+	{
+		Assert( IsEnabled() );
+
+		sample_t sample = Sample();
+
+		for ( hgroup_t i = 0; i < m_Groups.Size(); i++ )
+		{
+			group_t *group = &m_Groups[i];
+			group->hits = 0;
+			group->peakHit = 0;
+			Zero( group->samples );
+			Zero( group->peak );
+		}
+
+		// Time of open blocks up to now was included in the flushed snapshot
+		if ( m_State != kProfPaused )
+		{
+			for ( unsigned int i = 0; i < m_GroupStack.Size(); i++ )
+				m_Groups[ m_GroupStack[i] ].sampleStart = sample;
+		}
+	}
+
+	// Compact binary form of a snapshot, little endian:
+	//   u32 node count
+	//   node: u8 flags (1: group), u32 calls, u64 time (ns),
+	//         u16 name length, name (UTF-8), u16 source length, source (UTF-8)
+	static int GetMaxSerialisedLen( const snapshot_t &snapshot )
+	{
+		int len = 4;
+
+		for ( unsigned int i = 0; i < snapshot.nodes.Size(); i++ )
+		{
+			const snapshotnode_t &node = snapshot.nodes[i];
+			len += 1 + 4 + 8 + 2 + 2;
+			len += (int)scstombslen( node.funcname->_val, node.funcname->_len );
+			if ( node.funcsrc )
+				len += (int)scstombslen( node.funcsrc->_val, node.funcsrc->_len );
+		}
+
+		return len;
+	}
+
+	// Returns byte length
+	static int Serialise( const snapshot_t &snapshot, unsigned char *buf, int size )
+	{
+		const unsigned char *bufstart = buf;
+
+		PutLE( buf, snapshot.nodes.Size(), 4 );
+
+		for ( unsigned int i = 0; i < snapshot.nodes.Size(); i++ )
+		{
+			const snapshotnode_t &node = snapshot.nodes[i];
+
+			long long ns = std::chrono::duration_cast< std::chrono::nanoseconds >( node.samples ).count();
+			if ( ns < 0 )
+				ns = 0;
+
+			PutLE( buf, node.funcsrc ? 0 : 1, 1 );
+			PutLE( buf, node.calls, 4 );
+			PutLE( buf, (unsigned long long)ns, 8 );
+
+			PutStringLE( buf, node.funcname );
+			PutStringLE( buf, node.funcsrc );
+		}
+
+		Assert( (int)( buf - bufstart ) <= size );
+		(void)size;
+
+		return (int)( buf - bufstart );
+	}
+
+	static void PutLE( unsigned char *&buf, unsigned long long val, int bytes )
+	{
+		for ( int i = 0; i < bytes; i++ )
+			*buf++ = (unsigned char)( val >> ( i * 8 ) );
+	}
+
+private:
+	static void PutStringLE( unsigned char *&buf, const SQString *str )
+	{
+		unsigned int len = 0;
+
+		if ( str )
+		{
+			len = scstombs( (char*)buf + 2, scstombslen( str->_val, str->_len ), str->_val, str->_len );
+
+			if ( len > 0xFFFF )
+				len = 0xFFFF;
+		}
+
+		PutLE( buf, len, 2 );
+		buf += len;
+	}
+
+public:
+	static void ReleaseSnapshot( snapshot_t *snapshot )
+	{
+		for ( unsigned int i = 0; i < snapshot->nodes.Size(); i++ )
+		{
+			snapshotnode_t *node = &snapshot->nodes[i];
+			__ObjRelease( node->funcname );
+			__ObjRelease( node->funcsrc );
+		}
+
+		__ObjRelease( snapshot->name );
+		snapshot->nodes.Purge();
+	}
+
 #ifndef SQDBG_CALLGRAPH_MAX_DEPTH
 #define SQDBG_CALLGRAPH_MAX_DEPTH 10
 #endif
@@ -1243,6 +1659,12 @@ public:
 #define PROF_OUTPUT_HEADER "   %   total time  time/call      calls  func\n"
 //                         "100.00  100.00 ms  100.00 ms 4294967295  func\n"
 
+#define PROF_BUTTERFLY_OUTPUT_HEADER "   %   total time  self time      calls  func\n"
+//                                   "100.00  100.00 ms  100.00 ms 4294967295    <- func\n"
+
+#define PROF_COROUTINE_OUTPUT_HEADER "  wall time     active  suspended      calls  func\n"
+//                                   "  100.00 ms  100.00 ms  100.00 ms 4294967295  func\n"
+
 #define PROF_GROUP_OUTPUT_START \
 	"(sqdbg) prof | "
 
@@ -1254,6 +1676,9 @@ public:
 #define PROF_GROUP_NAME_LEN_ALIGNMENT 16
 #endif
 
+#define PROF_GROUP_TREE_OUTPUT_HEADER "   %   total time  self time   time/hit       hits  block\n"
+//                                    "100.00  100.00 ms  100.00 ms  100.00 ms 4294967295  block\n"
+
 	// Returns character length
 	int GetMaxOutputLen( SQString *tag, int type )
 	{
@@ -1264,6 +1689,27 @@ public:
 				1;
 		}
 
+		// group tree
+		if ( type == 2 )
+		{
+			const int header = STRLEN(PROF_GROUP_TREE_OUTPUT_HEADER);
+			const int bufsize = header + m_Groups.Size() *
+				( header - STRLEN("block") +
+				  // depth[SQDBG_CALLGRAPH_MAX_DEPTH*3]block\n
+				  SQDBG_CALLGRAPH_MAX_DEPTH * 3 ) +
+				1;
+
+			int len = 0;
+
+			for ( hgroup_t i = 0; i < m_Groups.Size(); i++ )
+			{
+				const group_t &group = m_Groups[i];
+				len += (int)group.tag->_len;
+			}
+
+			return bufsize + len;
+		}
+
 #ifndef SQDBG_DISABLE_PROFILER_AUTO
 		switch ( type )
 		{
@@ -1316,10 +1762,59 @@ public:
 
 				return bufsize + len;
 			}
-			default:
+			// butterfly
+			case 3:
 			{
-				return 0;
-			}
+				int maxlen = 0;
+
+				for ( hnode_t i = 0; i < m_NodeTags.Size(); i++ )
+				{
+					nodetag_t *node = &m_NodeTags[i];
+					int len = (int)node->funcsrc->_len + (int)node->funcname->_len;
+					if ( maxlen < len )
+						maxlen = len;
+				}
+
+				// Each node adds at most one function, one caller and one callee line,
+				// each function adds a separator line
+				const int header = STRLEN(PROF_BUTTERFLY_OUTPUT_HEADER);
+				return header + m_Nodes.Size() * 4 *
+					( header - STRLEN("func") +
+					  // <- func, src (addr)\n
+					  /*<- */ 5 +
+					  /*func*/ 2 +
+					  2 + FMT_PTR_LEN +
+					  1 +
+					  maxlen ) +
+					1;
+			}
+			// coroutine
+			case 4:
+			{
+				const int header = STRLEN(PROF_COROUTINE_OUTPUT_HEADER);
+				const int bufsize = header + m_Nodes.Size() *
+					( header - STRLEN("func") +
+					  // func, src (addr)\n
+					  2 +
+					  2 + FMT_PTR_LEN + 1 +
+					  1 ) +
+					1;
+
+				int len = 0;
+
+				for ( hnode_t i = 0; i < m_NodeTags.Size(); i++ )
+				{
+					nodetag_t *node = &m_NodeTags[i];
+					len += (int)node->funcsrc->_len;
+					len += (int)node->funcname->_len;
+				}
+
+				return bufsize + len;
+			}
+			default:
+			{
+				return 0;
+			}
 		}
 #else
 		(void)type;
@@ -1334,12 +1829,31 @@ public:
 
 		if ( tag )
 		{
-			hgroup_t idx;
-			const group_t *group = FindGroup( tag, &idx );
+			// Sum of the block in every parent
+			group_t total = {};
+
+			for ( hgroup_t i = 0; i < m_Groups.Size(); i++ )
+			{
+				const group_t &g = m_Groups[i];
+
+				if ( g.tag == tag && !IsNestedInSelf( g ) )
+				{
+					total.tag = tag;
+					total.hits += g.hits;
+					total.samples += g.samples;
+
+					if ( total.peak < g.peak )
+					{
+						total.peak = g.peak;
+						total.peakHit = g.peakHit;
+					}
+				}
+			}
 
-			if ( !group )
+			if ( !total.tag )
 				return 0;
 
+			const group_t *group = &total;
 			const SQChar *bufstart = buf;
 
 			int len = STRLEN(PROF_GROUP_OUTPUT_START);
@@ -1424,7 +1938,53 @@ public:
 			return (int)( buf - bufstart );
 		}
 
+		// group tree
+		if ( type == 2 )
+		{
+			vector< group_t > groups( m_Groups );
+			hgroup_t groupcount = groups.Size();
+			sample_t totalSamples = {};
+			const SQChar *bufstart = buf;
+
+			groups.Sort( _sortgroup );
+
+			for ( hgroup_t i = 0; i < groupcount; i++ )
+			{
+				const group_t &group = groups[i];
+				if ( group.parent != INVALID_HANDLE )
+					break;
+
+				totalSamples += group.samples;
+			}
+
+			int len = STRLEN(PROF_GROUP_TREE_OUTPUT_HEADER);
+			memcpy( buf, _SC(PROF_GROUP_TREE_OUTPUT_HEADER), sq_rsl(len) );
+			buf += len; size -= len;
+
+			for ( hgroup_t i = 0; i < groupcount; i++ )
+			{
+				const group_t &group = groups[i];
+				if ( group.parent != INVALID_HANDLE )
+					break;
+
+				DoPrintGroup( groups, i, Real( totalSamples ), 0, buf, size );
+			}
+
+			*buf = 0;
+
+			Assert( size > 0 );
+			Assert( (int)scstrlen( bufstart ) == (int)( buf - bufstart ) );
+
+			return (int)( buf - bufstart );
+		}
+
 #ifndef SQDBG_DISABLE_PROFILER_AUTO
+		if ( type == 3 )
+			return OutputButterfly( buf, size );
+
+		if ( type == 4 )
+			return OutputCoroutines( buf, size );
+
 		sample_t sample = {};
 
 		if ( m_CallStack.Size() && m_State != kProfPaused )
@@ -1526,194 +2086,137 @@ public:
 #endif
 	}
 
-private:
-#ifndef SQDBG_DISABLE_PROFILER_AUTO
-	void DoPrint( const vector< node_t > &nodes, hnode_t i,
-			real_t totalSamples, int depth, SQChar *&buf, int &size )
-	{
-		const node_t &node = nodes[i];
+#define PROF_DIFF_OUTPUT_HEADER "    total       delta  time/call       delta       calls        delta  func\n"
+//                              "100.00 ms  +100.00 ms  100.00 ms  +100.00 ms  4294967295  +4294967295  func\n"
 
-		real_t samples = Real( node.samples );
-		real_t frac = ( samples / totalSamples ) * 100.0;
-		real_t avg = samples / (real_t)node.calls;
+	// Returns character length
+	static int GetMaxDiffOutputLen( const snapshot_t &a, const snapshot_t &b )
+	{
+		const int header = STRLEN(PROF_DIFF_OUTPUT_HEADER);
+		const int bufsize = header + ( a.nodes.Size() + b.nodes.Size() ) *
+			( header - STRLEN("func") +
+			  // func, src\n
+			  /*func*/ 2 +
+			  1 ) +
+			1;
 
-		int len;
+		int len = 0;
 
-		if ( !IsZero( node.samples ) && isfinite( frac ) )
+		for ( unsigned int i = 0; i < a.nodes.Size(); i++ )
 		{
-			if ( frac > 100.0 )
-				frac = 100.0;
-
-			len = scsprintf( buf, size, _SC("%6.2f "), frac ) - 1;
-			buf += len; size -= len;
+			const snapshotnode_t &node = a.nodes[i];
+			len += (int)node.funcname->_len;
+			if ( node.funcsrc )
+				len += (int)node.funcsrc->_len;
 		}
-		else
-		{
-			*buf++ = ' '; size--;
-			*buf++ = ' '; size--;
-			*buf++ = ' '; size--;
 
-			len = STRLEN("N/A");
-			memcpy( buf, _SC("N/A"), sq_rsl(len) );
-			buf += len; size -= len;
+		for ( unsigned int i = 0; i < b.nodes.Size(); i++ )
+		{
+			const snapshotnode_t &node = b.nodes[i];
+			len += (int)node.funcname->_len;
+			if ( node.funcsrc )
+				len += (int)node.funcsrc->_len;
 		}
 
-		*buf++ = ' '; size--;
-		*buf++ = ' '; size--;
-
-		PrintTime( samples, buf, size );
-
-		*buf++ = ' '; size--;
-		*buf++ = ' '; size--;
-
-		PrintTime( avg, buf, size );
+		return bufsize + len;
+	}
 
-		*buf++ = ' '; size--;
+	// Changes from a to b, largest total time regression first.
+	// Returns character length
+	static int OutputDiff( const snapshot_t &a, const snapshot_t &b, SQChar *buf, int size )
+	{
+		Assert( size > 0 );
 
-		// right align
-		len = FMT_UINT32_LEN - countdigits( node.calls );
+		vector< diffnode_t > nodes;
+		nodes.Reserve( a.nodes.Size() + b.nodes.Size() );
 
-		while ( len-- )
+		for ( unsigned int i = 0; i < b.nodes.Size(); i++ )
 		{
-			*buf++ = ' ';
-			size--;
-		}
-
-		len = printint( buf, size, node.calls );
-		buf += len; size -= len;
-
-		*buf++ = ' '; size--;
-		*buf++ = ' '; size--;
+			const snapshotnode_t &nb = b.nodes[i];
 
-		STATIC_ASSERT( SQDBG_CALLGRAPH_MAX_DEPTH >= 3 && SQDBG_CALLGRAPH_MAX_DEPTH <= 9999 );
+			diffnode_t *node = &nodes.Append();
+			node->a = NULL;
+			node->b = &nb;
 
-		if ( depth <= SQDBG_CALLGRAPH_MAX_DEPTH )
-		{
-			for ( int d = depth; d--; )
+			for ( unsigned int j = 0; j < a.nodes.Size(); j++ )
 			{
-				*buf++ = '|';
-				*buf++ = ' ';
-				*buf++ = ' ';
+				const snapshotnode_t &na = a.nodes[j];
+				if ( na.funcname == nb.funcname && na.funcsrc == nb.funcsrc )
+				{
+					node->a = &na;
+					break;
+				}
 			}
 
-			size -= depth * 3;
+			node->delta = Real( nb.samples ) - ( node->a ? Real( node->a->samples ) : 0.0 );
 		}
-		else
-		{
-			for ( int d = SQDBG_CALLGRAPH_MAX_DEPTH - 2; d--; )
-			{
-				*buf++ = '|'; size--;
-				*buf++ = ' '; size--;
-				*buf++ = ' '; size--;
-			}
-
-			buf--; size++;
-
-			if ( depth < 10000 )
-			{
-				len = printint( buf, size, depth );
-			}
-			else
-			{
-				len = STRLEN("999+");
-				memcpy( buf, _SC("999+"), sq_rsl(len) );
-			}
 
-			buf += len; size -= len;
+		// Removed functions
+		for ( unsigned int i = 0; i < a.nodes.Size(); i++ )
+		{
+			const snapshotnode_t &na = a.nodes[i];
+			bool found = false;
 
-			for ( int d = ( ( len + 2 ) / 3 ) * 3; d-- > len; )
+			for ( unsigned int j = 0; j < b.nodes.Size(); j++ )
 			{
-				*buf++ = ' ';
-				size--;
+				const snapshotnode_t &nb = b.nodes[j];
+				if ( na.funcname == nb.funcname && na.funcsrc == nb.funcsrc )
+				{
+					found = true;
+					break;
+				}
 			}
 
-			*buf++ = ' '; size--;
-
-			len = ( ( len + 2 ) / 3 ) * 3;
-
-			for ( int d = ( ( 2 ) * 3 - len ) / 3; d--; )
+			if ( !found )
 			{
-				*buf++ = '|'; size--;
-				*buf++ = ' '; size--;
-				*buf++ = ' '; size--;
+				diffnode_t *node = &nodes.Append();
+				node->a = &na;
+				node->b = NULL;
+				node->delta = -Real( na.samples );
 			}
-
-			*(buf-1) = '.';
-			*(buf-2) = '.';
 		}
 
-		const nodetag_t &tag = m_NodeTags[node.id];
-
-		len = tag.funcname->_len;
-		memcpy( buf, tag.funcname->_val, sq_rsl(len) );
-		buf += len; size -= len;
+		nodes.Sort( _sortdiff );
 
-		*buf++ = ','; size--;
-		*buf++ = ' '; size--;
+		const SQChar *bufstart = buf;
 
-		len = tag.funcsrc->_len;
-		memcpy( buf, tag.funcsrc->_val, sq_rsl(len) );
+		int len = STRLEN(PROF_DIFF_OUTPUT_HEADER);
+		memcpy( buf, _SC(PROF_DIFF_OUTPUT_HEADER), sq_rsl(len) );
 		buf += len; size -= len;
 
-		if ( tag.funcname->_val[0] != '0' )
+		for ( unsigned int i = 0; i < nodes.Size(); i++ )
 		{
-			*buf++ = ' '; size--;
-			*buf++ = '('; size--;
-			len = printhex( buf, size, (uintptr_t)node.func );
-			buf += len; size -= len;
-			*buf++ = ')'; size--;
-		}
+			const diffnode_t &node = nodes[i];
+			const snapshotnode_t *sn = node.b ? node.b : node.a;
 
-		*buf++ = '\n'; size--;
-
-		int more = 0;
-		avg = 0.0;
+			unsigned int callsA = node.a ? node.a->calls : 0;
+			unsigned int callsB = node.b ? node.b->calls : 0;
+			real_t samplesA = node.a ? Real( node.a->samples ) : 0.0;
+			real_t samplesB = node.b ? Real( node.b->samples ) : 0.0;
+			real_t avgB = samplesB / (real_t)callsB;
 
-		for ( hnode_t j = i + 1; j < nodes.Size(); j++ )
-		{
-			const node_t &nj = nodes[j];
-			if ( nj.caller == node.id )
-			{
-				// Prevent stack overflow
-				// Limit should be at most 3 digits for the depth print
-				if ( depth < 100 )
-				{
-					DoPrint( nodes, j, totalSamples, depth+1, buf, size );
-				}
-				else
-				{
-					avg =
-						( (real_t)more * avg + ( Real( nj.samples ) / (real_t)nj.calls ) ) /
-						(real_t)( more + 1 );
-					more++;
-				}
-			}
-		}
+			PrintTime( samplesB, buf, size );
 
-		if ( more )
-		{
-			*buf++ = ' '; size--;
 			*buf++ = ' '; size--;
 			*buf++ = ' '; size--;
 
-			len = STRLEN("N/A");
-			memcpy( buf, _SC("N/A"), sq_rsl(len) );
-			buf += len; size -= len;
+			PrintTimeDelta( node.delta, buf, size );
 
 			*buf++ = ' '; size--;
 			*buf++ = ' '; size--;
 
-			PrintTime( NAN, buf, size );
+			PrintTime( avgB, buf, size );
 
 			*buf++ = ' '; size--;
 			*buf++ = ' '; size--;
 
-			PrintTime( avg, buf, size );
+			PrintTimeDelta( ( callsA && callsB ) ? avgB - samplesA / (real_t)callsA : NAN, buf, size );
 
+			*buf++ = ' '; size--;
 			*buf++ = ' '; size--;
 
 			// right align
-			len = FMT_UINT32_LEN - STRLEN("N/A");
+			len = FMT_UINT32_LEN - countdigits( callsB );
 
 			while ( len-- )
 			{
@@ -1721,48 +2224,779 @@ private:
 				size--;
 			}
 
-			len = STRLEN("N/A");
-			memcpy( buf, _SC("N/A"), sq_rsl(len) );
+			len = printint( buf, size, callsB );
 			buf += len; size -= len;
 
 			*buf++ = ' '; size--;
 			*buf++ = ' '; size--;
 
-			for ( int d = SQDBG_CALLGRAPH_MAX_DEPTH; d--; )
+			unsigned int dcalls = callsB >= callsA ? callsB - callsA : callsA - callsB;
+
+			// right align
+			len = FMT_UINT32_LEN - countdigits( dcalls );
+
+			while ( len-- )
 			{
-				*buf++ = '|';
-				*buf++ = ' ';
 				*buf++ = ' ';
+				size--;
 			}
 
-			size -= SQDBG_CALLGRAPH_MAX_DEPTH * 3;
+			*buf++ = callsB > callsA ? '+' : callsB < callsA ? '-' : ' '; size--;
 
-			*(buf-1) = '.';
-			*(buf-2) = '.';
+			len = printint( buf, size, dcalls );
+			buf += len; size -= len;
 
+			*buf++ = ' '; size--;
 			*buf++ = ' '; size--;
 
-			len = printint( buf, size, more );
+			len = sn->funcname->_len;
+			memcpy( buf, sn->funcname->_val, sq_rsl(len) );
 			buf += len; size -= len;
 
-			len = STRLEN(" more");
-			memcpy( buf, _SC(" more"), sq_rsl(len) );
-			buf += len; size -= len;
+			if ( sn->funcsrc )
+			{
+				*buf++ = ','; size--;
+				*buf++ = ' '; size--;
+
+				len = sn->funcsrc->_len;
+				memcpy( buf, sn->funcsrc->_val, sq_rsl(len) );
+				buf += len; size -= len;
+			}
 
 			*buf++ = '\n'; size--;
 		}
-	}
-#endif
 
-	// Print time and its unit to 9 chars: "000.00 ms"
-	static void PrintTime( real_t ns, SQChar *&buf, int &size )
-	{
-		int len;
+		*buf = 0;
 
-		// because a value less than 1000.0
-		// is not guaranteed to print less than 1000.0
-#define FIX_FLT_PRINT() \
-		if ( len == 8 ) \
+		Assert( size > 0 );
+		Assert( (int)scstrlen( bufstart ) == (int)( buf - bufstart ) );
+
+		return (int)( buf - bufstart );
+	}
+
+private:
+#ifndef SQDBG_DISABLE_PROFILER_AUTO
+	// Callers and callees of each function with their share of its time
+	int OutputButterfly( SQChar *buf, int size )
+	{
+		sample_t sample = {};
+
+		if ( m_CallStack.Size() && m_State != kProfPaused )
+			sample = Sample();
+
+		hnode_t nodecount = m_Nodes.Size();
+		vector< sample_t > samples;
+		vector< sample_t > selfs;
+		samples.Reserve( nodecount );
+		selfs.Reserve( nodecount );
+
+		for ( hnode_t i = 0; i < nodecount; i++ )
+			samples.Append( m_Nodes[i].samples );
+
+		// Within the call frame, take current time
+		if ( m_State != kProfPaused )
+		{
+			for ( unsigned int i = 0; i < m_CallStack.Size(); i++ )
+			{
+				hnode_t id = m_CallStack[i];
+				samples[id] += sample - m_Nodes[id].sampleStart;
+			}
+		}
+
+		// Exclusive time
+		for ( hnode_t i = 0; i < nodecount; i++ )
+			selfs.Append( samples[i] );
+
+		for ( hnode_t i = 0; i < nodecount; i++ )
+		{
+			const node_t &node = m_Nodes[i];
+			if ( node.caller != INVALID_HANDLE )
+				selfs[ node.caller ] -= samples[i];
+		}
+
+		sample_t totalSamples = {};
+		vector< bfnode_t > funcs;
+
+		for ( hnode_t i = 0; i < nodecount; i++ )
+		{
+			const node_t &node = m_Nodes[i];
+
+			if ( node.caller == INVALID_HANDLE )
+				totalSamples += samples[i];
+
+			AddButterflyNode( funcs, node.func, i, node.calls, samples[i], selfs[i] );
+		}
+
+		funcs.Sort( _sortbf );
+
+		vector< hnode_t > funcOf;
+		funcOf.Reserve( nodecount );
+
+		for ( hnode_t i = 0; i < nodecount; i++ )
+		{
+			for ( hnode_t j = 0; j < funcs.Size(); j++ )
+			{
+				if ( funcs[j].func == m_Nodes[i].func )
+				{
+					funcOf.Append( j );
+					break;
+				}
+			}
+		}
+
+		Assert( funcOf.Size() == nodecount );
+
+		real_t flTotalSamples = Real( totalSamples );
+		const SQChar *bufstart = buf;
+
+		int len = STRLEN(PROF_BUTTERFLY_OUTPUT_HEADER);
+		memcpy( buf, _SC(PROF_BUTTERFLY_OUTPUT_HEADER), sq_rsl(len) );
+		buf += len; size -= len;
+
+		vector< bfnode_t > edges;
+
+		for ( hnode_t f = 0; f < funcs.Size(); f++ )
+		{
+			edges.Clear();
+
+			for ( hnode_t i = 0; i < nodecount; i++ )
+			{
+				const node_t &node = m_Nodes[i];
+				if ( funcOf[i] == f && node.caller != INVALID_HANDLE )
+				{
+					const bfnode_t &caller = funcs[ funcOf[ node.caller ] ];
+					AddButterflyNode( edges, caller.func, caller.id, node.calls, samples[i], selfs[i] );
+				}
+			}
+
+			edges.Sort( _sortbf );
+
+			for ( hnode_t i = 0; i < edges.Size(); i++ )
+				DoPrintButterfly( edges[i], -1.0, _SC("  <- "), buf, size );
+
+			DoPrintButterfly( funcs[f], flTotalSamples, NULL, buf, size );
+
+			edges.Clear();
+
+			for ( hnode_t i = 0; i < nodecount; i++ )
+			{
+				const node_t &node = m_Nodes[i];
+				if ( node.caller != INVALID_HANDLE && funcOf[ node.caller ] == f )
+				{
+					const bfnode_t &callee = funcs[ funcOf[i] ];
+					AddButterflyNode( edges, callee.func, callee.id, node.calls, samples[i], selfs[i] );
+				}
+			}
+
+			edges.Sort( _sortbf );
+
+			for ( hnode_t i = 0; i < edges.Size(); i++ )
+				DoPrintButterfly( edges[i], -1.0, _SC("  -> "), buf, size );
+
+			*buf++ = '\n'; size--;
+		}
+
+		*buf = 0;
+
+		Assert( size > 0 );
+		Assert( (int)scstrlen( bufstart ) == (int)( buf - bufstart ) );
+
+		return (int)( buf - bufstart );
+	}
+
+	// Functions that were suspended by yield or thread suspend,
+	// active time excludes and wall time includes time spent suspended
+	int OutputCoroutines( SQChar *buf, int size )
+	{
+		sample_t sample = Sample();
+
+		hnode_t nodecount = m_Nodes.Size();
+		vector< bfnode_t > funcs;
+
+		for ( hnode_t i = 0; i < nodecount; i++ )
+		{
+			const node_t &node = m_Nodes[i];
+			sample_t samples = node.samples;
+			sample_t suspended = node.suspended;
+
+			for ( unsigned int j = 0; j < m_CallStack.Size(); j++ )
+			{
+				if ( m_CallStack[j] == i )
+				{
+					// Within the call frame, take current time
+					if ( m_State != kProfPaused )
+					{
+						samples += sample - node.sampleStart;
+					}
+					else if ( m_bThreadSuspended )
+					{
+						suspended += sample - m_SuspendStart;
+					}
+
+					break;
+				}
+			}
+
+			for ( unsigned int j = 0; j < m_YieldedNodes.Size(); j++ )
+			{
+				if ( m_YieldedNodes[j].id == i )
+					suspended += sample - m_YieldedNodes[j].sampleStart;
+			}
+
+			// self is used for suspended time
+			AddButterflyNode( funcs, node.func, i, node.calls, samples, suspended );
+		}
+
+		for ( hnode_t i = 0; i < funcs.Size(); i++ )
+		{
+			if ( IsZero( funcs[i].self ) )
+			{
+				funcs.Remove(i);
+				i--;
+			}
+			else
+			{
+				funcs[i].samples += funcs[i].self;
+			}
+		}
+
+		funcs.Sort( _sortbf );
+
+		const SQChar *bufstart = buf;
+
+		int len = STRLEN(PROF_COROUTINE_OUTPUT_HEADER);
+		memcpy( buf, _SC(PROF_COROUTINE_OUTPUT_HEADER), sq_rsl(len) );
+		buf += len; size -= len;
+
+		for ( hnode_t i = 0; i < funcs.Size(); i++ )
+		{
+			const bfnode_t &node = funcs[i];
+			const nodetag_t &tag = m_NodeTags[node.id];
+
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			PrintTime( Real( node.samples ), buf, size );
+
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			PrintTime( Real( node.samples - node.self ), buf, size );
+
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			PrintTime( Real( node.self ), buf, size );
+
+			*buf++ = ' '; size--;
+
+			// right align
+			len = FMT_UINT32_LEN - countdigits( node.calls );
+
+			while ( len-- )
+			{
+				*buf++ = ' ';
+				size--;
+			}
+
+			len = printint( buf, size, node.calls );
+			buf += len; size -= len;
+
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			len = tag.funcname->_len;
+			memcpy( buf, tag.funcname->_val, sq_rsl(len) );
+			buf += len; size -= len;
+
+			*buf++ = ','; size--;
+			*buf++ = ' '; size--;
+
+			len = tag.funcsrc->_len;
+			memcpy( buf, tag.funcsrc->_val, sq_rsl(len) );
+			buf += len; size -= len;
+
+			if ( tag.funcname->_val[0] != '0' )
+			{
+				*buf++ = ' '; size--;
+				*buf++ = '('; size--;
+				len = printhex( buf, size, (uintptr_t)node.func );
+				buf += len; size -= len;
+				*buf++ = ')'; size--;
+			}
+
+			*buf++ = '\n'; size--;
+		}
+
+		*buf = 0;
+
+		Assert( size > 0 );
+		Assert( (int)scstrlen( bufstart ) == (int)( buf - bufstart ) );
+
+		return (int)( buf - bufstart );
+	}
+
+	static void AddButterflyNode( vector< bfnode_t > &list, void *func, hnode_t id,
+			unsigned int calls, const sample_t &samples, const sample_t &self )
+	{
+		for ( hnode_t i = 0; i < list.Size(); i++ )
+		{
+			bfnode_t &node = list[i];
+			if ( node.func == func )
+			{
+				node.calls += calls;
+				node.samples += samples;
+				node.self += self;
+				return;
+			}
+		}
+
+		bfnode_t &node = list.Append();
+		node.func = func;
+		node.id = id;
+		node.calls = calls;
+		node.samples = samples;
+		node.self = self;
+	}
+
+	// Function line if prefix is NULL
+	void DoPrintButterfly( const bfnode_t &node, real_t totalSamples, const SQChar *prefix,
+			SQChar *&buf, int &size )
+	{
+		real_t samples = Real( node.samples );
+		real_t self = Real( node.self );
+
+		int len;
+
+		if ( !prefix )
+		{
+			real_t frac = ( samples / totalSamples ) * 100.0;
+
+			if ( !IsZero( node.samples ) && isfinite( frac ) )
+			{
+				if ( frac > 100.0 )
+					frac = 100.0;
+
+				len = scsprintf( buf, size, _SC("%6.2f "), frac ) - 1;
+				buf += len; size -= len;
+			}
+			else
+			{
+				*buf++ = ' '; size--;
+				*buf++ = ' '; size--;
+				*buf++ = ' '; size--;
+
+				len = STRLEN("N/A");
+				memcpy( buf, _SC("N/A"), sq_rsl(len) );
+				buf += len; size -= len;
+			}
+		}
+		else
+		{
+			for ( int i = 6; i--; )
+			{
+				*buf++ = ' ';
+				size--;
+			}
+		}
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		PrintTime( samples, buf, size );
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		// recursive calls can have negative exclusive time in merged nodes
+		PrintTime( self > 0.0 ? self : 0.0, buf, size );
+
+		*buf++ = ' '; size--;
+
+		// right align
+		len = FMT_UINT32_LEN - countdigits( node.calls );
+
+		while ( len-- )
+		{
+			*buf++ = ' ';
+			size--;
+		}
+
+		len = printint( buf, size, node.calls );
+		buf += len; size -= len;
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		if ( prefix )
+		{
+			len = 5;
+			memcpy( buf, prefix, sq_rsl(len) );
+			buf += len; size -= len;
+		}
+
+		const nodetag_t &tag = m_NodeTags[node.id];
+
+		len = tag.funcname->_len;
+		memcpy( buf, tag.funcname->_val, sq_rsl(len) );
+		buf += len; size -= len;
+
+		*buf++ = ','; size--;
+		*buf++ = ' '; size--;
+
+		len = tag.funcsrc->_len;
+		memcpy( buf, tag.funcsrc->_val, sq_rsl(len) );
+		buf += len; size -= len;
+
+		if ( !prefix && tag.funcname->_val[0] != '0' )
+		{
+			*buf++ = ' '; size--;
+			*buf++ = '('; size--;
+			len = printhex( buf, size, (uintptr_t)node.func );
+			buf += len; size -= len;
+			*buf++ = ')'; size--;
+		}
+
+		*buf++ = '\n'; size--;
+	}
+#endif
+
+	void DoPrintGroup( const vector< group_t > &groups, hgroup_t i,
+			real_t totalSamples, int depth, SQChar *&buf, int &size )
+	{
+		const group_t &group = groups[i];
+
+		// Exclusive time, children can be anywhere as they are not guaranteed
+		// to have less samples if they were reset or ended out of order
+		sample_t self = group.samples;
+
+		for ( hgroup_t j = 0; j < groups.Size(); j++ )
+		{
+			const group_t &gj = groups[j];
+			if ( gj.parent == group.id )
+				self -= gj.samples;
+		}
+
+		if ( self < self.zero() )
+			Zero( self );
+
+		real_t samples = Real( group.samples );
+		real_t frac = ( samples / totalSamples ) * 100.0;
+
+		int len;
+
+		if ( !IsZero( group.samples ) && isfinite( frac ) )
+		{
+			if ( frac > 100.0 )
+				frac = 100.0;
+
+			len = scsprintf( buf, size, _SC("%6.2f "), frac ) - 1;
+			buf += len; size -= len;
+		}
+		else
+		{
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			len = STRLEN("N/A");
+			memcpy( buf, _SC("N/A"), sq_rsl(len) );
+			buf += len; size -= len;
+		}
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		PrintTime( samples, buf, size );
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		PrintTime( Real( self ), buf, size );
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		PrintTime( samples / (real_t)group.hits, buf, size );
+
+		*buf++ = ' '; size--;
+
+		// right align
+		len = FMT_UINT32_LEN - countdigits( group.hits );
+
+		while ( len-- )
+		{
+			*buf++ = ' ';
+			size--;
+		}
+
+		len = printint( buf, size, group.hits );
+		buf += len; size -= len;
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		for ( int d = min( depth, SQDBG_CALLGRAPH_MAX_DEPTH ); d--; )
+		{
+			*buf++ = '|'; size--;
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+		}
+
+		len = group.tag->_len;
+		memcpy( buf, group.tag->_val, sq_rsl(len) );
+		buf += len; size -= len;
+
+		*buf++ = '\n'; size--;
+
+		// Prevent stack overflow
+		if ( depth >= 100 )
+			return;
+
+		for ( hgroup_t j = 0; j < groups.Size(); j++ )
+		{
+			const group_t &gj = groups[j];
+			if ( gj.parent == group.id )
+				DoPrintGroup( groups, j, totalSamples, depth+1, buf, size );
+		}
+	}
+
+#ifndef SQDBG_DISABLE_PROFILER_AUTO
+	void DoPrint( const vector< node_t > &nodes, hnode_t i,
+			real_t totalSamples, int depth, SQChar *&buf, int &size )
+	{
+		const node_t &node = nodes[i];
+
+		real_t samples = Real( node.samples );
+		real_t frac = ( samples / totalSamples ) * 100.0;
+		real_t avg = samples / (real_t)node.calls;
+
+		int len;
+
+		if ( !IsZero( node.samples ) && isfinite( frac ) )
+		{
+			if ( frac > 100.0 )
+				frac = 100.0;
+
+			len = scsprintf( buf, size, _SC("%6.2f "), frac ) - 1;
+			buf += len; size -= len;
+		}
+		else
+		{
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			len = STRLEN("N/A");
+			memcpy( buf, _SC("N/A"), sq_rsl(len) );
+			buf += len; size -= len;
+		}
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		PrintTime( samples, buf, size );
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		PrintTime( avg, buf, size );
+
+		*buf++ = ' '; size--;
+
+		// right align
+		len = FMT_UINT32_LEN - countdigits( node.calls );
+
+		while ( len-- )
+		{
+			*buf++ = ' ';
+			size--;
+		}
+
+		len = printint( buf, size, node.calls );
+		buf += len; size -= len;
+
+		*buf++ = ' '; size--;
+		*buf++ = ' '; size--;
+
+		STATIC_ASSERT( SQDBG_CALLGRAPH_MAX_DEPTH >= 3 && SQDBG_CALLGRAPH_MAX_DEPTH <= 9999 );
+
+		if ( depth <= SQDBG_CALLGRAPH_MAX_DEPTH )
+		{
+			for ( int d = depth; d--; )
+			{
+				*buf++ = '|';
+				*buf++ = ' ';
+				*buf++ = ' ';
+			}
+
+			size -= depth * 3;
+		}
+		else
+		{
+			for ( int d = SQDBG_CALLGRAPH_MAX_DEPTH - 2; d--; )
+			{
+				*buf++ = '|'; size--;
+				*buf++ = ' '; size--;
+				*buf++ = ' '; size--;
+			}
+
+			buf--; size++;
+
+			if ( depth < 10000 )
+			{
+				len = printint( buf, size, depth );
+			}
+			else
+			{
+				len = STRLEN("999+");
+				memcpy( buf, _SC("999+"), sq_rsl(len) );
+			}
+
+			buf += len; size -= len;
+
+			for ( int d = ( ( len + 2 ) / 3 ) * 3; d-- > len; )
+			{
+				*buf++ = ' ';
+				size--;
+			}
+
+			*buf++ = ' '; size--;
+
+			len = ( ( len + 2 ) / 3 ) * 3;
+
+			for ( int d = ( ( 2 ) * 3 - len ) / 3; d--; )
+			{
+				*buf++ = '|'; size--;
+				*buf++ = ' '; size--;
+				*buf++ = ' '; size--;
+			}
+
+			*(buf-1) = '.';
+			*(buf-2) = '.';
+		}
+
+		const nodetag_t &tag = m_NodeTags[node.id];
+
+		len = tag.funcname->_len;
+		memcpy( buf, tag.funcname->_val, sq_rsl(len) );
+		buf += len; size -= len;
+
+		*buf++ = ','; size--;
+		*buf++ = ' '; size--;
+
+		len = tag.funcsrc->_len;
+		memcpy( buf, tag.funcsrc->_val, sq_rsl(len) );
+		buf += len; size -= len;
+
+		if ( tag.funcname->_val[0] != '0' )
+		{
+			*buf++ = ' '; size--;
+			*buf++ = '('; size--;
+			len = printhex( buf, size, (uintptr_t)node.func );
+			buf += len; size -= len;
+			*buf++ = ')'; size--;
+		}
+
+		*buf++ = '\n'; size--;
+
+		int more = 0;
+		avg = 0.0;
+
+		for ( hnode_t j = i + 1; j < nodes.Size(); j++ )
+		{
+			const node_t &nj = nodes[j];
+			if ( nj.caller == node.id )
+			{
+				// Prevent stack overflow
+				// Limit should be at most 3 digits for the depth print
+				if ( depth < 100 )
+				{
+					DoPrint( nodes, j, totalSamples, depth+1, buf, size );
+				}
+				else
+				{
+					avg =
+						( (real_t)more * avg + ( Real( nj.samples ) / (real_t)nj.calls ) ) /
+						(real_t)( more + 1 );
+					more++;
+				}
+			}
+		}
+
+		if ( more )
+		{
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			len = STRLEN("N/A");
+			memcpy( buf, _SC("N/A"), sq_rsl(len) );
+			buf += len; size -= len;
+
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			PrintTime( NAN, buf, size );
+
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			PrintTime( avg, buf, size );
+
+			*buf++ = ' '; size--;
+
+			// right align
+			len = FMT_UINT32_LEN - STRLEN("N/A");
+
+			while ( len-- )
+			{
+				*buf++ = ' ';
+				size--;
+			}
+
+			len = STRLEN("N/A");
+			memcpy( buf, _SC("N/A"), sq_rsl(len) );
+			buf += len; size -= len;
+
+			*buf++ = ' '; size--;
+			*buf++ = ' '; size--;
+
+			for ( int d = SQDBG_CALLGRAPH_MAX_DEPTH; d--; )
+			{
+				*buf++ = '|';
+				*buf++ = ' ';
+				*buf++ = ' ';
+			}
+
+			size -= SQDBG_CALLGRAPH_MAX_DEPTH * 3;
+
+			*(buf-1) = '.';
+			*(buf-2) = '.';
+
+			*buf++ = ' '; size--;
+
+			len = printint( buf, size, more );
+			buf += len; size -= len;
+
+			len = STRLEN(" more");
+			memcpy( buf, _SC(" more"), sq_rsl(len) );
+			buf += len; size -= len;
+
+			*buf++ = '\n'; size--;
+		}
+	}
+#endif
+
+	// Print time and its unit to 9 chars: "000.00 ms"
+	static void PrintTime( real_t ns, SQChar *&buf, int &size )
+	{
+		int len;
+
+		// because a value less than 1000.0
+		// is not guaranteed to print less than 1000.0
+#define FIX_FLT_PRINT() \
+		if ( len == 8 ) \
 		{ \
 			len = STRLEN("999.99 "); \
 			memcpy( buf, _SC("999.99 "), sq_rsl(len) ); \
@@ -1877,15 +3111,77 @@ LNAN:
 #undef FIX_FLT_PRINT
 	}
 
+	// Print signed time to 10 chars: "+000.00 ms"
+	static void PrintTimeDelta( real_t ns, SQChar *&buf, int &size )
+	{
+		if ( ns > 0.0 )
+		{
+			*buf++ = '+'; size--;
+		}
+		else if ( ns < 0.0 )
+		{
+			*buf++ = '-'; size--;
+			ns = -ns;
+		}
+		else
+		{
+			*buf++ = ' '; size--;
+
+			if ( ns == 0.0 )
+			{
+				int len = STRLEN("  0.00 ns");
+				memcpy( buf, _SC("  0.00 ns"), sq_rsl(len) );
+				buf += len; size -= len;
+				return;
+			}
+		}
+
+		PrintTime( ns, buf, size );
+	}
+
 #ifndef SQDBG_DISABLE_PROFILER_AUTO
 	static int _sort( const node_t *a, const node_t *b )
 	{
-		if ( a->caller != b->caller )
+		if ( a->caller != b->caller )
+		{
+			if ( a->caller == INVALID_HANDLE )
+				return -1;
+
+			if ( b->caller == INVALID_HANDLE )
+				return 1;
+		}
+
+		if ( a->samples > b->samples )
+			return -1;
+
+		if ( b->samples > a->samples )
+			return 1;
+
+		return 0;
+	}
+#endif
+
+#ifndef SQDBG_DISABLE_PROFILER_AUTO
+	static int _sortbf( const bfnode_t *a, const bfnode_t *b )
+	{
+		if ( a->samples > b->samples )
+			return -1;
+
+		if ( b->samples > a->samples )
+			return 1;
+
+		return 0;
+	}
+#endif
+
+	static int _sortgroup( const group_t *a, const group_t *b )
+	{
+		if ( a->parent != b->parent )
 		{
-			if ( a->caller == INVALID_HANDLE )
+			if ( a->parent == INVALID_HANDLE )
 				return -1;
 
-			if ( b->caller == INVALID_HANDLE )
+			if ( b->parent == INVALID_HANDLE )
 				return 1;
 		}
 
@@ -1897,7 +3193,17 @@ LNAN:
 
 		return 0;
 	}
-#endif
+
+	static int _sortdiff( const diffnode_t *a, const diffnode_t *b )
+	{
+		if ( a->delta > b->delta )
+			return -1;
+
+		if ( b->delta > a->delta )
+			return 1;
+
+		return 0;
+	}
 };
 #endif // !SQDBG_DISABLE_PROFILER
 
@@ -2287,8 +3593,10 @@ struct script_t
 {
 	char *sourceptr;
 	char *scriptptr;
+	char *contentptr; // JSON escaped script, created on request
 	unsigned int sourcelen;
 	unsigned int scriptlen;
+	unsigned int contentlen;
 };
 
 struct objref_t
@@ -2406,6 +3714,44 @@ typedef enum
 	ThreadState_SuspendNow,
 } EThreadState;
 
+// Built-in requests, the rest are looked up in SQDebugServer::m_CustomRequests
+typedef enum
+{
+	Request_Unknown = 0,
+	Request_SetBreakpoints,
+	Request_SetFunctionBreakpoints,
+	Request_SetExceptionBreakpoints,
+	Request_SetDataBreakpoints,
+	Request_DataBreakpointInfo,
+	Request_Evaluate,
+#ifndef SQDBG_DISABLE_COMPILER
+	Request_Completions,
+#endif
+	Request_Scopes,
+	Request_Threads,
+	Request_StackTrace,
+	Request_Variables,
+	Request_SetVariable,
+	Request_SetExpression,
+	Request_Source,
+	Request_Disassemble,
+#ifdef SUPPORTS_RESTART_FRAME
+	Request_RestartFrame,
+#endif
+	Request_GotoTargets,
+	Request_Goto,
+	Request_Next,
+	Request_StepIn,
+	Request_StepOut,
+	Request_Continue,
+	Request_Pause,
+	Request_Attach,
+	Request_Disconnect,
+	Request_Terminate,
+	Request_Initialize,
+	Request_ConfigurationDone,
+} ERequest;
+
 //
 // Squirrel doesn't read files, it usually keeps file names passed in from host programs.
 // DAP returns file path on breakpoints; try to construct file paths from these partial
@@ -2486,6 +3832,134 @@ public:
 		m_PrintError( m_pCurVM, __VA_ARGS__ ); \
 	}
 
+// Script output is sent when this many bytes are buffered or on the next frame
+#ifndef SQDBG_OUTPUT_BATCH_SIZE
+#define SQDBG_OUTPUT_BATCH_SIZE 16384
+#endif
+
+// Longest wait for client messages while suspended before timers are checked
+#ifndef SQDBG_SUSPEND_WAIT
+#define SQDBG_SUSPEND_WAIT 100
+#endif
+
+#define SQDBG_RECORD_VERSION 1
+#define SQDBG_RECORD_INBOUND 0
+#define SQDBG_RECORD_OUTBOUND 1
+
+static void SetCapabilities( wjson_table_t &body )
+{
+	body.SetBool( "supportsConfigurationDoneRequest", true );
+	body.SetBool( "supportsFunctionBreakpoints", true );
+	body.SetBool( "supportsConditionalBreakpoints", true );
+	body.SetBool( "supportsHitConditionalBreakpoints", true );
+	body.SetBool( "supportsEvaluateForHovers", true );
+	{
+		wjson_array_t exceptionBreakpointFilters = body.SetArray( "exceptionBreakpointFilters" );
+		{
+			wjson_table_t filter = exceptionBreakpointFilters.AppendTable();
+			filter.SetString( "filter", "unhandled" );
+			filter.SetString( "label", "Unhandled exceptions" );
+			filter.SetString( "description", "Break on uncaught exceptions" );
+			filter.SetBool( "default", true );
+		}
+		{
+			wjson_table_t filter = exceptionBreakpointFilters.AppendTable();
+			filter.SetString( "filter", "all" );
+			filter.SetString( "label", "All exceptions" );
+			filter.SetString( "description", "Break on both caught and uncaught exceptions" );
+		}
+	}
+	body.SetBool( "supportsSetVariable", true );
+#ifdef SUPPORTS_RESTART_FRAME
+	body.SetBool( "supportsRestartFrame", true );
+#endif
+	body.SetBool( "supportsGotoTargetsRequest", true );
+#ifndef SQDBG_DISABLE_COMPILER
+	body.SetBool( "supportsCompletionsRequest", true );
+#endif
+	body.SetBool( "supportsSetExpression", true );
+	body.SetBool( "supportsSetHitCount", true );
+	{
+		wjson_array_t a = body.SetArray( "supportedChecksumAlgorithms" );
+	}
+	body.SetBool( "supportsValueFormattingOptions", true );
+	body.SetBool( "supportsDelayedStackTraceLoading", true );
+	body.SetBool( "supportsLogPoints", true );
+	body.SetBool( "supportsTerminateRequest", true );
+	body.SetBool( "supportsDataBreakpoints", true );
+	body.SetBool( "supportsDisassembleRequest", true );
+	body.SetBool( "supportsSteppingGranularity", true );
+}
+
+//
+// Observers are read-only, initialize is answered with the capabilities
+// and other requests fail. Called on the I/O thread with SQDBG_NET_THREAD
+//
+static int DAP_OnObserverRequest( char *ptr, int len, char *out, int size )
+{
+	if ( len >= (int)STRLEN(CBOR_MAGIC) && !memcmp( ptr, CBOR_MAGIC, STRLEN(CBOR_MAGIC) ) )
+		return 0;
+
+	CScratch< true > scratch;
+	memset( (char*)&scratch, 0, sizeof(scratch) );
+
+	CBuffer buf;
+	memset( (char*)&buf, 0, sizeof(buf) );
+
+	int ret = 0;
+
+	{
+		json_table_t table;
+		JSONParser parser( &scratch, ptr, len, &table );
+
+		string_t type, command;
+		int seq;
+
+		if ( !parser.GetError() &&
+				table.GetString( "type", &type ) && type.IsEqualTo( "request" ) &&
+				table.GetString( "command", &command ) &&
+				table.GetInt( "seq", &seq ) )
+		{
+			bool initialize = command.IsEqualTo( "initialize" );
+
+			{
+				wjson_table_t packet( buf );
+				packet.SetInt( "request_seq", seq );
+				packet.SetString( "type", "response" );
+				packet.SetString( "command", command );
+				packet.SetBool( "success", initialize );
+
+				if ( initialize )
+				{
+					wjson_table_t body = packet.SetTable( "body" );
+					SetCapabilities( body );
+				}
+				else
+				{
+					wjson_table_t body = packet.SetTable( "body" );
+					wjson_table_t error = body.SetTable( "error" );
+					error.SetInt( "id", 0 );
+					error.SetString( "format", "observers are read-only" );
+				}
+			}
+
+			char header[DAP_HEADER_MAXSIZE];
+			int headerLen = DAP_WriteHeader( header, buf.Size() );
+
+			if ( headerLen + buf.Size() <= size )
+			{
+				memcpy( out, header, headerLen );
+				memcpy( out + headerLen, buf.Base(), buf.Size() );
+				ret = headerLen + buf.Size();
+			}
+		}
+	}
+
+	buf.Free();
+	scratch.Free();
+	return ret;
+}
+
 struct SQDebugServer
 {
 private:
@@ -2511,7 +3985,18 @@ private:
 #ifndef SQDBG_DISABLE_PROFILER
 	CProfiler *m_pProfiler;
 	vector< threadprofiler_t > m_Profilers;
+	vector< CProfiler::snapshot_t > m_ProfSnapshots;
 	bool m_bProfilerEnabled;
+
+	// Continuous profiling
+	char *m_pszProfFlushDir;
+	unsigned int m_nProfFlushDirLen;
+	int m_nProfFlushInterval;
+	int m_nProfFlushIndex;
+	unsigned long long m_nProfFlushStartTime;
+	std::chrono::steady_clock::time_point m_ProfFlushTime;
+	// Profiler was started by continuous mode and is stopped with it
+	bool m_bProfContinuousStarted;
 #endif
 
 	bool m_bInREPL;
@@ -2525,6 +4010,10 @@ private:
 #ifndef SQDBG_DISABLE_COMPILER
 	bool m_bClientColumnOffset;
 #endif
+	// sqdbg specific messages are sent in CBOR
+	bool m_bClientCBOR;
+	// Output is batched per source line to keep its attribution
+	bool m_bClientOutputLines;
 
 	// Ignore debug hook calls from debugger executed scripts
 	class CCallGuard
@@ -2587,10 +4076,35 @@ private:
 
 public:
 	CBuffer m_SendBuf;
+	// Sent in place of an empty string in m_SendBuf
+	string_t m_SendBlob;
+	int m_nSendBlobOffset;
+
+	// Escaped stdout text of consecutive prints from the same source line
+	CBuffer m_OutputBuf;
+	SQObjectPtr m_OutputSource;
+	int m_nOutputLine;
+	int m_nOutputBatchSize;
+	int m_nOutputFlushInterval;
+	std::chrono::steady_clock::time_point m_OutputFlushTime;
+	// Also wakes the suspended loop, -1 if not set
+	int m_nWakeFd;
+	// Session recording, NULL if not recording
+	FILE *m_pRecordFile;
+	std::chrono::steady_clock::time_point m_RecordStart;
+	// Frames given a time budget that had requests, those that left requests
+	// for the next frame, and the longest time spent on requests in one (us)
+	unsigned int m_nBudgetFrames;
+	unsigned int m_nBudgetHits;
+	unsigned int m_nBudgetMaxTime;
 	CScratch< true > m_Scratch;
 	CScratch< false > m_Strings;
 
+#ifdef SQDBG_NET_THREAD
+	CServerThread< DAP_ReadHeader, DAP_IsPauseRequest, DAP_OnObserverRequest > m_Server;
+#else
 	CServerSocket m_Server;
+#endif
 
 public:
 	char *ScratchPad( unsigned int size )
@@ -2609,13 +4123,20 @@ public:
 	void DoSetDebugHook( HSQUIRRELVM vm, _SQDEBUGHOOK fn );
 	void SetDebugHook( _SQDEBUGHOOK fn );
 	bool ListenSocket( unsigned short port );
+	bool ListenUnix( const char *path );
+	bool ListenShm( const char *name );
+	bool AttachStdio();
 	void Shutdown();
 	void DisconnectClient();
 	void OnClientConnected( const char *addr );
-	void Frame();
+	bool Frame( int budget = 0 );
+	void FlushOutput();
 
 	bool IsClientConnected() { return m_Server.IsClientConnected(); }
 
+	bool StartRecording( const char *path );
+	void StopRecording();
+
 private:
 	void PrintLastServerMessage()
 	{
@@ -2691,21 +4212,97 @@ private:
 		}
 	}
 
-	void Send( const char *buf, int len )
+	void Send( const char *buf, int len, bool droppable = false, bool broadcast = false )
 	{
-		if ( m_Server.IsClientConnected() && !m_Server.Send( buf, len ) )
+		string_t blob = m_SendBlob;
+		m_SendBlob.ptr = NULL;
+		m_SendBlob.len = 0;
+
+		if ( !m_Server.IsClientConnected() )
+			return;
+
+		char header[DAP_HEADER_MAXSIZE];
+		netbuf_t bufs[4];
+		int count = 0;
+
+		bufs[count].ptr = header;
+		bufs[count++].len = DAP_WriteHeader( header, len + blob.len );
+
+		if ( blob.len )
+		{
+			Assert( m_nSendBlobOffset > 0 && m_nSendBlobOffset < len );
+
+			bufs[count].ptr = buf;
+			bufs[count++].len = m_nSendBlobOffset;
+			bufs[count].ptr = blob.ptr;
+			bufs[count++].len = blob.len;
+			bufs[count].ptr = buf + m_nSendBlobOffset;
+			bufs[count++].len = len - m_nSendBlobOffset;
+		}
+		else
+		{
+			bufs[count].ptr = buf;
+			bufs[count++].len = len;
+		}
+
+		if ( m_pRecordFile )
+			Record( SQDBG_RECORD_OUTBOUND, bufs + 1, count - 1 );
+
+		if ( !m_Server.Send( bufs, count, droppable, broadcast ) )
 		{
 			PrintLastServerMessage();
 			DisconnectClient();
 		}
 	}
 
+	// Sent to observers that connect while suspended, len 0 to clear
+	void SetObserverState( const char *buf, int len )
+	{
+		if ( !len )
+		{
+			m_Server.SetObserverState( NULL, 0 );
+			return;
+		}
+
+		char header[DAP_HEADER_MAXSIZE];
+		netbuf_t bufs[2];
+
+		bufs[0].ptr = header;
+		bufs[0].len = DAP_WriteHeader( header, len );
+		bufs[1].ptr = buf;
+		bufs[1].len = len;
+
+		m_Server.SetObserverState( bufs, 2 );
+	}
+
+	void FlushSend();
+
+	void Record( int direction, const netbuf_t *bufs, int count );
+
 	void OnMessageReceived( char *ptr, int len );
 
 	void ProcessRequest( const json_table_t &table, int seq );
 	void ProcessResponse( const json_table_t &table, int seq );
 	void ProcessEvent( const json_table_t &table );
 
+	// Handlers of requests that are not built-in get the whole request
+	typedef void (SQDebugServer::*requesthandler_t)( const json_table_t &table, int seq );
+
+	struct customrequest_t
+	{
+		string_t command;
+		unsigned int hash;
+		requesthandler_t handler;
+	};
+
+	vector< customrequest_t > m_CustomRequests;
+
+	void RegisterRequest( const string_t &command, requesthandler_t handler );
+	requesthandler_t GetCustomRequest( const string_t &command );
+
+	void OnRequest_SetHitCount( const json_table_t &table, int seq );
+	template < class wtable_t >
+	void SetHitCount( const json_table_t &table, int seq );
 	void OnRequest_Initialize( const json_table_t &arguments, int seq );
 	void OnRequest_SetBreakpoints( const json_table_t &arguments, int seq );
 	void OnRequest_SetFunctionBreakpoints( const json_table_t &arguments, int seq );
@@ -3186,6 +4783,7 @@ private:
 private:
 	script_t *GetScript( const string_t &source );
 	void RemoveScripts();
+	bool EscapeScript( script_t *scr );
 
 public:
 	void OnScriptCompile( const SQChar *script, unsigned int scriptlen,
@@ -3293,6 +4891,11 @@ public:
 	void ProfGroupEnd( HSQUIRRELVM vm );
 	sqstring_t ProfGets( HSQUIRRELVM vm, SQString *tag, int type );
 	void ProfPrint( HSQUIRRELVM vm, SQString *tag, int type );
+	bool ProfSnapshot( HSQUIRRELVM vm, SQString *name );
+	sqstring_t ProfDiff( SQString *a, SQString *b );
+	void ProfRemoveSnapshots();
+	void ProfContinuous( const char *dir, int interval );
+	void ProfFlush();
 #endif
 
 public:
@@ -3348,6 +4951,8 @@ public:
 	static SQInteger SQProfGroupEnd( HSQUIRRELVM vm );
 	static SQInteger SQProfGets( HSQUIRRELVM vm );
 	static SQInteger SQProfPrint( HSQUIRRELVM vm );
+	static SQInteger SQProfSnapshot( HSQUIRRELVM vm );
+	static SQInteger SQProfDiff( HSQUIRRELVM vm );
 #endif
 
 	static const SQVM::CallInfo *GetCurrentScriptSource( HSQUIRRELVM vm );
@@ -3483,6 +5088,11 @@ void SQDebugServer::Attach( HSQUIRRELVM vm )
 	if ( sq_type(m_ErrorHandler) != OT_NULL )
 		sq_addref( m_pRootVM, &m_ErrorHandler );
 
+	m_nOutputBatchSize = SQDBG_OUTPUT_BATCH_SIZE;
+	m_nWakeFd = -1;
+
+	RegisterRequest( "setHitCount", &SQDebugServer::OnRequest_SetHitCount );
+
 	SQString *cached = CreateSQString( m_pRootVM, _SC("sqdbg") );
 	__ObjAddRef( cached );
 	m_sqstrCallFrame = CreateSQString( m_pRootVM, _SC(KW_CALLFRAME) );
@@ -3617,6 +5227,20 @@ void SQDebugServer::Attach( HSQUIRRELVM vm )
 		sq_setnativeclosurename( m_pRootVM, -1, _SC("sqdbg_prof_print") );
 		sq_setparamscheck( m_pRootVM, -2, _SC(".v|i|si|s") );
 		sq_newslot( m_pRootVM, -3, SQFalse );
+
+		sq_pushstring( m_pRootVM, _SC("sqdbg_prof_snapshot"), STRLEN("sqdbg_prof_snapshot") );
+		sq_pushobject( m_pRootVM, ref );
+		sq_newclosure( m_pRootVM, &SQDebugServer::SQProfSnapshot, 1 );
+		sq_setnativeclosurename( m_pRootVM, -1, _SC("sqdbg_prof_snapshot") );
+		sq_setparamscheck( m_pRootVM, -2, _SC(".v|ss") );
+		sq_newslot( m_pRootVM, -3, SQFalse );
+
+		sq_pushstring( m_pRootVM, _SC("sqdbg_prof_diff"), STRLEN("sqdbg_prof_diff") );
+		sq_pushobject( m_pRootVM, ref );
+		sq_newclosure( m_pRootVM, &SQDebugServer::SQProfDiff, 1 );
+		sq_setnativeclosurename( m_pRootVM, -1, _SC("sqdbg_prof_diff") );
+		sq_setparamscheck( m_pRootVM, 3, _SC(".ss") );
+		sq_newslot( m_pRootVM, -3, SQFalse );
 #endif
 
 		sq_pop( m_pRootVM, 1 );
@@ -3730,6 +5354,66 @@ bool SQDebugServer::ListenSocket( unsigned short port )
 	return true;
 }
 
+bool SQDebugServer::ListenUnix( const char *path )
+{
+	Assert( m_pRootVM );
+
+	if ( m_Server.IsListening() )
+	{
+		Print(_SC("(sqdbg) Socket already open\n"));
+		return true;
+	}
+
+	if ( !m_Server.ListenUnix( path ) )
+	{
+		PrintLastServerMessage();
+		return false;
+	}
+
+	Print(_SC("(sqdbg) Listening for connections on '" FMT_CSTR "'\n"), path);
+	return true;
+}
+
+bool SQDebugServer::ListenShm( const char *name )
+{
+	Assert( m_pRootVM );
+
+	if ( m_Server.IsListening() )
+	{
+		Print(_SC("(sqdbg) Socket already open\n"));
+		return true;
+	}
+
+	if ( !m_Server.ListenShm( name ) )
+	{
+		PrintLastServerMessage();
+		return false;
+	}
+
+	Print(_SC("(sqdbg) Waiting for adapter on shared memory '" FMT_CSTR "'\n"), name);
+	return true;
+}
+
+bool SQDebugServer::AttachStdio()
+{
+	Assert( m_pRootVM );
+
+	if ( m_Server.IsListening() )
+	{
+		Print(_SC("(sqdbg) Socket already open\n"));
+		return true;
+	}
+
+	if ( !m_Server.AttachStdio() )
+	{
+		PrintLastServerMessage();
+		return false;
+	}
+
+	Print(_SC("(sqdbg) Reading messages from stdin, stdout is redirected to stderr\n"));
+	return true;
+}
+
 void SQDebugServer::Shutdown()
 {
 	if ( !m_pRootVM )
@@ -3742,17 +5426,25 @@ void SQDebugServer::Shutdown()
 		m_Server.Execute< SQDebugServer, &SQDebugServer::OnMessageReceived >( this );
 
 		DAP_START_EVENT( ++m_Sequence, "terminated" );
-		DAP_SEND();
+		DAP_SEND_BROADCAST();
 	}
 
 	m_Server.Shutdown();
 
+	if ( m_pRecordFile )
+		StopRecording();
+
 #ifndef SQDBG_DISABLE_PROFILER
+	if ( m_pszProfFlushDir )
+		ProfContinuous( NULL, 0 );
+
 	if ( IsProfilerEnabled() )
 		ProfStop();
 
 	Assert( m_Profilers.Size() == 0 );
 	m_Profilers.Purge();
+
+	ProfRemoveSnapshots();
 #endif
 
 	SetErrorHandler( false );
@@ -3768,6 +5460,8 @@ void SQDebugServer::Shutdown()
 	m_bExceptionPause = false;
 	m_bDebugHookGuard = false;
 	m_bDebugHookGuardAlways = false;
+	m_bClientCBOR = false;
+	m_bClientOutputLines = false;
 #if SQUIRREL_VERSION_NUMBER < 300
 	m_bInDebugHook = false;
 #endif
@@ -3791,9 +5485,12 @@ void SQDebugServer::Shutdown()
 	RemoveClassDefs();
 	RemoveScripts();
 	m_FrameIDs.Purge();
+	m_CustomRequests.Purge();
 	m_FilePathMap.Clear( &m_Strings );
 
 	m_SendBuf.Free();
+	m_OutputBuf.Free();
+	m_OutputSource.Null();
 	m_Scratch.Free();
 	m_Strings.Free();
 
@@ -3839,8 +5536,21 @@ void SQDebugServer::DisconnectClient()
 		Print(_SC("(sqdbg) Client disconnected\n"));
 
 		DAP_START_EVENT( ++m_Sequence, "terminated" );
-		DAP_SEND();
+		DAP_SEND_BROADCAST();
+	}
+
+#if defined(_DEBUG) && !defined(SQDBG_NET_THREAD)
+	{
+		CMessagePool::stats_t stats;
+		m_Server.GetMessagePoolStats( &stats );
+
+		if ( stats.allocs )
+		{
+			Print(_SC("(sqdbg) Message pool: peak %d/%d blocks, %d chunks, %u allocs, %u reused\n"),
+					stats.peakBlocks, stats.blocks, stats.chunks, stats.allocs, stats.reused);
+		}
 	}
+#endif
 
 	m_Server.DisconnectClient();
 
@@ -3863,6 +5573,8 @@ void SQDebugServer::DisconnectClient()
 	m_bExceptionPause = false;
 	m_bDebugHookGuard = false;
 	m_bDebugHookGuardAlways = false;
+	m_bClientCBOR = false;
+	m_bClientOutputLines = false;
 #if SQUIRREL_VERSION_NUMBER < 300
 	m_bInDebugHook = false;
 #endif
@@ -3883,6 +5595,8 @@ void SQDebugServer::DisconnectClient()
 	m_DataWatches.Purge();
 
 	m_SendBuf.Free();
+	m_OutputBuf.Free();
+	m_OutputSource.Null();
 	m_Scratch.Free();
 
 	ClearEnvDelegate( m_EnvGetVal );
@@ -3922,19 +5636,76 @@ void SQDebugServer::OnClientConnected( const char *addr )
 #undef _check
 }
 
-void SQDebugServer::Frame()
+//
+// Requests left over after budget (us) are processed first on the next call.
+// Returns false if there are any
+//
+bool SQDebugServer::Frame( int budget )
 {
+	bool done = true;
+
+	m_Server.BeginFrame();
+
 	if ( m_Server.IsClientConnected() )
 	{
 		Recv();
 		Parse();
-		m_Server.Execute< SQDebugServer, &SQDebugServer::OnMessageReceived >( this );
+
+		if ( budget > 0 && m_Server.HasMessages() )
+		{
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			std::chrono::steady_clock::time_point deadline = start + std::chrono::microseconds( budget );
+
+			done = m_Server.Execute< SQDebugServer, &SQDebugServer::OnMessageReceived >( this, &deadline );
+
+			unsigned int time = (unsigned int)std::chrono::duration_cast< std::chrono::microseconds >(
+					std::chrono::steady_clock::now() - start ).count();
+
+			m_nBudgetFrames++;
+
+			if ( !done )
+				m_nBudgetHits++;
+
+			if ( m_nBudgetMaxTime < time )
+				m_nBudgetMaxTime = time;
+		}
+		else
+		{
+			m_Server.Execute< SQDebugServer, &SQDebugServer::OnMessageReceived >( this );
+		}
+
+		m_Server.ServiceObservers< DAP_ReadHeader, DAP_OnObserverRequest >();
+
+		if ( m_OutputBuf.Size() &&
+				( !m_nOutputFlushInterval || std::chrono::steady_clock::now() >= m_OutputFlushTime ) )
+		{
+			FlushOutput();
+		}
+
+		FlushSend();
 	}
 	else if ( m_Server.Listen() )
 	{
 		OnClientConnected( m_Server.m_pszLastMsg );
 		m_Server.m_pszLastMsg = NULL;
 	}
+
+#ifndef SQDBG_DISABLE_PROFILER
+	if ( m_nProfFlushInterval )
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		if ( now >= m_ProfFlushTime )
+		{
+			m_ProfFlushTime = now + std::chrono::milliseconds( m_nProfFlushInterval );
+
+			if ( IsProfilerEnabled() )
+				ProfFlush();
+		}
+	}
+#endif
+
+	return done;
 }
 
 #define GET_OR_FAIL( _base, _val ) \
@@ -3955,8 +5726,125 @@ void SQDebugServer::Frame()
 		return; \
 	}
 
+// For handlers templated on wtable_t
+#define GET_OR_ERROR_RESPONSE_EXT( _cmd, _base, _val ) \
+	if ( !(_base).Get( #_val, &_val ) ) \
+	{ \
+		PrintError( _SC("(sqdbg) Invalid DAP message, could not find '" FMT_CSTR "'\n"), #_val ); \
+		DAP_ERROR_RESPONSE_EXT( seq, _cmd ); \
+		DAP_ERROR_BODY_EXT( 0, "invalid DAP message" ); \
+		DAP_SEND(); \
+		return; \
+	}
+
+//
+// File: u8[4] "SQDR", u16 version, u64 start time (ms since Unix epoch),
+//       followed by records of u8 direction, u64 time (us since start),
+//       u32 length and the message content without the header
+//
+bool SQDebugServer::StartRecording( const char *path )
+{
+	if ( m_pRecordFile )
+		StopRecording();
+
+	if ( !path || !path[0] )
+		return true;
+
+	m_pRecordFile = fopen( path, "wb" );
+
+	if ( !m_pRecordFile )
+	{
+		PrintError(_SC("(sqdbg) Failed to open recording file '" FMT_CSTR "'\n"), path);
+		return false;
+	}
+
+	unsigned long long startTime = std::chrono::duration_cast< std::chrono::milliseconds >(
+			std::chrono::system_clock::now().time_since_epoch() ).count();
+
+	unsigned char header[14];
+	unsigned char *ptr = header;
+
+	*ptr++ = 'S'; *ptr++ = 'Q'; *ptr++ = 'D'; *ptr++ = 'R';
+
+	for ( int i = 0; i < 2; i++ )
+		*ptr++ = (unsigned char)( SQDBG_RECORD_VERSION >> ( i * 8 ) );
+
+	for ( int i = 0; i < 8; i++ )
+		*ptr++ = (unsigned char)( startTime >> ( i * 8 ) );
+
+	Assert( ptr == header + sizeof(header) );
+
+	m_RecordStart = std::chrono::steady_clock::now();
+
+	if ( fwrite( header, sizeof(header), 1, m_pRecordFile ) != 1 )
+	{
+		PrintError(_SC("(sqdbg) Failed to write recording file '" FMT_CSTR "'\n"), path);
+		fclose( m_pRecordFile );
+		m_pRecordFile = NULL;
+		return false;
+	}
+
+	Print(_SC("(sqdbg) Recording session to '" FMT_CSTR "'\n"), path);
+	return true;
+}
+
+void SQDebugServer::StopRecording()
+{
+	Assert( m_pRecordFile );
+
+	fclose( m_pRecordFile );
+	m_pRecordFile = NULL;
+
+	Print(_SC("(sqdbg) Recording stopped\n"));
+}
+
+void SQDebugServer::Record( int direction, const netbuf_t *bufs, int count )
+{
+	Assert( m_pRecordFile );
+
+	unsigned long long time = std::chrono::duration_cast< std::chrono::microseconds >(
+			std::chrono::steady_clock::now() - m_RecordStart ).count();
+
+	unsigned int len = 0;
+
+	for ( int i = 0; i < count; i++ )
+		len += bufs[i].len;
+
+	unsigned char header[13];
+	unsigned char *ptr = header;
+
+	*ptr++ = (unsigned char)direction;
+
+	for ( int i = 0; i < 8; i++ )
+		*ptr++ = (unsigned char)( time >> ( i * 8 ) );
+
+	for ( int i = 0; i < 4; i++ )
+		*ptr++ = (unsigned char)( len >> ( i * 8 ) );
+
+	bool ok = ( fwrite( header, sizeof(header), 1, m_pRecordFile ) == 1 );
+
+	for ( int i = 0; ok && i < count; i++ )
+	{
+		if ( bufs[i].len )
+			ok = ( fwrite( bufs[i].ptr, bufs[i].len, 1, m_pRecordFile ) == 1 );
+	}
+
+	if ( !ok )
+	{
+		PrintError(_SC("(sqdbg) Failed to write recording file\n"));
+		StopRecording();
+	}
+}
+
 void SQDebugServer::OnMessageReceived( char *ptr, int len )
 {
+	// Before the parser unescapes in place
+	if ( m_pRecordFile )
+	{
+		netbuf_t buf = { ptr, (unsigned int)len };
+		Record( SQDBG_RECORD_INBOUND, &buf, 1 );
+	}
+
 	CScratch_Restore_Auto _sr( &m_Scratch );
 
 	json_table_t table;
@@ -4007,405 +5895,573 @@ void SQDebugServer::OnMessageReceived( char *ptr, int len )
 	}
 }
 
-void SQDebugServer::ProcessRequest( const json_table_t &table, int seq )
+// Requests are compared to the names of their length only
+static ERequest GetRequestType( const string_t &command )
 {
-	string_t command;
-	table.GetString( "command", &command );
+#define _match( _len, _name, _type ) \
+	STATIC_ASSERT( STRLEN(_name) == _len ); \
+	if ( !memcmp( command.ptr, _name, _len ) ) \
+		return _type;
 
-	if ( command.IsEqualTo( "setBreakpoints" ) )
+	switch ( command.len )
 	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "setBreakpoints", table, arguments );
-
-		OnRequest_SetBreakpoints( *arguments, seq );
+		case 4:
+			_match( 4, "next", Request_Next );
+			_match( 4, "goto", Request_Goto );
+			break;
+		case 5:
+			_match( 5, "pause", Request_Pause );
+			break;
+		case 6:
+			_match( 6, "scopes", Request_Scopes );
+			_match( 6, "stepIn", Request_StepIn );
+			_match( 6, "source", Request_Source );
+			_match( 6, "attach", Request_Attach );
+			break;
+		case 7:
+			_match( 7, "stepOut", Request_StepOut );
+			_match( 7, "threads", Request_Threads );
+			break;
+		case 8:
+			_match( 8, "evaluate", Request_Evaluate );
+			_match( 8, "continue", Request_Continue );
+			break;
+		case 9:
+			_match( 9, "variables", Request_Variables );
+			_match( 9, "terminate", Request_Terminate );
+			break;
+		case 10:
+			_match( 10, "stackTrace", Request_StackTrace );
+			_match( 10, "initialize", Request_Initialize );
+			_match( 10, "disconnect", Request_Disconnect );
+			break;
+		case 11:
+			_match( 11, "setVariable", Request_SetVariable );
+			_match( 11, "disassemble", Request_Disassemble );
+			_match( 11, "gotoTargets", Request_GotoTargets );
+#ifndef SQDBG_DISABLE_COMPILER
+			_match( 11, "completions", Request_Completions );
+#endif
+			break;
+#ifdef SUPPORTS_RESTART_FRAME
+		case 12:
+			_match( 12, "restartFrame", Request_RestartFrame );
+			break;
+#endif
+		case 13:
+			_match( 13, "setExpression", Request_SetExpression );
+			break;
+		case 14:
+			_match( 14, "setBreakpoints", Request_SetBreakpoints );
+			break;
+		case 17:
+			_match( 17, "configurationDone", Request_ConfigurationDone );
+			break;
+		case 18:
+			_match( 18, "setDataBreakpoints", Request_SetDataBreakpoints );
+			_match( 18, "dataBreakpointInfo", Request_DataBreakpointInfo );
+			break;
+		case 22:
+			_match( 22, "setFunctionBreakpoints", Request_SetFunctionBreakpoints );
+			break;
+		case 23:
+			_match( 23, "setExceptionBreakpoints", Request_SetExceptionBreakpoints );
+			break;
 	}
-	else if ( command.IsEqualTo( "setFunctionBreakpoints" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "setFunctionBreakpoints", table, arguments );
 
-		OnRequest_SetFunctionBreakpoints( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "setExceptionBreakpoints" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "setExceptionBreakpoints", table, arguments );
+	return Request_Unknown;
+#undef _match
+}
 
-		OnRequest_SetExceptionBreakpoints( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "setDataBreakpoints" ) )
+void SQDebugServer::OnRequest_SetHitCount( const json_table_t &table, int seq )
+{
+	if ( !m_bClientCBOR )
 	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "setDataBreakpoints", table, arguments );
-
-		OnRequest_SetDataBreakpoints( *arguments, seq );
+		SetHitCount< wjson_table_t >( table, seq );
 	}
-	else if ( command.IsEqualTo( "dataBreakpointInfo" ) )
+	else
 	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "dataBreakpointInfo", table, arguments );
-
-		OnRequest_DataBreakpointInfo( *arguments, seq );
+		SetHitCount< wcbor_table_t >( table, seq );
 	}
-	else if ( command.IsEqualTo( "evaluate" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "evaluate", table, arguments );
+}
 
-		OnRequest_Evaluate( *arguments, seq );
-	}
-#ifndef SQDBG_DISABLE_COMPILER
-	else if ( command.IsEqualTo( "completions" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "completions", table, arguments );
+template < class wtable_t >
+void SQDebugServer::SetHitCount( const json_table_t &table, int seq )
+{
+	json_table_t *arguments;
+	GET_OR_ERROR_RESPONSE_EXT( "setHitCount", table, arguments );
 
-		OnRequest_Completions( *arguments, seq );
-	}
-#endif
-	else if ( command.IsEqualTo( "scopes" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "scopes", table, arguments );
+	int breakpointId, hitCount;
+	arguments->GetInt( "breakpointId", &breakpointId );
+	arguments->GetInt( "hitCount", &hitCount );
 
-		OnRequest_Scopes( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "threads" ) )
-	{
-		OnRequest_Threads( seq );
-	}
-	else if ( command.IsEqualTo( "stackTrace" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "stackTrace", table, arguments );
+	if ( hitCount < 0 )
+		hitCount = 0;
 
-		OnRequest_StackTrace( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "variables" ) )
+	if ( breakpointId > 0 && breakpointId < m_nBreakpointIndex )
 	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "variables", table, arguments );
+#define _check( vec, type ) \
+		for ( unsigned int i = 0; i < vec.Size(); i++ ) \
+		{ \
+			type &bp = vec[i]; \
+			if ( bp.id == breakpointId ) \
+			{ \
+				bp.hits = hitCount; \
+				DAP_START_RESPONSE_EXT( seq, "setHitCount" ); \
+				DAP_SEND(); \
+				return; \
+			} \
+		}
 
-		OnRequest_Variables( *arguments, seq );
+		_check( m_Breakpoints, breakpoint_t );
+		_check( m_DataWatches, datawatch_t );
+#undef _check
 	}
-	else if ( command.IsEqualTo( "setVariable" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "setVariable", table, arguments );
 
-		OnRequest_SetVariable( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "setExpression" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "setExpression", table, arguments );
+	DAP_ERROR_RESPONSE_EXT( seq, "setHitCount" );
+	DAP_ERROR_BODY_EXT( 0, "invalid breakpoint {id}" );
+		wtable_t variables = error.SetTable( "variables" );
+		variables.SetIntString( "id", breakpointId );
+	DAP_SEND();
+}
 
-		OnRequest_SetExpression( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "setHitCount" ) )
+void SQDebugServer::ProcessRequest( const json_table_t &table, int seq )
+{
+	string_t command;
+	table.GetString( "command", &command );
+
+	switch ( GetRequestType( command ) )
 	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "setHitCount", table, arguments );
+		case Request_SetBreakpoints:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "setBreakpoints", table, arguments );
 
-		int breakpointId, hitCount;
-		arguments->GetInt( "breakpointId", &breakpointId );
-		arguments->GetInt( "hitCount", &hitCount );
+			OnRequest_SetBreakpoints( *arguments, seq );
+			break;
+		}
+		case Request_SetFunctionBreakpoints:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "setFunctionBreakpoints", table, arguments );
 
-		if ( hitCount < 0 )
-			hitCount = 0;
+			OnRequest_SetFunctionBreakpoints( *arguments, seq );
+			break;
+		}
+		case Request_SetExceptionBreakpoints:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "setExceptionBreakpoints", table, arguments );
 
-		if ( breakpointId > 0 && breakpointId < m_nBreakpointIndex )
+			OnRequest_SetExceptionBreakpoints( *arguments, seq );
+			break;
+		}
+		case Request_SetDataBreakpoints:
 		{
-#define _check( vec, type ) \
-			for ( unsigned int i = 0; i < vec.Size(); i++ ) \
-			{ \
-				type &bp = vec[i]; \
-				if ( bp.id == breakpointId ) \
-				{ \
-					bp.hits = hitCount; \
-					DAP_START_RESPONSE( seq, "setHitCount" ); \
-					DAP_SEND(); \
-					return; \
-				} \
-			}
-
-			_check( m_Breakpoints, breakpoint_t );
-			_check( m_DataWatches, datawatch_t );
-#undef _check
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "setDataBreakpoints", table, arguments );
+
+			OnRequest_SetDataBreakpoints( *arguments, seq );
+			break;
 		}
+		case Request_DataBreakpointInfo:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "dataBreakpointInfo", table, arguments );
 
-		DAP_ERROR_RESPONSE( seq, "setHitCount" );
-		DAP_ERROR_BODY( 0, "invalid breakpoint {id}" );
-			wjson_table_t variables = error.SetTable( "variables" );
-			variables.SetIntString( "id", breakpointId );
-		DAP_SEND();
-	}
-	else if ( command.IsEqualTo( "source" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "source", table, arguments );
+			OnRequest_DataBreakpointInfo( *arguments, seq );
+			break;
+		}
+		case Request_Evaluate:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "evaluate", table, arguments );
 
-		json_table_t *source;
-		if ( arguments->GetTable( "source", &source ) )
+			OnRequest_Evaluate( *arguments, seq );
+			break;
+		}
+#ifndef SQDBG_DISABLE_COMPILER
+		case Request_Completions:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "completions", table, arguments );
+
+			OnRequest_Completions( *arguments, seq );
+			break;
+		}
+#endif
+		case Request_Scopes:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "scopes", table, arguments );
+
+			OnRequest_Scopes( *arguments, seq );
+			break;
+		}
+		case Request_Threads:
+		{
+			OnRequest_Threads( seq );
+			break;
+		}
+		case Request_StackTrace:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "stackTrace", table, arguments );
+
+			OnRequest_StackTrace( *arguments, seq );
+			break;
+		}
+		case Request_Variables:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "variables", table, arguments );
+
+			OnRequest_Variables( *arguments, seq );
+			break;
+		}
+		case Request_SetVariable:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "setVariable", table, arguments );
+
+			OnRequest_SetVariable( *arguments, seq );
+			break;
+		}
+		case Request_SetExpression:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "setExpression", table, arguments );
+
+			OnRequest_SetExpression( *arguments, seq );
+			break;
+		}
+		case Request_Source:
 		{
-			string_t srcname;
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "source", table, arguments );
 
-			if ( ( !source->GetString( "name", &srcname ) || srcname.IsEmpty() ) &&
-					source->GetString( "path", &srcname ) )
+			json_table_t *source;
+			if ( arguments->GetTable( "source", &source ) )
 			{
-				StripFileName( &srcname.ptr, &srcname.len );
+				string_t srcname;
+
+				if ( ( !source->GetString( "name", &srcname ) || srcname.IsEmpty() ) &&
+						source->GetString( "path", &srcname ) )
+				{
+					StripFileName( &srcname.ptr, &srcname.len );
+				}
+
+				script_t *scr = GetScript( srcname );
+				if ( scr )
+				{
+					if ( !scr->contentptr && !EscapeScript( scr ) )
+					{
+						DAP_ERROR_RESPONSE( seq, "source" );
+						DAP_ERROR_BODY( 0, "could not allocate source content" );
+						DAP_SEND();
+						return;
+					}
+
+					DAP_START_RESPONSE( seq, "source" );
+					DAP_SET_TABLE( body );
+						// Content is written from the script buffer on send
+						m_nSendBlobOffset = body.SetStringPlaceholder( "content" );
+						m_SendBlob.Assign( scr->contentptr, scr->contentlen );
+					DAP_SEND();
+					return;
+				}
 			}
 
-			script_t *scr = GetScript( srcname );
-			if ( scr )
+			DAP_ERROR_RESPONSE( seq, "source" );
+			DAP_SEND();
+			break;
+		}
+		case Request_Disassemble:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "disassemble", table, arguments );
+
+			OnRequest_Disassemble( *arguments, seq );
+			break;
+		}
+#ifdef SUPPORTS_RESTART_FRAME
+		case Request_RestartFrame:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "restartFrame", table, arguments );
+
+			if ( m_bExceptionPause )
 			{
-				DAP_START_RESPONSE( seq, "source" );
-				DAP_SET_TABLE( body );
-					body.SetString( "content", { scr->scriptptr, scr->scriptlen } );
+				DAP_START_RESPONSE( seq, "restartFrame" );
 				DAP_SEND();
+
+				Continue( m_pCurVM );
 				return;
 			}
-		}
 
-		DAP_ERROR_RESPONSE( seq, "source" );
-		DAP_SEND();
-	}
-	else if ( command.IsEqualTo( "disassemble" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "disassemble", table, arguments );
+#ifndef SQDBG_DISABLE_PROFILER
+			// HACKHACK: Re-validate current profiler
+			if ( IsProfilerEnabled() )
+				ProfSwitchThread( m_pCurVM );
+#endif
 
-		OnRequest_Disassemble( *arguments, seq );
-	}
-#ifdef SUPPORTS_RESTART_FRAME
-	else if ( command.IsEqualTo( "restartFrame" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "restartFrame", table, arguments );
+			RestoreCachedInstructions();
+			ClearCachedInstructions();
 
-		if ( m_bExceptionPause )
+			RemoveReturnValues();
+
+			OnRequest_RestartFrame( *arguments, seq );
+			break;
+		}
+#endif
+		case Request_GotoTargets:
 		{
-			DAP_START_RESPONSE( seq, "restartFrame" );
-			DAP_SEND();
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "gotoTargets", table, arguments );
 
-			Continue( m_pCurVM );
-			return;
+			OnRequest_GotoTargets( *arguments, seq );
+			break;
 		}
+		case Request_Goto:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "goto", table, arguments );
+
+			if ( m_bExceptionPause )
+			{
+				DAP_START_RESPONSE( seq, "goto" );
+				DAP_SEND();
+
+				Continue( m_pCurVM );
+				return;
+			}
 
 #ifndef SQDBG_DISABLE_PROFILER
-		// HACKHACK: Re-validate current profiler
-		if ( IsProfilerEnabled() )
-			ProfSwitchThread( m_pCurVM );
+			// HACKHACK: Re-validate current profiler
+			if ( IsProfilerEnabled() )
+				ProfSwitchThread( m_pCurVM );
 #endif
 
-		RestoreCachedInstructions();
-		ClearCachedInstructions();
+			RestoreCachedInstructions();
+			ClearCachedInstructions();
 
-		RemoveReturnValues();
+			RemoveReturnValues();
 
-		OnRequest_RestartFrame( *arguments, seq );
-	}
+			OnRequest_Goto( *arguments, seq );
+			break;
+		}
+		case Request_Next:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "next", table, arguments );
+
+			if ( m_bExceptionPause )
+			{
+				DAP_START_RESPONSE( seq, "next" );
+				DAP_SEND();
+
+				Continue( m_pCurVM );
+				return;
+			}
+
+#ifndef SQDBG_DISABLE_PROFILER
+			// HACKHACK: Re-validate current profiler
+			if ( IsProfilerEnabled() )
+				ProfSwitchThread( m_pCurVM );
 #endif
-	else if ( command.IsEqualTo( "gotoTargets" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "gotoTargets", table, arguments );
 
-		OnRequest_GotoTargets( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "goto" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "goto", table, arguments );
+			RestoreCachedInstructions();
+			ClearCachedInstructions();
 
-		if ( m_bExceptionPause )
-		{
-			DAP_START_RESPONSE( seq, "goto" );
-			DAP_SEND();
+			RemoveReturnValues();
 
-			Continue( m_pCurVM );
-			return;
+			OnRequest_Next( *arguments, seq );
+			break;
 		}
+		case Request_StepIn:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "stepIn", table, arguments );
+
+			if ( m_bExceptionPause )
+			{
+				DAP_START_RESPONSE( seq, "stepIn" );
+				DAP_SEND();
+
+				Continue( m_pCurVM );
+				return;
+			}
 
 #ifndef SQDBG_DISABLE_PROFILER
-		// HACKHACK: Re-validate current profiler
-		if ( IsProfilerEnabled() )
-			ProfSwitchThread( m_pCurVM );
+			// HACKHACK: Re-validate current profiler
+			if ( IsProfilerEnabled() )
+				ProfSwitchThread( m_pCurVM );
 #endif
 
-		RestoreCachedInstructions();
-		ClearCachedInstructions();
-
-		RemoveReturnValues();
+			RestoreCachedInstructions();
+			ClearCachedInstructions();
 
-		OnRequest_Goto( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "next" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "next", table, arguments );
+			RemoveReturnValues();
 
-		if ( m_bExceptionPause )
+			OnRequest_StepIn( *arguments, seq );
+			break;
+		}
+		case Request_StepOut:
 		{
-			DAP_START_RESPONSE( seq, "next" );
-			DAP_SEND();
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "stepOut", table, arguments );
 
-			Continue( m_pCurVM );
-			return;
-		}
+			if ( m_bExceptionPause )
+			{
+				DAP_START_RESPONSE( seq, "stepOut" );
+				DAP_SEND();
+
+				Continue( m_pCurVM );
+				return;
+			}
 
 #ifndef SQDBG_DISABLE_PROFILER
-		// HACKHACK: Re-validate current profiler
-		if ( IsProfilerEnabled() )
-			ProfSwitchThread( m_pCurVM );
+			// HACKHACK: Re-validate current profiler
+			if ( IsProfilerEnabled() )
+				ProfSwitchThread( m_pCurVM );
 #endif
 
-		RestoreCachedInstructions();
-		ClearCachedInstructions();
-
-		RemoveReturnValues();
+			RestoreCachedInstructions();
+			ClearCachedInstructions();
 
-		OnRequest_Next( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "stepIn" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "stepIn", table, arguments );
+			RemoveReturnValues();
 
-		if ( m_bExceptionPause )
+			OnRequest_StepOut( *arguments, seq );
+			break;
+		}
+		case Request_Continue:
 		{
-			DAP_START_RESPONSE( seq, "stepIn" );
+			DAP_START_RESPONSE( seq, "continue" );
+			DAP_SET_TABLE( body );
+				body.SetBool( "allThreadsContinued", true );
 			DAP_SEND();
 
 			Continue( m_pCurVM );
-			return;
+			break;
 		}
+		case Request_Pause:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "pause", table, arguments );
 
-#ifndef SQDBG_DISABLE_PROFILER
-		// HACKHACK: Re-validate current profiler
-		if ( IsProfilerEnabled() )
-			ProfSwitchThread( m_pCurVM );
-#endif
+			int threadId;
+			arguments->GetInt( "threadId", &threadId, -1 );
 
-		RestoreCachedInstructions();
-		ClearCachedInstructions();
+			HSQUIRRELVM vm = ThreadFromID( threadId );
+
+			if ( vm )
+			{
+				DAP_START_RESPONSE( seq, "pause" );
+				DAP_SEND();
 
-		RemoveReturnValues();
+				if ( m_State != ThreadState_Suspended )
+				{
+					if ( m_pPausedThread )
+					{
+						RestoreCachedInstructions();
+						ClearCachedInstructions();
+					}
+
+					m_pPausedThread = vm;
+				}
+			}
+			else
+			{
+				DAP_ERROR_RESPONSE( seq, "pause" );
+				DAP_ERROR_BODY( 0, "invalid thread" );
+				DAP_SEND();
+			}
+
+			break;
+		}
+		case Request_Attach:
+		{
+			Print(_SC("(sqdbg) Client attached\n"));
 
-		OnRequest_StepIn( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "stepOut" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "stepOut", table, arguments );
+			DAP_START_RESPONSE( seq, "attach" );
+			DAP_SEND();
 
-		if ( m_bExceptionPause )
+			DAP_START_EVENT( seq, "process" );
+			DAP_SET_TABLE( body );
+				body.SetString( "name", "" );
+				body.SetString( "startMethod", "attach" );
+				body.SetInt( "pointerSize", (int)sizeof(void*) );
+			DAP_SEND();
+			break;
+		}
+		case Request_Disconnect:
+		case Request_Terminate:
 		{
-			DAP_START_RESPONSE( seq, "stepOut" );
+			DAP_START_RESPONSE( seq, command );
 			DAP_SEND();
 
-			Continue( m_pCurVM );
-			return;
+			DisconnectClient();
+			break;
 		}
+		case Request_Initialize:
+		{
+			json_table_t *arguments;
+			GET_OR_ERROR_RESPONSE( "initialize", table, arguments );
 
-#ifndef SQDBG_DISABLE_PROFILER
-		// HACKHACK: Re-validate current profiler
-		if ( IsProfilerEnabled() )
-			ProfSwitchThread( m_pCurVM );
-#endif
-
-		RestoreCachedInstructions();
-		ClearCachedInstructions();
-
-		RemoveReturnValues();
-
-		OnRequest_StepOut( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "continue" ) )
-	{
-		DAP_START_RESPONSE( seq, "continue" );
-		DAP_SET_TABLE( body );
-			body.SetBool( "allThreadsContinued", true );
-		DAP_SEND();
-
-		Continue( m_pCurVM );
-	}
-	else if ( command.IsEqualTo( "pause" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "pause", table, arguments );
-
-		int threadId;
-		arguments->GetInt( "threadId", &threadId, -1 );
-
-		HSQUIRRELVM vm = ThreadFromID( threadId );
-
-		if ( vm )
+			OnRequest_Initialize( *arguments, seq );
+			break;
+		}
+		case Request_ConfigurationDone:
 		{
-			DAP_START_RESPONSE( seq, "pause" );
+			DAP_START_RESPONSE( seq, "configurationDone" );
 			DAP_SEND();
+			break;
+		}
+		default:
+		{
+			requesthandler_t handler = GetCustomRequest( command );
 
-			if ( m_State != ThreadState_Suspended )
+			if ( handler )
 			{
-				if ( m_pPausedThread )
-				{
-					RestoreCachedInstructions();
-					ClearCachedInstructions();
-				}
-
-				m_pPausedThread = vm;
+				(this->*handler)( table, seq );
+				break;
 			}
-		}
-		else
-		{
-			DAP_ERROR_RESPONSE( seq, "pause" );
-			DAP_ERROR_BODY( 0, "invalid thread" );
+
+			DAP_ERROR_RESPONSE( seq, command );
+			DAP_ERROR_BODY( 0, "Unrecognised request '{command}'" );
+				wjson_table_t variables = error.SetTable( "variables" );
+				variables.SetString( "command", command );
 			DAP_SEND();
+
+			AssertClientMsg1( 0, "Unrecognised request '%s'", command.ptr );
+			break;
 		}
 	}
-	else if ( command.IsEqualTo( "attach" ) )
-	{
-		Print(_SC("(sqdbg) Client attached\n"));
+}
 
-		DAP_START_RESPONSE( seq, "attach" );
-		DAP_SEND();
+void SQDebugServer::RegisterRequest( const string_t &command, requesthandler_t handler )
+{
+	Assert( GetRequestType( command ) == Request_Unknown );
 
-		DAP_START_EVENT( seq, "process" );
-		DAP_SET_TABLE( body );
-			body.SetString( "name", "" );
-			body.SetString( "startMethod", "attach" );
-			body.SetInt( "pointerSize", (int)sizeof(void*) );
-		DAP_SEND();
-	}
-	else if ( command.IsEqualTo( "disconnect" ) || command.IsEqualTo( "terminate" ) )
-	{
-		DAP_START_RESPONSE( seq, command );
-		DAP_SEND();
+	customrequest_t &req = m_CustomRequests.Append();
+	req.command = command;
+	req.hash = JSONHashKey( command.ptr, command.len );
+	req.handler = handler;
+}
 
-		DisconnectClient();
-	}
-	else if ( command.IsEqualTo( "initialize" ) )
-	{
-		json_table_t *arguments;
-		GET_OR_ERROR_RESPONSE( "initialize", table, arguments );
+SQDebugServer::requesthandler_t SQDebugServer::GetCustomRequest( const string_t &command )
+{
+	unsigned int hash = JSONHashKey( command.ptr, command.len );
 
-		OnRequest_Initialize( *arguments, seq );
-	}
-	else if ( command.IsEqualTo( "configurationDone" ) )
-	{
-		DAP_START_RESPONSE( seq, "configurationDone" );
-		DAP_SEND();
-	}
-	else
+	for ( unsigned int i = 0; i < m_CustomRequests.Size(); i++ )
 	{
-		DAP_ERROR_RESPONSE( seq, command );
-		DAP_ERROR_BODY( 0, "Unrecognised request '{command}'" );
-			wjson_table_t variables = error.SetTable( "variables" );
-			variables.SetString( "command", command );
-		DAP_SEND();
+		const customrequest_t &req = m_CustomRequests[i];
 
-		AssertClientMsg1( 0, "Unrecognised request '%s'", command.ptr );
+		if ( req.hash == hash && command.IsEqualTo( req.command ) )
+			return req.handler;
 	}
+
+	return NULL;
 }
 
 void SQDebugServer::OnScriptCompile( const SQChar *script, unsigned int scriptlen,
@@ -4438,6 +6494,8 @@ void SQDebugServer::OnScriptCompile( const SQChar *script, unsigned int scriptle
 		scr = &m_Scripts.Append();
 		scr->sourceptr = m_Strings.Alloc( source.len );
 		scr->scriptptr = m_Strings.Alloc( scriptbufsize );
+		scr->contentptr = NULL;
+		scr->contentlen = 0;
 
 		if ( scr->sourceptr )
 		{
@@ -4453,6 +6511,13 @@ void SQDebugServer::OnScriptCompile( const SQChar *script, unsigned int scriptle
 			m_Strings.Free( scr->scriptptr );
 			scr->scriptptr = m_Strings.Alloc( scriptbufsize );
 		}
+
+		if ( scr->contentptr )
+		{
+			m_Strings.Free( scr->contentptr );
+			scr->contentptr = NULL;
+			scr->contentlen = 0;
+		}
 	}
 
 	if ( scr->scriptptr )
@@ -4480,11 +6545,33 @@ void SQDebugServer::RemoveScripts()
 		script_t &scr = m_Scripts[i];
 		m_Strings.Free( scr.sourceptr );
 		m_Strings.Free( scr.scriptptr );
+
+		if ( scr.contentptr )
+			m_Strings.Free( scr.contentptr );
 	}
 
 	m_Scripts.Purge();
 }
 
+// Returns false if the content could not be allocated, empty scripts have no content
+bool SQDebugServer::EscapeScript( script_t *scr )
+{
+	if ( !scr->scriptptr || !scr->scriptlen )
+		return true;
+
+	CBufTmpCache _bufcache( &m_SendBuf );
+	PutStr( &m_SendBuf, string_t( scr->scriptptr, scr->scriptlen ), false );
+
+	scr->contentptr = m_Strings.Alloc( m_SendBuf.Size() );
+
+	if ( !scr->contentptr )
+		return false;
+
+	memcpy( scr->contentptr, m_SendBuf.Base(), m_SendBuf.Size() );
+	scr->contentlen = m_SendBuf.Size();
+	return true;
+}
+
 void SQDebugServer::OnRequest_Initialize( const json_table_t &arguments, int seq )
 {
 	string_t clientID, clientName;
@@ -4506,49 +6593,18 @@ void SQDebugServer::OnRequest_Initialize( const json_table_t &arguments, int seq
 	arguments.GetBool( "columnsStartAt1", &m_bClientColumnOffset );
 #endif
 
+	string_t encoding;
+	arguments.GetString( "sqdbgEncoding", &encoding );
+	m_bClientCBOR = encoding.IsEqualTo( "cbor" );
+
+	m_bClientOutputLines = false;
+	arguments.GetBool( "sqdbgOutputLines", &m_bClientOutputLines );
+
 	DAP_START_RESPONSE( seq, "initialize" );
 	DAP_SET_TABLE( body );
-		body.SetBool( "supportsConfigurationDoneRequest", true );
-		body.SetBool( "supportsFunctionBreakpoints", true );
-		body.SetBool( "supportsConditionalBreakpoints", true );
-		body.SetBool( "supportsHitConditionalBreakpoints", true );
-		body.SetBool( "supportsEvaluateForHovers", true );
-		{
-			wjson_array_t exceptionBreakpointFilters = body.SetArray( "exceptionBreakpointFilters" );
-			{
-				wjson_table_t filter = exceptionBreakpointFilters.AppendTable();
-				filter.SetString( "filter", "unhandled" );
-				filter.SetString( "label", "Unhandled exceptions" );
-				filter.SetString( "description", "Break on uncaught exceptions" );
-				filter.SetBool( "default", true );
-			}
-			{
-				wjson_table_t filter = exceptionBreakpointFilters.AppendTable();
-				filter.SetString( "filter", "all" );
-				filter.SetString( "label", "All exceptions" );
-				filter.SetString( "description", "Break on both caught and uncaught exceptions" );
-			}
-		}
-		body.SetBool( "supportsSetVariable", true );
-#ifdef SUPPORTS_RESTART_FRAME
-		body.SetBool( "supportsRestartFrame", true );
-#endif
-		body.SetBool( "supportsGotoTargetsRequest", true );
-#ifndef SQDBG_DISABLE_COMPILER
-		body.SetBool( "supportsCompletionsRequest", true );
-#endif
-		body.SetBool( "supportsSetExpression", true );
-		body.SetBool( "supportsSetHitCount", true );
-		{
-			wjson_array_t a = body.SetArray( "supportedChecksumAlgorithms" );
-		}
-		body.SetBool( "supportsValueFormattingOptions", true );
-		body.SetBool( "supportsDelayedStackTraceLoading", true );
-		body.SetBool( "supportsLogPoints", true );
-		body.SetBool( "supportsTerminateRequest", true );
-		body.SetBool( "supportsDataBreakpoints", true );
-		body.SetBool( "supportsDisassembleRequest", true );
-		body.SetBool( "supportsSteppingGranularity", true );
+		SetCapabilities( body );
+		if ( m_bClientCBOR )
+			body.SetString( "sqdbgEncoding", "cbor" );
 	DAP_SEND();
 
 	DAP_START_EVENT( seq, "initialized" );
@@ -5706,6 +7762,13 @@ static inline bool HasEscapes( const SQChar *src, SQInteger len )
 
 	for ( ; src < end; src++ )
 	{
+#ifndef SQUNICODE
+		src = JSONScanEscape( src, end );
+
+		if ( src >= end )
+			break;
+#endif
+
 		switch ( *src )
 		{
 			case '\\': case '\"':
@@ -5749,6 +7812,11 @@ static inline int CountEscapes( const char *src, SQInteger len )
 
 	for ( ; src < end; src++ )
 	{
+		src = JSONScanEscape( src, end );
+
+		if ( src >= end )
+			break;
+
 		switch ( *src )
 		{
 			case '\\': case '\"':
@@ -5793,6 +7861,11 @@ static void Escape( char *dst, unsigned int *len, unsigned int size )
 
 	for ( ; dst < strEnd; dst++ )
 	{
+		dst = (char*)JSONScanEscape( dst, strEnd );
+
+		if ( dst >= strEnd )
+			break;
+
 		switch ( *dst )
 		{
 			case '\\': case '\"':
@@ -20034,6 +22107,28 @@ void SQDebugServer::ProfSwitchThread( HSQUIRRELVM vm )
 	if ( m_Profilers.Size() == 0 )
 		m_Profilers.Reserve(1);
 
+#ifndef SQDBG_DISABLE_PROFILER_AUTO
+	// Previous thread suspended itself, don't count the time until it's woken up
+	if ( m_pProfiler && m_pProfiler->IsActive() )
+	{
+		for ( unsigned int i = 0; i < m_Profilers.Size(); i++ )
+		{
+			threadprofiler_t &tp = m_Profilers[i];
+			if ( &tp.prof == m_pProfiler )
+			{
+				if ( tp.thread && sq_type(tp.thread->_obj) == OT_THREAD &&
+						_thread(tp.thread->_obj) != vm &&
+						_thread(tp.thread->_obj)->_suspended )
+				{
+					m_pProfiler->ThreadSuspend();
+				}
+
+				break;
+			}
+		}
+	}
+#endif
+
 	for ( unsigned int i = 0; i < m_Profilers.Size(); i++ )
 	{
 		threadprofiler_t &tp = m_Profilers[i];
@@ -20042,6 +22137,10 @@ void SQDebugServer::ProfSwitchThread( HSQUIRRELVM vm )
 			if ( _thread(tp.thread->_obj) == vm )
 			{
 				m_pProfiler = tp.prof.IsEnabled() ? &tp.prof : NULL;
+#ifndef SQDBG_DISABLE_PROFILER_AUTO
+				if ( m_pProfiler && m_pProfiler->IsThreadSuspended() )
+					m_pProfiler->ThreadWakeup();
+#endif
 				return;
 			}
 		}
@@ -20093,6 +22192,7 @@ void SQDebugServer::ProfStop()
 	m_Profilers.Clear();
 	m_pProfiler = NULL;
 	m_bProfilerEnabled = false;
+	m_bProfContinuousStarted = false;
 }
 
 void SQDebugServer::ProfPause( HSQUIRRELVM vm )
@@ -20136,28 +22236,234 @@ void SQDebugServer::ProfGroupEnd( HSQUIRRELVM vm )
 	CProfiler *prof = GetProfilerFast( vm );
 	if ( prof && prof->IsActive() )
 	{
-		prof->GroupEnd();
+		prof->GroupEnd();
+	}
+}
+
+sqstring_t SQDebugServer::ProfGets( HSQUIRRELVM vm, SQString *tag, int type )
+{
+	Assert( IsProfilerEnabled() );
+
+	CProfiler *pProfiler = NULL;
+
+	for ( unsigned int i = 0; i < m_Profilers.Size(); i++ )
+	{
+		threadprofiler_t &tp = m_Profilers[i];
+		if ( tp.thread && sq_type(tp.thread->_obj) == OT_THREAD )
+		{
+			if ( _thread(tp.thread->_obj) == vm )
+			{
+				pProfiler = &tp.prof;
+				break;
+			}
+		}
+		else
+		{
+			__ObjRelease( tp.thread );
+			m_Profilers.Remove(i);
+			i--;
+		}
+	}
+
+	if ( !pProfiler )
+		return { 0, 0 };
+
+	const int size = pProfiler->GetMaxOutputLen( tag, type );
+
+	if ( size <= 0 )
+		return { 0, 0 };
+
+	SQChar *buf = (SQChar*)ScratchPad( sq_rsl(size) );
+	int len = pProfiler->Output( tag, type, buf, size );
+	Assert( len >= 0 );
+
+	return { buf, (unsigned int)len };
+}
+
+void SQDebugServer::ProfPrint( HSQUIRRELVM vm, SQString *tag, int type )
+{
+	CScratch_Restore_Auto _sr( &m_Scratch );
+	sqstring_t str = ProfGets( vm, tag, type );
+
+	if ( str.IsEmpty() )
+		return;
+
+	// Print each line
+	for ( SQChar *start = str.ptr; ; )
+	{
+		SQChar *end = scstrchr( start, '\n' );
+		if ( !end )
+			break;
+
+		int linelen = (int)( end + 1 - start );
+
+		_OutputDebugStringFmt( _SC(FMT_VSTR), linelen, start );
+		m_Print( vm, _SC(FMT_VSTR), linelen, start );
+		SendEvent_OutputStdOut( sqstring_t( start, linelen ), NULL );
+
+		if ( end + 1 >= str.ptr + str.len )
+			break;
+
+		start = end + 1;
+	}
+}
+
+bool SQDebugServer::ProfSnapshot( HSQUIRRELVM vm, SQString *name )
+{
+	Assert( IsProfilerEnabled() );
+
+	CProfiler *prof = GetProfiler( vm );
+	if ( !prof || !prof->IsEnabled() )
+		return false;
+
+	CProfiler::snapshot_t *snapshot = NULL;
+
+	for ( unsigned int i = 0; i < m_ProfSnapshots.Size(); i++ )
+	{
+		CProfiler::snapshot_t &sn = m_ProfSnapshots[i];
+		if ( sn.name == name )
+		{
+			CProfiler::ReleaseSnapshot( &sn );
+			snapshot = &sn;
+			break;
+		}
+	}
+
+	if ( !snapshot )
+		snapshot = &m_ProfSnapshots.Append();
+
+	snapshot->name = name;
+	__ObjAddRef( name );
+
+	prof->Snapshot( snapshot );
+	return true;
+}
+
+sqstring_t SQDebugServer::ProfDiff( SQString *a, SQString *b )
+{
+	const CProfiler::snapshot_t *sa = NULL;
+	const CProfiler::snapshot_t *sb = NULL;
+
+	for ( unsigned int i = 0; i < m_ProfSnapshots.Size(); i++ )
+	{
+		const CProfiler::snapshot_t &sn = m_ProfSnapshots[i];
+
+		if ( sn.name == a )
+			sa = &sn;
+
+		if ( sn.name == b )
+			sb = &sn;
+	}
+
+	if ( !sa || !sb )
+		return { 0, 0 };
+
+	const int size = CProfiler::GetMaxDiffOutputLen( *sa, *sb );
+	SQChar *buf = (SQChar*)ScratchPad( sq_rsl(size) );
+	int len = CProfiler::OutputDiff( *sa, *sb, buf, size );
+	Assert( len >= 0 );
+
+	return { buf, (unsigned int)len };
+}
+
+void SQDebugServer::ProfRemoveSnapshots()
+{
+	for ( unsigned int i = 0; i < m_ProfSnapshots.Size(); i++ )
+		CProfiler::ReleaseSnapshot( &m_ProfSnapshots[i] );
+
+	m_ProfSnapshots.Purge();
+}
+
+#ifndef SQDBG_PROF_FLUSH_FILE_COUNT
+#define SQDBG_PROF_FLUSH_FILE_COUNT 16
+#endif
+
+static inline unsigned long long ProfSystemTime()
+{
+	return std::chrono::duration_cast< std::chrono::milliseconds >(
+			std::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+void SQDebugServer::ProfContinuous( const char *dir, int interval )
+{
+	bool started = m_bProfContinuousStarted;
+	m_bProfContinuousStarted = false;
+
+	if ( m_pszProfFlushDir )
+	{
+		// Write what was collected since the last flush
+		if ( IsProfilerEnabled() )
+			ProfFlush();
+
+		sqdbg_free( m_pszProfFlushDir, m_nProfFlushDirLen + 1 );
+		m_pszProfFlushDir = NULL;
+		m_nProfFlushDirLen = 0;
+		m_nProfFlushInterval = 0;
+
+		Print(_SC("(sqdbg) Continuous profiling stopped\n"));
+	}
+
+	if ( !dir || !dir[0] || interval <= 0 )
+	{
+		if ( started && IsProfilerEnabled() )
+			ProfStop();
+
+		return;
+	}
+
+	m_nProfFlushDirLen = strlen( dir );
+	m_pszProfFlushDir = (char*)sqdbg_malloc( m_nProfFlushDirLen + 1 );
+	AssertOOM( m_pszProfFlushDir, m_nProfFlushDirLen + 1 );
+	memcpy( m_pszProfFlushDir, dir, m_nProfFlushDirLen + 1 );
+
+	m_nProfFlushInterval = interval;
+	m_nProfFlushIndex = 0;
+	m_nProfFlushStartTime = ProfSystemTime();
+	m_ProfFlushTime = std::chrono::steady_clock::now() + std::chrono::milliseconds( interval );
+
+	if ( !IsProfilerEnabled() )
+	{
+		ProfStart();
+		started = true;
 	}
+
+	m_bProfContinuousStarted = started;
+
+	Print(_SC("(sqdbg) Writing profiles to '" FMT_CSTR "' every %d ms\n"), m_pszProfFlushDir, interval);
 }
 
-sqstring_t SQDebugServer::ProfGets( HSQUIRRELVM vm, SQString *tag, int type )
+//
+// File: u8[4] "SQPF", u16 version, u16 thread count,
+//       u64 start time, u64 end time (ms since Unix epoch),
+//       followed by thread count serialised snapshots
+//
+void SQDebugServer::ProfFlush()
 {
 	Assert( IsProfilerEnabled() );
+	Assert( m_pszProfFlushDir );
 
-	CProfiler *pProfiler = NULL;
+	STATIC_ASSERT( SQDBG_PROF_FLUSH_FILE_COUNT > 0 && SQDBG_PROF_FLUSH_FILE_COUNT <= 100 );
+
+	CScratch_Restore_Auto _sr( &m_Scratch );
+
+	int pathlen = m_nProfFlushDirLen + STRLEN("/sqdbg_prof_00.bin") + 1;
+	char *path = (char*)ScratchPad( pathlen );
+	snprintf( path, pathlen, "%s/sqdbg_prof_%02d.bin", m_pszProfFlushDir, m_nProfFlushIndex );
+
+	m_nProfFlushIndex = ( m_nProfFlushIndex + 1 ) % SQDBG_PROF_FLUSH_FILE_COUNT;
+
+	FILE *file = fopen( path, "wb" );
+
+	if ( !file )
+	{
+		PrintError(_SC("(sqdbg) Failed to open profile output file '" FMT_CSTR "'\n"), path);
+		return;
+	}
 
 	for ( unsigned int i = 0; i < m_Profilers.Size(); i++ )
 	{
 		threadprofiler_t &tp = m_Profilers[i];
-		if ( tp.thread && sq_type(tp.thread->_obj) == OT_THREAD )
-		{
-			if ( _thread(tp.thread->_obj) == vm )
-			{
-				pProfiler = &tp.prof;
-				break;
-			}
-		}
-		else
+		if ( !tp.thread || sq_type(tp.thread->_obj) != OT_THREAD )
 		{
 			__ObjRelease( tp.thread );
 			m_Profilers.Remove(i);
@@ -20165,47 +22471,48 @@ sqstring_t SQDebugServer::ProfGets( HSQUIRRELVM vm, SQString *tag, int type )
 		}
 	}
 
-	if ( !pProfiler )
-		return { 0, 0 };
-
-	const int size = pProfiler->GetMaxOutputLen( tag, type );
-
-	if ( size <= 0 )
-		return { 0, 0 };
+	unsigned long long startTime = m_nProfFlushStartTime;
+	unsigned long long endTime = m_nProfFlushStartTime = ProfSystemTime();
 
-	SQChar *buf = (SQChar*)ScratchPad( sq_rsl(size) );
-	int len = pProfiler->Output( tag, type, buf, size );
-	Assert( len >= 0 );
+	unsigned char header[24];
+	unsigned char *ptr = header;
 
-	return { buf, (unsigned int)len };
-}
+	*ptr++ = 'S'; *ptr++ = 'Q'; *ptr++ = 'P'; *ptr++ = 'F';
+	CProfiler::PutLE( ptr, 1, 2 );
+	CProfiler::PutLE( ptr, m_Profilers.Size(), 2 );
+	CProfiler::PutLE( ptr, startTime, 8 );
+	CProfiler::PutLE( ptr, endTime, 8 );
 
-void SQDebugServer::ProfPrint( HSQUIRRELVM vm, SQString *tag, int type )
-{
-	CScratch_Restore_Auto _sr( &m_Scratch );
-	sqstring_t str = ProfGets( vm, tag, type );
+	Assert( ptr == header + sizeof(header) );
 
-	if ( str.IsEmpty() )
-		return;
+	bool ok = ( fwrite( header, sizeof(header), 1, file ) == 1 );
 
-	// Print each line
-	for ( SQChar *start = str.ptr; ; )
+	for ( unsigned int i = 0; i < m_Profilers.Size(); i++ )
 	{
-		SQChar *end = scstrchr( start, '\n' );
-		if ( !end )
-			break;
+		threadprofiler_t &tp = m_Profilers[i];
+		CProfiler::snapshot_t snapshot = {};
 
-		int linelen = (int)( end + 1 - start );
+		if ( tp.prof.IsEnabled() )
+		{
+			tp.prof.Snapshot( &snapshot );
+			tp.prof.Reset( _thread(tp.thread->_obj), NULL );
+			tp.prof.ResetGroups();
+		}
 
-		_OutputDebugStringFmt( _SC(FMT_VSTR), linelen, start );
-		m_Print( vm, _SC(FMT_VSTR), linelen, start );
-		SendEvent_OutputStdOut( sqstring_t( start, linelen ), NULL );
+		int size = CProfiler::GetMaxSerialisedLen( snapshot );
+		unsigned char *buf = (unsigned char*)ScratchPad( size );
+		int len = CProfiler::Serialise( snapshot, buf, size );
 
-		if ( end + 1 >= str.ptr + str.len )
-			break;
+		if ( ok )
+			ok = ( fwrite( buf, len, 1, file ) == 1 );
 
-		start = end + 1;
+		CProfiler::ReleaseSnapshot( &snapshot );
 	}
+
+	fclose( file );
+
+	if ( !ok )
+		PrintError(_SC("(sqdbg) Failed to write profile output file '" FMT_CSTR "'\n"), path);
 }
 #endif
 
@@ -20813,12 +23120,37 @@ void SQDebugServer::Break( HSQUIRRELVM vm, breakreason_t reason )
 			wjson_array_t ids = body.SetArray( "hitBreakpointIds" );
 			ids.Append( reason.id );
 		}
-	DAP_SEND();
+	DAP_SEND_BROADCAST_STATE();
 
 	if ( m_State != ThreadState_Suspended )
 		m_State = ThreadState_SuspendNow;
 }
 
+void SQDebugServer::FlushSend()
+{
+	if ( !m_Server.Flush() )
+	{
+		PrintLastServerMessage();
+		DisconnectClient();
+		return;
+	}
+
+	if ( m_Server.IsSendQueueEmpty() )
+	{
+		unsigned int dropped = m_Server.GetDroppedMessageCount();
+
+		if ( dropped )
+		{
+			stringbuf_t< 64 > buf;
+			buf.Puts( "(sqdbg) Dropped " );
+			buf.PutInt( dropped );
+			buf.Puts( " output messages\n" );
+
+			SendEvent_OutputStdOut( string_t( buf ), NULL );
+		}
+	}
+}
+
 void SQDebugServer::Suspend()
 {
 	Assert( m_State == ThreadState_SuspendNow );
@@ -20837,7 +23169,15 @@ void SQDebugServer::Suspend()
 			break;
 		}
 
-		sqdbg_sleep( 5 );
+		if ( m_State != ThreadState_Suspended )
+			break;
+
+		int timeout = SQDBG_SUSPEND_WAIT;
+
+		if ( m_OutputBuf.Size() && m_nOutputFlushInterval < timeout )
+			timeout = m_nOutputFlushInterval;
+
+		m_Server.Wait( timeout, m_nWakeFd );
 	}
 	while ( m_State == ThreadState_Suspended );
 }
@@ -20847,13 +23187,15 @@ void SQDebugServer::Continue( HSQUIRRELVM vm )
 	if ( m_State == ThreadState_SuspendNow )
 		return;
 
+	SetObserverState( NULL, 0 );
+
 	if ( IsClientConnected() && m_State != ThreadState_Running )
 	{
 		DAP_START_EVENT( ++m_Sequence, "continued" );
 		DAP_SET_TABLE( body );
 			body.SetInt( "threadId", ThreadToID( vm ) );
 			body.SetBool( "allThreadsContinued", true );
-		DAP_SEND();
+		DAP_SEND_BROADCAST();
 	}
 
 	m_State = ThreadState_Running;
@@ -21269,6 +23611,22 @@ void SQDebugServer::DebugHook( HSQUIRRELVM vm, int type,
 	m_bInDebugHook = true;
 #endif
 
+#ifdef SQDBG_NET_THREAD
+	// Don't wait for the next frame to pause
+	if ( m_Server.IsPauseRequested() )
+	{
+		Frame();
+
+		if ( !IsClientConnected() )
+		{
+#if SQUIRREL_VERSION_NUMBER < 300
+			m_bInDebugHook = false;
+#endif
+			return;
+		}
+	}
+#endif
+
 #ifdef NATIVE_DEBUG_HOOK
 	SQVM::CallInfo *ci = vm->ci;
 #else
@@ -21395,7 +23753,14 @@ void SQDebugServer::DebugHook( HSQUIRRELVM vm, int type,
 
 				if ( !bGenerator || ( ci != vm->_callsstack && ((ci-1)->_ip-1)->op == _OP_RESUME ) )
 				{
-					m_pProfiler->CallBegin( func );
+					if ( func->_bgenerator )
+					{
+						m_pProfiler->CallResume( func, ci->_generator );
+					}
+					else
+					{
+						m_pProfiler->CallBegin( func );
+					}
 				}
 			}
 		}
@@ -21829,7 +24194,14 @@ void SQDebugServer::DebugHook( HSQUIRRELVM vm, int type,
 
 				if ( !bGenerator || ( ci != vm->_callsstack && ((ci-1)->_ip-1)->op == _OP_RESUME ) )
 				{
-					m_pProfiler->CallBegin( pFunc );
+					if ( pFunc->_bgenerator )
+					{
+						m_pProfiler->CallResume( pFunc, ci->_generator );
+					}
+					else
+					{
+						m_pProfiler->CallBegin( pFunc );
+					}
 				}
 			}
 #endif
@@ -21848,7 +24220,14 @@ void SQDebugServer::DebugHook( HSQUIRRELVM vm, int type,
 
 				if ( !bGenerator )
 				{
-					m_pProfiler->CallEnd();
+					if ( ci->_generator && (ci->_ip-1)->op == _OP_YIELD )
+					{
+						m_pProfiler->CallYield( ci->_generator );
+					}
+					else
+					{
+						m_pProfiler->CallEnd();
+					}
 				}
 			}
 #endif
@@ -21958,7 +24337,14 @@ void SQDebugServer::ProfHook( HSQUIRRELVM vm, int type )
 			{
 				if ( !bGenerator || ( ci != vm->_callsstack && ((ci-1)->_ip-1)->op == _OP_RESUME ) )
 				{
-					m_pProfiler->CallBegin( func );
+					if ( func->_bgenerator )
+					{
+						m_pProfiler->CallResume( func, ci->_generator );
+					}
+					else
+					{
+						m_pProfiler->CallBegin( func );
+					}
 				}
 
 				break;
@@ -21967,7 +24353,14 @@ void SQDebugServer::ProfHook( HSQUIRRELVM vm, int type )
 			{
 				if ( !bGenerator )
 				{
-					m_pProfiler->CallEnd();
+					if ( ci->_generator && (ci->_ip-1)->op == _OP_YIELD )
+					{
+						m_pProfiler->CallYield( ci->_generator );
+					}
+					else
+					{
+						m_pProfiler->CallEnd();
+					}
 				}
 
 				break;
@@ -21983,24 +24376,92 @@ void SQDebugServer::SendEvent_OutputStdOut( const T &strOutput, const SQVM::Call
 {
 	Assert( !ci || sq_type(ci->_closure) == OT_CLOSURE );
 
+	if ( !IsClientConnected() )
+		return;
+
+	SQString *source = NULL;
+	int line = 0;
+
+	if ( ci )
+	{
+		SQFunctionProto *func = _fp(_closure(ci->_closure)->_function);
+		if ( !IsEqual( _SC("sqdbg"), _string(func->_sourcename) ) )
+		{
+			source = _string(func->_sourcename);
+			line = (int)func->GetLine( ci->_ip );
+		}
+	}
+
+	if ( m_OutputBuf.Size() &&
+			( line != m_nOutputLine ||
+			  source != ( sq_type(m_OutputSource) == OT_STRING ? _string(m_OutputSource) : NULL ) ) )
+	{
+		// Output with different attribution is sent separately if the client asked for it,
+		// otherwise the batch is sent without attribution
+		if ( m_bClientOutputLines )
+		{
+			FlushOutput();
+		}
+		else
+		{
+			m_OutputSource.Null();
+			m_nOutputLine = 0;
+		}
+	}
+
+	if ( !m_OutputBuf.Size() )
+	{
+		if ( source )
+		{
+			m_OutputSource = source;
+		}
+		else
+		{
+			m_OutputSource.Null();
+		}
+
+		m_nOutputLine = line;
+
+		if ( m_nOutputFlushInterval )
+		{
+			m_OutputFlushTime = std::chrono::steady_clock::now() +
+				std::chrono::milliseconds( m_nOutputFlushInterval );
+		}
+	}
+
+	PutStr( &m_OutputBuf, strOutput, false );
+
+	if ( m_OutputBuf.Size() >= m_nOutputBatchSize )
+		FlushOutput();
+}
+
+void SQDebugServer::FlushOutput()
+{
+	int size = m_OutputBuf.Size();
+
+	if ( !size )
+		return;
+
+	// Events started from here don't flush again
+	m_OutputBuf.size = 0;
+
 	if ( IsClientConnected() )
 	{
 		DAP_START_EVENT( ++m_Sequence, "output" );
 		DAP_SET_TABLE( body );
 			body.SetString( "category", "stdout" );
-			body.SetString( "output", strOutput );
-			if ( ci )
+			m_nSendBlobOffset = body.SetStringPlaceholder( "output" );
+			m_SendBlob.Assign( m_OutputBuf.Base(), size );
+			if ( sq_type(m_OutputSource) == OT_STRING )
 			{
-				SQFunctionProto *func = _fp(_closure(ci->_closure)->_function);
-				if ( !IsEqual( _SC("sqdbg"), _string(func->_sourcename) ) )
-				{
-					body.SetInt( "line", (int)func->GetLine( ci->_ip ) );
-					wjson_table_t source = body.SetTable( "source" );
-					SetSource( source, _string(func->_sourcename) );
-				}
+				body.SetInt( "line", m_nOutputLine );
+				wjson_table_t source = body.SetTable( "source" );
+				SetSource( source, _string(m_OutputSource) );
 			}
-		DAP_SEND();
+		DAP_SEND_BROADCAST_DROPPABLE();
 	}
+
+	m_OutputSource.Null();
 }
 
 SQInteger SQDebugServer::SQDefineClass( HSQUIRRELVM vm )
@@ -22057,9 +24518,13 @@ SQInteger SQDebugServer::SQPrintDisassembly( HSQUIRRELVM vm )
 SQInteger SQDebugServer::SQProfStart( HSQUIRRELVM vm )
 {
 	SQDebugServer *dbg = sqdbg_get( vm );
-	if ( dbg && !dbg->IsProfilerEnabled() )
+	if ( dbg )
 	{
-		dbg->ProfStart();
+		if ( !dbg->IsProfilerEnabled() )
+			dbg->ProfStart();
+
+		// Keep running after continuous mode stops
+		dbg->m_bProfContinuousStarted = false;
 	}
 
 	return 0;
@@ -22275,6 +24740,65 @@ SQInteger SQDebugServer::SQProfPrint( HSQUIRRELVM vm )
 
 	return 0;
 }
+
+SQInteger SQDebugServer::SQProfSnapshot( HSQUIRRELVM vm )
+{
+	SQDebugServer *dbg = sqdbg_get( vm );
+	if ( dbg && dbg->IsProfilerEnabled() )
+	{
+		HSQUIRRELVM thread = vm;
+
+		HSQOBJECT arg1 = {};
+
+		SQInteger top = sq_gettop( vm );
+
+		if ( top > 3 )
+			return sq_throwerror( vm, _SC("wrong number of parameters") );
+
+		if ( top > 2 )
+		{
+			sq_getstackobj( vm, -2, &arg1 );
+
+			if ( sq_type(arg1) != OT_THREAD )
+				return sq_throwerror( vm, _SC("expected thread") );
+
+			thread = _thread(arg1);
+			arg1 = {};
+		}
+
+		sq_getstackobj( vm, -1, &arg1 );
+
+		if ( sq_type(arg1) != OT_STRING )
+			return sq_throwerror( vm, _SC("expected snapshot name (string)") );
+
+		dbg->ProfSnapshot( thread, _string(arg1) );
+	}
+
+	return 0;
+}
+
+SQInteger SQDebugServer::SQProfDiff( HSQUIRRELVM vm )
+{
+	SQDebugServer *dbg = sqdbg_get( vm );
+	if ( dbg )
+	{
+		HSQOBJECT a, b;
+		sq_getstackobj( vm, -2, &a );
+		sq_getstackobj( vm, -1, &b );
+		Assert( sq_type(a) == OT_STRING && sq_type(b) == OT_STRING );
+
+		CScratch_Restore_Auto _sr( &dbg->m_Scratch );
+		sqstring_t str = dbg->ProfDiff( _string(a), _string(b) );
+
+		if ( str.len )
+		{
+			sq_pushstring( vm, str.ptr, str.len );
+			return 1;
+		}
+	}
+
+	return 0;
+}
 #endif
 
 SQInteger SQDebugServer::SQBreak( HSQUIRRELVM vm )
@@ -23005,11 +25529,44 @@ int sqdbg_listen_socket( HSQDEBUGSERVER dbg, unsigned short port )
 	return ( dbg->ListenSocket( port ) == false );
 }
 
+int sqdbg_listen_unix( HSQDEBUGSERVER dbg, const char *path )
+{
+	return ( dbg->ListenUnix( path ) == false );
+}
+
+int sqdbg_listen_shm( HSQDEBUGSERVER dbg, const char *name )
+{
+	return ( dbg->ListenShm( name ) == false );
+}
+
+int sqdbg_attach_stdio( HSQDEBUGSERVER dbg )
+{
+	return ( dbg->AttachStdio() == false );
+}
+
 void sqdbg_frame( HSQDEBUGSERVER dbg )
 {
 	dbg->Frame();
 }
 
+int sqdbg_frame_budget( HSQDEBUGSERVER dbg, int max_us )
+{
+	return !dbg->Frame( max_us > 0 ? max_us : 1 );
+}
+
+void sqdbg_frame_budget_stats( HSQDEBUGSERVER dbg,
+		unsigned int *frames, unsigned int *hits, unsigned int *max_us )
+{
+	if ( frames )
+		*frames = dbg->m_nBudgetFrames;
+
+	if ( hits )
+		*hits = dbg->m_nBudgetHits;
+
+	if ( max_us )
+		*max_us = dbg->m_nBudgetMaxTime;
+}
+
 void sqdbg_on_script_compile( HSQDEBUGSERVER dbg,
 		const SQChar *script, SQInteger scriptlen,
 		const SQChar *sourcename, SQInteger sourcenamelen )
@@ -23021,3 +25578,44 @@ int sqdbg_is_client_connected( HSQDEBUGSERVER dbg )
 {
 	return dbg->IsClientConnected();
 }
+
+int sqdbg_output_batching( HSQDEBUGSERVER dbg, int max_bytes, int interval_ms )
+{
+	if ( max_bytes < 0 || interval_ms < 0 )
+		return 1;
+
+	dbg->FlushOutput();
+	dbg->m_nOutputBatchSize = max_bytes;
+	dbg->m_nOutputFlushInterval = interval_ms;
+	return 0;
+}
+
+int sqdbg_wakeup_fd( HSQDEBUGSERVER dbg, int fd )
+{
+#ifndef _WIN32
+	dbg->m_nWakeFd = fd;
+	return 0;
+#else
+	(void)dbg;
+	(void)fd;
+	return 1;
+#endif
+}
+
+int sqdbg_record( HSQDEBUGSERVER dbg, const char *path )
+{
+	return !dbg->StartRecording( path );
+}
+
+int sqdbg_prof_continuous( HSQDEBUGSERVER dbg, const char *dir, int interval_ms )
+{
+#ifndef SQDBG_DISABLE_PROFILER
+	dbg->ProfContinuous( dir, interval_ms );
+	return 0;
+#else
+	(void)dbg;
+	(void)dir;
+	(void)interval_ms;
+	return 1;
+#endif
+}
@@ -0,0 +1,182 @@
+//-----------------------------------------------------------------------
+//                       github.com/samisalreadytaken/sqdbg
+//-----------------------------------------------------------------------
+//
+// Shared memory rings between the debugger and a local adapter process.
+// Each ring carries the same byte stream as a socket would.
+//
+// The adapter resets the rings, increments serial and sets state to attach.
+// The debugger sets connected when it accepts, and clears it on disconnect.
+// The adapter clears state to detach, and waits for connected to clear
+// before attaching again.
+//
+// Each side waits on the head of the ring it reads from.
+//
+
+#ifndef SQDBG_SHM_H
+#define SQDBG_SHM_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+
+#define SQDBG_SHM_MAGIC 0x47424453 // "SDBG"
+#define SQDBG_SHM_VERSION 1
+
+// Power of 2
+#ifndef SQDBG_SHM_RING_SIZE
+#define SQDBG_SHM_RING_SIZE ( 1 << 20 )
+#endif
+
+struct shmring_t
+{
+	// Free running positions
+	unsigned int head;
+	unsigned int tail;
+	unsigned int waiting;
+	char pad[ 64 - 3 * sizeof(unsigned int) ];
+	char data[ SQDBG_SHM_RING_SIZE ];
+};
+
+struct shmheader_t
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int ringsize;
+	unsigned int state;
+	unsigned int serial;
+	unsigned int connected;
+	char pad[ 64 - 6 * sizeof(unsigned int) ];
+	shmring_t toServer;
+	shmring_t toClient;
+};
+
+inline void ShmRingReset( shmring_t *ring )
+{
+	__atomic_store_n( &ring->head, 0, __ATOMIC_RELAXED );
+	__atomic_store_n( &ring->tail, 0, __ATOMIC_RELAXED );
+	__atomic_store_n( &ring->waiting, 0, __ATOMIC_RELEASE );
+}
+
+// Returns bytes written, less than len if the ring is full
+inline unsigned int ShmRingWrite( shmring_t *ring, const char *buf, unsigned int len )
+{
+	unsigned int head = __atomic_load_n( &ring->head, __ATOMIC_RELAXED );
+	unsigned int tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+	unsigned int space = SQDBG_SHM_RING_SIZE - ( head - tail );
+
+	if ( len > space )
+		len = space;
+
+	if ( !len )
+		return 0;
+
+	unsigned int offset = head & ( SQDBG_SHM_RING_SIZE - 1 );
+	unsigned int first = SQDBG_SHM_RING_SIZE - offset;
+
+	if ( first > len )
+		first = len;
+
+	memcpy( ring->data + offset, buf, first );
+	memcpy( ring->data, buf + first, len - first );
+
+	__atomic_store_n( &ring->head, head + len, __ATOMIC_SEQ_CST );
+
+	if ( __atomic_load_n( &ring->waiting, __ATOMIC_SEQ_CST ) )
+		syscall( SYS_futex, &ring->head, FUTEX_WAKE, 1, NULL, NULL, 0 );
+
+	return len;
+}
+
+// Returns bytes read
+inline unsigned int ShmRingRead( shmring_t *ring, char *buf, unsigned int len )
+{
+	unsigned int tail = __atomic_load_n( &ring->tail, __ATOMIC_RELAXED );
+	unsigned int head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+	unsigned int avail = head - tail;
+
+	if ( len > avail )
+		len = avail;
+
+	if ( !len )
+		return 0;
+
+	unsigned int offset = tail & ( SQDBG_SHM_RING_SIZE - 1 );
+	unsigned int first = SQDBG_SHM_RING_SIZE - offset;
+
+	if ( first > len )
+		first = len;
+
+	memcpy( buf, ring->data + offset, first );
+	memcpy( buf + first, ring->data, len - first );
+
+	__atomic_store_n( &ring->tail, tail + len, __ATOMIC_RELEASE );
+	return len;
+}
+
+inline bool ShmRingIsEmpty( shmring_t *ring )
+{
+	return __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE ) == __atomic_load_n( &ring->tail, __ATOMIC_RELAXED );
+}
+
+// Sleeps until the writer moves head or the timeout passes
+inline void ShmRingWait( shmring_t *ring, int timeout_ms )
+{
+	unsigned int tail = __atomic_load_n( &ring->tail, __ATOMIC_RELAXED );
+
+	__atomic_store_n( &ring->waiting, 1, __ATOMIC_SEQ_CST );
+
+	if ( __atomic_load_n( &ring->head, __ATOMIC_SEQ_CST ) == tail )
+	{
+		timespec ts;
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = ( timeout_ms % 1000 ) * 1000000;
+
+		syscall( SYS_futex, &ring->head, FUTEX_WAIT, tail, &ts, NULL, 0 );
+	}
+
+	__atomic_store_n( &ring->waiting, 0, __ATOMIC_RELAXED );
+}
+
+// Maps the named region, creating it if create is true. Returns NULL on failure
+inline shmheader_t *ShmMap( const char *name, bool create )
+{
+	int fd = shm_open( name, create ? ( O_CREAT | O_RDWR ) : O_RDWR, 0600 );
+
+	if ( fd == -1 )
+		return NULL;
+
+	if ( create && ftruncate( fd, sizeof(shmheader_t) ) == -1 )
+	{
+		close( fd );
+		return NULL;
+	}
+
+	struct stat st;
+
+	if ( fstat( fd, &st ) == -1 || st.st_size < (off_t)sizeof(shmheader_t) )
+	{
+		close( fd );
+		return NULL;
+	}
+
+	void *ptr = mmap( NULL, sizeof(shmheader_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	close( fd );
+
+	if ( ptr == MAP_FAILED )
+		return NULL;
+
+	return (shmheader_t*)ptr;
+}
+
+inline void ShmUnmap( shmheader_t *shm )
+{
+	munmap( shm, sizeof(shmheader_t) );
+}
+
+#endif // SQDBG_SHM_H
@@ -225,6 +225,28 @@ do { \
 	(mbc)[3] = 0x80 | ( (cp) & 0x3F ); \
 } while (0)
 
+#if !defined(SQDBG_DISABLE_SIMD) && \
+	( defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+	#define SQDBG_SSE2
+	#include <emmintrin.h>
+
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+
+// Index of the lowest set bit, mask is non-zero
+inline int ctz32( unsigned int mask )
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward( &i, mask );
+	return (int)i;
+#else
+	return __builtin_ctz( mask );
+#endif
+}
+#endif
+
 typedef enum
 {
 	kUTFNoEscape = 0,
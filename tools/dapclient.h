@@ -0,0 +1,378 @@
+//-----------------------------------------------------------------------
+//                       github.com/samisalreadytaken/sqdbg
+//-----------------------------------------------------------------------
+//
+// Loopback DAP client, latency tables and test VM host shared by
+// sqdbgload and sqdbgreplay. Included after sqdbg/server.cpp
+//
+
+#ifndef SQDBG_DAPCLIENT_H
+#define SQDBG_DAPCLIENT_H
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Flags set once by one thread and polled by another
+static inline bool Load( bool *flag )
+{
+	return __atomic_load_n( flag, __ATOMIC_ACQUIRE );
+}
+
+static inline void Store( bool *flag )
+{
+	__atomic_store_n( flag, true, __ATOMIC_RELEASE );
+}
+
+static inline long long NowNs()
+{
+	return std::chrono::duration_cast< std::chrono::nanoseconds >(
+			std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+//
+// Latency samples per request type, in up to MAX_SAMPLE_SETS sets each
+//
+#define MAX_STATS 64
+#define MAX_SAMPLE_SETS 2
+
+struct samples_t
+{
+	long long *ptr;
+	int count;
+	int size;
+};
+
+struct stat_t
+{
+	char name[32];
+	samples_t sets[ MAX_SAMPLE_SETS ];
+	int missing;
+};
+
+static stat_t g_Stats[ MAX_STATS ];
+static int g_nStats = 0;
+
+// Returns NULL when the table is full
+static inline stat_t *GetStat( const char *name, int len )
+{
+	for ( int i = 0; i < g_nStats; i++ )
+	{
+		if ( !strncmp( g_Stats[i].name, name, len ) && g_Stats[i].name[len] == 0 )
+			return &g_Stats[i];
+	}
+
+	if ( g_nStats == MAX_STATS || len >= (int)sizeof(g_Stats[0].name) )
+		return NULL;
+
+	stat_t *stat = &g_Stats[ g_nStats++ ];
+	memcpy( stat->name, name, len );
+	stat->name[ len ] = 0;
+	return stat;
+}
+
+static inline stat_t *GetStat( const char *name )
+{
+	return GetStat( name, strlen( name ) );
+}
+
+static inline void AddSample( stat_t *stat, int set, long long ns )
+{
+	if ( !stat )
+		return;
+
+	Assert( set < MAX_SAMPLE_SETS );
+	samples_t *samples = &stat->sets[ set ];
+
+	if ( samples->count == samples->size )
+	{
+		samples->size = samples->size ? samples->size * 2 : 1024;
+		samples->ptr = (long long*)realloc( samples->ptr, samples->size * sizeof(long long) );
+	}
+
+	samples->ptr[ samples->count++ ] = ns;
+}
+
+static inline int _sort( const void *pa, const void *pb )
+{
+	long long a = *(const long long*)pa;
+	long long b = *(const long long*)pb;
+	return ( a > b ) - ( a < b );
+}
+
+static inline double Percentile( const samples_t *samples, double p )
+{
+	if ( !samples->count )
+		return 0.0;
+
+	return (double)samples->ptr[ (int)( (double)( samples->count - 1 ) * p ) ] / 1.e3;
+}
+
+// One row per set, labelled when there is more than one
+static inline void PrintStats( int sets = 1, const char *const *labels = NULL )
+{
+	Assert( sets <= MAX_SAMPLE_SETS );
+
+	if ( sets == 1 )
+	{
+		printf( "\n%-20s %8s %10s %10s %10s %10s\n", "us", "count", "p50", "p90", "p99", "max" );
+	}
+	else
+	{
+		printf( "\n%-26s %8s %10s %10s %10s %10s %8s\n", "us", "count", "p50", "p90", "p99", "max", "missing" );
+	}
+
+	for ( int i = 0; i < g_nStats; i++ )
+	{
+		stat_t &stat = g_Stats[i];
+
+		for ( int s = 0; s < sets; s++ )
+		{
+			samples_t *samples = &stat.sets[s];
+			qsort( samples->ptr, samples->count, sizeof(long long), _sort );
+
+			if ( sets == 1 )
+			{
+				printf( "%-20s", stat.name );
+			}
+			else
+			{
+				printf( "%-17s %-8s", s == 0 ? stat.name : "", labels[s] );
+			}
+
+			printf( " %8d %10.1f %10.1f %10.1f %10.1f",
+					samples->count,
+					Percentile( samples, 0.5 ),
+					Percentile( samples, 0.9 ),
+					Percentile( samples, 0.99 ),
+					Percentile( samples, 1.0 ) );
+
+			if ( sets != 1 && s == sets - 1 )
+				printf( " %8d", stat.missing );
+
+			printf( "\n" );
+
+			free( samples->ptr );
+			samples->ptr = NULL;
+			samples->count = samples->size = 0;
+		}
+	}
+}
+
+//
+// Client
+//
+static int g_Socket = -1;
+
+static char *g_pRecv = NULL;
+static int g_nRecvLen = 0;
+static int g_nRecvSize = 0;
+static int g_nMsgLen = 0; // framed length of the message in the buffer
+
+static CScratch< true > g_RecvScratch;
+
+// Retries while the host starts listening, exits on failure
+static inline void ClientConnect( int port )
+{
+	sockaddr_in addr;
+	memset( &addr, 0, sizeof(addr) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( port );
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+	for ( int i = 0; ; i++ )
+	{
+		g_Socket = socket( AF_INET, SOCK_STREAM, 0 );
+
+		if ( connect( g_Socket, (sockaddr*)&addr, sizeof(addr) ) == 0 )
+			break;
+
+		close( g_Socket );
+
+		if ( i == 100 )
+		{
+			fprintf( stderr, "could not connect to port %d\n", port );
+			exit( 1 );
+		}
+
+		usleep( 20000 );
+	}
+
+	int opt = 1;
+	setsockopt( g_Socket, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt) );
+}
+
+static inline void ClientClose()
+{
+	close( g_Socket );
+	g_Socket = -1;
+
+	free( g_pRecv );
+	g_pRecv = NULL;
+	g_nRecvLen = g_nRecvSize = g_nMsgLen = 0;
+}
+
+static inline void ClientSend( const char *body, int len )
+{
+	char header[ DAP_HEADER_MAXSIZE ];
+	int headerLen = DAP_WriteHeader( header, len );
+
+	if ( send( g_Socket, header, headerLen, 0 ) != headerLen ||
+			send( g_Socket, body, len, 0 ) != len )
+	{
+		fprintf( stderr, "send failed\n" );
+		exit( 1 );
+	}
+}
+
+// Parses the next message into table, the table is valid until the next call.
+// Returns 0 on timeout, -1 on disconnection. Pass -1 timeout_ms to wait indefinitely
+static inline int ClientRecv( json_table_t *table, int timeout_ms = -1 )
+{
+	if ( g_nMsgLen )
+	{
+		g_nRecvLen -= g_nMsgLen;
+		memmove( g_pRecv, g_pRecv + g_nMsgLen, g_nRecvLen );
+		g_nMsgLen = 0;
+	}
+
+	for (;;)
+	{
+		char *msg = g_pRecv;
+		int len = g_nRecvLen;
+
+		if ( len && DAP_ReadHeader( &msg, &len ) )
+		{
+			if ( len < 0 )
+				return -1;
+
+			if ( msg + len <= g_pRecv + g_nRecvLen )
+			{
+				g_nMsgLen = msg + len - g_pRecv;
+
+				g_RecvScratch.Free();
+				JSONParser parser( &g_RecvScratch, msg, len, table );
+
+				if ( parser.GetError() )
+				{
+					fprintf( stderr, "invalid message: %s\n", parser.GetError() );
+					return -1;
+				}
+
+				return 1;
+			}
+		}
+
+		if ( g_nRecvSize - g_nRecvLen < 64 * 1024 )
+		{
+			g_nRecvSize = g_nRecvSize ? g_nRecvSize * 2 : 256 * 1024;
+			g_pRecv = (char*)realloc( g_pRecv, g_nRecvSize );
+		}
+
+		if ( timeout_ms >= 0 )
+		{
+			pollfd pfd;
+			pfd.fd = g_Socket;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+
+			if ( poll( &pfd, 1, timeout_ms ) == 0 )
+				return 0;
+		}
+
+		int ret = recv( g_Socket, g_pRecv + g_nRecvLen, g_nRecvSize - g_nRecvLen, 0 );
+
+		if ( ret <= 0 )
+			return -1;
+
+		g_nRecvLen += ret;
+	}
+}
+
+//
+// Host
+//
+static inline void PrintFunc( HSQUIRRELVM, const SQChar *, ... )
+{
+}
+
+static inline void ErrorFunc( HSQUIRRELVM, const SQChar *fmt, ... )
+{
+	va_list va;
+	va_start( va, fmt );
+#ifdef SQUNICODE
+	vfwprintf( stderr, fmt, va );
+#else
+	vfprintf( stderr, fmt, va );
+#endif
+	va_end( va );
+}
+
+// Opens a VM with the debugger listening on port, exits on failure
+static inline HSQUIRRELVM HostOpen( int port, HSQDEBUGSERVER *dbg )
+{
+	HSQUIRRELVM vm = sq_open( 1024 );
+#if SQUIRREL_VERSION_NUMBER >= 300
+	sq_setprintfunc( vm, PrintFunc, ErrorFunc );
+#else
+	sq_setprintfunc( vm, PrintFunc );
+	(void)ErrorFunc;
+#endif
+
+	*dbg = sqdbg_attach_debugger( vm );
+
+	if ( sqdbg_listen_socket( *dbg, port ) != 0 )
+	{
+		fprintf( stderr, "could not listen on port %d\n", port );
+		exit( 1 );
+	}
+
+	return vm;
+}
+
+static inline void HostClose( HSQUIRRELVM vm )
+{
+	sqdbg_destroy_debugger( vm );
+	sq_close( vm );
+}
+
+static inline void HostSetConst( HSQUIRRELVM vm, const SQChar *name, int val )
+{
+	sq_pushroottable( vm );
+	sq_pushstring( vm, name, -1 );
+	sq_pushinteger( vm, val );
+	sq_newslot( vm, -3, SQFalse );
+	sq_pop( vm, 1 );
+}
+
+// Processes messages until the client thread sets flag
+static inline void HostFrameUntil( HSQDEBUGSERVER dbg, bool *flag )
+{
+	while ( !Load( flag ) )
+	{
+		sqdbg_frame( dbg );
+		usleep( 1000 );
+	}
+}
+
+static inline void HostRun( HSQUIRRELVM vm, HSQDEBUGSERVER dbg,
+		const SQChar *script, SQInteger len,
+		const SQChar *sourcename, SQInteger sourcenamelen )
+{
+	sqdbg_on_script_compile( dbg, script, len, sourcename, sourcenamelen );
+
+	SQInteger top = sq_gettop( vm );
+
+	if ( SQ_SUCCEEDED( sq_compilebuffer( vm, script, len, sourcename, SQTrue ) ) )
+	{
+		sq_pushroottable( vm );
+		sq_call( vm, 1, SQFalse, SQTrue );
+	}
+
+	sq_settop( vm, top );
+}
+
+#endif // SQDBG_DAPCLIENT_H
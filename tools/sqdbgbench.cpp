@@ -0,0 +1,610 @@
+//-----------------------------------------------------------------------
+//                       github.com/samisalreadytaken/sqdbg
+//-----------------------------------------------------------------------
+//
+// Microbenchmarks for the protocol and memory layers of the debugger.
+// Built against the same Squirrel headers and library as the debugger
+//
+//   c++ -O2 -Iinclude -I<squirrel>/include -I<squirrel>/squirrel tools/sqdbgbench.cpp <squirrel libs>
+//   sqdbgbench [-t ms] [file]
+//
+// file is a stream of Content-Length framed DAP messages, such as one captured
+// from a session. Built-in client requests are used otherwise.
+// The escape scan is run with both its scalar and SSE2 versions.
+//
+
+#define SQDBG_EXCLUDE_DEFAULT_MEMFUNCTIONS
+#include "../sqdbg/server.cpp"
+
+static unsigned long long g_nAllocs = 0;
+static unsigned long long g_nAllocBytes = 0;
+
+void *sqdbg_malloc( unsigned int size )
+{
+	g_nAllocs++;
+	g_nAllocBytes += size;
+	return malloc( size );
+}
+
+void *sqdbg_realloc( void *p, unsigned int oldsize, unsigned int size )
+{
+	g_nAllocs++;
+	g_nAllocBytes += size > oldsize ? size - oldsize : 0;
+	return realloc( p, size );
+}
+
+void sqdbg_free( void *p, unsigned int size )
+{
+	(void)size;
+	free( p );
+}
+
+// Requests as sent by VS Code while stepping through a script
+static const char *g_DefaultMessages[] =
+{
+	"{\"command\":\"initialize\",\"arguments\":{\"clientID\":\"vscode\",\"clientName\":\"Visual Studio Code\",\"adapterID\":\"squirrel\",\"pathFormat\":\"path\",\"linesStartAt1\":true,\"columnsStartAt1\":true,\"supportsVariableType\":true,\"supportsVariablePaging\":true,\"supportsRunInTerminalRequest\":true,\"locale\":\"en\",\"supportsProgressReporting\":true,\"supportsInvalidatedEvent\":true,\"supportsMemoryReferences\":true,\"supportsArgsCanBeInterpretedByShell\":true,\"supportsMemoryEvent\":true,\"supportsStartDebuggingRequest\":true},\"type\":\"request\",\"seq\":1}",
+	"{\"command\":\"attach\",\"arguments\":{\"type\":\"squirrel\",\"request\":\"attach\",\"name\":\"Attach\",\"port\":2222,\"__configurationTarget\":6,\"__sessionId\":\"5b2e7bd4-0a53-4e1c-9a1d-1e1c3b7fa0f3\"},\"type\":\"request\",\"seq\":2}",
+	"{\"command\":\"setBreakpoints\",\"arguments\":{\"source\":{\"name\":\"player.nut\",\"path\":\"/home/user/project/scripts/vscripts/entities/player.nut\"},\"lines\":[12,48,49,130,244],\"breakpoints\":[{\"line\":12},{\"line\":48,\"condition\":\"health < 10\"},{\"line\":49},{\"line\":130,\"hitCondition\":\"3\"},{\"line\":244,\"logMessage\":\"spawned {ent} at {origin}\"}],\"sourceModified\":false},\"type\":\"request\",\"seq\":3}",
+	"{\"command\":\"setExceptionBreakpoints\",\"arguments\":{\"filters\":[\"unhandled\"],\"filterOptions\":[]},\"type\":\"request\",\"seq\":4}",
+	"{\"command\":\"configurationDone\",\"type\":\"request\",\"seq\":5}",
+	"{\"command\":\"threads\",\"type\":\"request\",\"seq\":6}",
+	"{\"command\":\"stackTrace\",\"arguments\":{\"threadId\":1,\"startFrame\":0,\"levels\":20,\"format\":{\"parameters\":true,\"parameterTypes\":true}},\"type\":\"request\",\"seq\":7}",
+	"{\"command\":\"scopes\",\"arguments\":{\"frameId\":4},\"type\":\"request\",\"seq\":8}",
+	"{\"command\":\"variables\",\"arguments\":{\"variablesReference\":37,\"format\":{\"hex\":false}},\"type\":\"request\",\"seq\":9}",
+	"{\"command\":\"variables\",\"arguments\":{\"variablesReference\":41,\"filter\":\"indexed\",\"start\":0,\"count\":100},\"type\":\"request\",\"seq\":10}",
+	"{\"command\":\"evaluate\",\"arguments\":{\"expression\":\"self.m_vecOrigin\",\"frameId\":4,\"context\":\"hover\"},\"type\":\"request\",\"seq\":11}",
+	"{\"command\":\"evaluate\",\"arguments\":{\"expression\":\"foreach ( k, v in getroottable() ) print( k + \\\"\\\\n\\\" )\",\"frameId\":4,\"context\":\"repl\"},\"type\":\"request\",\"seq\":12}",
+	"{\"command\":\"completions\",\"arguments\":{\"frameId\":4,\"text\":\"self.m_\",\"column\":8,\"line\":1},\"type\":\"request\",\"seq\":13}",
+	"{\"command\":\"next\",\"arguments\":{\"threadId\":1,\"granularity\":\"line\"},\"type\":\"request\",\"seq\":14}",
+	"{\"command\":\"continue\",\"arguments\":{\"threadId\":1},\"type\":\"request\",\"seq\":15}",
+};
+
+struct message_t
+{
+	char *ptr;
+	int len;
+};
+
+static message_t *g_Messages = NULL;
+static int g_nMessages = 0;
+static int g_nMessageBytes = 0;
+
+// Content-Length framed stream of g_Messages
+static char *g_pStream = NULL;
+static int g_nStreamLen = 0;
+
+static unsigned int g_Seed = 0x5eed;
+
+static unsigned int Rand()
+{
+	g_Seed = g_Seed * 1103515245 + 12345;
+	return g_Seed >> 8;
+}
+
+static void AddMessage( const char *ptr, int len )
+{
+	g_Messages = (message_t*)realloc( g_Messages, ( g_nMessages + 1 ) * sizeof(message_t) );
+	message_t &msg = g_Messages[ g_nMessages++ ];
+	msg.ptr = (char*)malloc( len );
+	msg.len = len;
+	memcpy( msg.ptr, ptr, len );
+	g_nMessageBytes += len;
+}
+
+static bool ReadMessages( const char *path )
+{
+	FILE *file = fopen( path, "rb" );
+
+	if ( !file )
+	{
+		fprintf( stderr, "could not open '%s'\n", path );
+		return false;
+	}
+
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+
+	char *buf = (char*)malloc( size + 1 );
+	bool ok = ( size > 0 && fread( buf, size, 1, file ) == 1 );
+	fclose( file );
+
+	for ( char *ptr = buf, *end = buf + size; ok && ptr < end; )
+	{
+		char *msg = ptr;
+		int len = end - ptr;
+
+		if ( !DAP_ReadHeader( &msg, &len ) || len <= 0 || len > end - msg )
+			break;
+
+		AddMessage( msg, len );
+		ptr = msg + len;
+	}
+
+	free( buf );
+
+	if ( !g_nMessages )
+	{
+		fprintf( stderr, "'%s' has no DAP messages\n", path );
+		return false;
+	}
+
+	return true;
+}
+
+static void BuildStream()
+{
+	g_nStreamLen = 0;
+
+	for ( int i = 0; i < g_nMessages; i++ )
+		g_nStreamLen += DAP_HEADER_MAXSIZE + g_Messages[i].len;
+
+	g_pStream = (char*)malloc( g_nStreamLen );
+	g_nStreamLen = 0;
+
+	for ( int i = 0; i < g_nMessages; i++ )
+	{
+		char header[ DAP_HEADER_MAXSIZE ];
+		int len = DAP_WriteHeader( header, g_Messages[i].len );
+		memcpy( g_pStream + g_nStreamLen, header, len );
+		memcpy( g_pStream + g_nStreamLen + len, g_Messages[i].ptr, g_Messages[i].len );
+		g_nStreamLen += len + g_Messages[i].len;
+	}
+}
+
+//
+// Values shown in a variables response, skewed like a typical game script
+//
+struct variable_t
+{
+	string_t name;
+	string_t value;
+	int type; // 0 int, 1 float/literal, 2 string, 3 table
+	int ival;
+};
+
+#define VARIABLE_COUNT 64
+
+static variable_t g_Variables[ VARIABLE_COUNT ];
+static CScratch< true > g_ValueScratch;
+
+static string_t RandomString( int len, bool escapes )
+{
+	char *ptr = g_ValueScratch.Alloc( len + 1 );
+
+	for ( int i = 0; i < len; i++ )
+	{
+		if ( escapes && Rand() % 16 == 0 )
+		{
+			const char special[] = "\n\t\"\\\xC3";
+			ptr[i] = special[ Rand() % ( sizeof(special) - 1 ) ];
+
+			// Complete the 2 byte sequence
+			if ( ptr[i] == '\xC3' && i + 1 < len )
+				ptr[++i] = '\xA9';
+		}
+		else
+		{
+			ptr[i] = 'a' + Rand() % 26;
+		}
+	}
+
+	return { ptr, (unsigned int)len };
+}
+
+static int RandomInt()
+{
+	switch ( Rand() % 8 )
+	{
+		case 0: case 1: case 2: return Rand() % 10;
+		case 3: case 4: return Rand() % 1000;
+		case 5: return -(int)( Rand() % 100000 );
+		default: return (int)( Rand() * 4 );
+	}
+}
+
+static void BuildVariables()
+{
+	for ( int i = 0; i < VARIABLE_COUNT; i++ )
+	{
+		variable_t &var = g_Variables[i];
+		var.name = RandomString( 1 + Rand() % 3 + ( Rand() % 4 == 0 ? Rand() % 20 : 4 ), false );
+
+		switch ( Rand() % 10 )
+		{
+			case 0: case 1: case 2: case 3: case 4:
+				var.type = 0;
+				var.ival = RandomInt();
+				break;
+			case 5: case 6:
+			{
+				var.type = 1;
+				char *ptr = g_ValueScratch.Alloc( 32 );
+				int len = snprintf( ptr, 32, "%g", (double)RandomInt() / 7.0 );
+				var.value = { ptr, (unsigned int)len };
+				break;
+			}
+			case 7: case 8:
+				var.type = 2;
+				var.value = RandomString( Rand() % 4 == 0 ? 64 + Rand() % 512 : Rand() % 24, true );
+				break;
+			default:
+				var.type = 3;
+				var.ival = 1 + Rand() % 5000;
+				var.value = { (char*)"{...}", 5 };
+		}
+	}
+}
+
+template < bool CBOR >
+static void WriteVariables( CBuffer &buffer )
+{
+	buffer.size = 0;
+
+	_wjson_table_t< CBOR > packet( buffer );
+	packet.SetInt( "request_seq", 9 );
+	packet.SetString( "type", "response" );
+	packet.SetString( "command", "variables" );
+	packet.SetBool( "success", true );
+	_wjson_table_t< CBOR > body = packet.SetTable( "body" );
+	_wjson_array_t< CBOR > variables = body.SetArray( "variables" );
+
+	for ( int i = 0; i < VARIABLE_COUNT; i++ )
+	{
+		const variable_t &var = g_Variables[i];
+		_wjson_table_t< CBOR > elem = variables.AppendTable();
+		elem.SetString( "name", var.name );
+
+		switch ( var.type )
+		{
+			case 0:
+				elem.SetIntString( "value", var.ival );
+				elem.SetString( "type", "integer" );
+				elem.SetInt( "variablesReference", 0 );
+				break;
+			case 1:
+				elem.SetString( "value", var.value );
+				elem.SetString( "type", "float" );
+				elem.SetInt( "variablesReference", 0 );
+				break;
+			case 2:
+				elem.SetString( "value", var.value, true );
+				elem.SetString( "type", "string" );
+				elem.SetInt( "variablesReference", 0 );
+				break;
+			default:
+			{
+				_jstringbuf_t< CBOR > buf = elem.SetStringAsBuf( "value" );
+				buf.Puts( var.value );
+				buf.Put( ' ' );
+				buf.PutHex( (uintptr_t)&var, true );
+			}
+				elem.SetString( "type", "table" );
+				elem.SetInt( "variablesReference", var.ival );
+				elem.SetIntBrackets( "indexedVariables", var.ival );
+		}
+	}
+}
+
+template < bool CBOR >
+static void WriteStackTrace( CBuffer &buffer )
+{
+	buffer.size = 0;
+
+	_wjson_table_t< CBOR > packet( buffer );
+	packet.SetInt( "request_seq", 7 );
+	packet.SetString( "type", "response" );
+	packet.SetString( "command", "stackTrace" );
+	packet.SetBool( "success", true );
+	_wjson_table_t< CBOR > body = packet.SetTable( "body" );
+	_wjson_array_t< CBOR > stackFrames = body.SetArray( "stackFrames" );
+
+	for ( int i = 0; i < 20; i++ )
+	{
+		_wjson_table_t< CBOR > frame = stackFrames.AppendTable();
+		frame.SetInt( "id", i );
+		frame.SetString( "name", g_Variables[i].name );
+		frame.SetInt( "line", 1 + ( i * 37 ) % 2000 );
+		frame.SetInt( "column", 1 );
+		_wjson_table_t< CBOR > source = frame.SetTable( "source" );
+		source.SetString( "name", "player.nut" );
+		source.SetString( "path", "/home/user/project/scripts/vscripts/entities/player.nut" );
+	}
+
+	body.SetInt( "totalFrames", 20 );
+}
+
+//
+// Benchmarks
+//
+static CScratch< true > g_Scratch;
+static CScratch< false > g_Strings;
+static CMessagePool g_Pool;
+static CBuffer g_Buffer;
+static char *g_pParseBuf = NULL;
+static unsigned long long g_Sink = 0;
+
+static void BenchParse()
+{
+	for ( int i = 0; i < g_nMessages; i++ )
+	{
+		CScratch_Restore_Auto _sr( &g_Scratch );
+
+		// Parsing is destructive
+		memcpy( g_pParseBuf, g_Messages[i].ptr, g_Messages[i].len );
+
+		json_table_t table;
+		JSONParser parser( &g_Scratch, g_pParseBuf, g_Messages[i].len, &table );
+
+		int seq;
+		table.GetInt( "seq", &seq );
+		g_Sink += seq;
+	}
+}
+
+static void BenchCopy()
+{
+	for ( int i = 0; i < g_nMessages; i++ )
+	{
+		memcpy( g_pParseBuf, g_Messages[i].ptr, g_Messages[i].len );
+		g_Sink += g_pParseBuf[0];
+	}
+}
+
+static void BenchReadHeader()
+{
+	for ( char *ptr = g_pStream, *end = g_pStream + g_nStreamLen; ptr < end; )
+	{
+		char *msg = ptr;
+		int len = end - ptr;
+
+		if ( !DAP_ReadHeader( &msg, &len ) )
+			break;
+
+		g_Sink += len;
+		ptr = msg + len;
+	}
+}
+
+static void BenchWriteHeader()
+{
+	char header[ DAP_HEADER_MAXSIZE ];
+
+	for ( int i = 0; i < g_nMessages; i++ )
+		g_Sink += DAP_WriteHeader( header, g_Messages[i].len );
+}
+
+// Script-like text, escapes are mostly line ends with some quotes and tabs
+#define SCAN_TEXT_SIZE ( 64 * 1024 )
+
+static char g_ScanText[ SCAN_TEXT_SIZE ];
+
+static void BuildScanText()
+{
+	for ( int i = 0; i < SCAN_TEXT_SIZE; i++ )
+	{
+		unsigned int r = Rand() % 64;
+
+		if ( r == 0 )
+		{
+			g_ScanText[i] = '\n';
+		}
+		else if ( r == 1 )
+		{
+			g_ScanText[i] = Rand() % 2 ? '\"' : '\t';
+		}
+		else
+		{
+			g_ScanText[i] = r < 12 ? ' ' : 'a' + r % 26;
+		}
+	}
+}
+
+template < const char *(scan)( const char *ptr, const char *end ) >
+static void BenchScanEscape()
+{
+	const char *end = g_ScanText + SCAN_TEXT_SIZE;
+
+	for ( const char *c = scan( g_ScanText, end ); c < end; c = scan( c + 1, end ) )
+		g_Sink++;
+}
+
+static void BenchWriteVariablesJSON() { WriteVariables< false >( g_Buffer ); g_Sink += g_Buffer.Size(); }
+static void BenchWriteVariablesCBOR() { WriteVariables< true >( g_Buffer ); g_Sink += g_Buffer.Size(); }
+static void BenchWriteStackTraceJSON() { WriteStackTrace< false >( g_Buffer ); g_Sink += g_Buffer.Size(); }
+static void BenchWriteStackTraceCBOR() { WriteStackTrace< true >( g_Buffer ); g_Sink += g_Buffer.Size(); }
+
+class CPoolReader
+{
+public:
+	void OnMessage( char *ptr, int len )
+	{
+		g_Sink += ptr[ len - 1 ];
+	}
+};
+
+static void BenchMessagePool()
+{
+	CPoolReader reader;
+
+	// Bursts of 1 to 16 messages queued before each service
+	for ( int i = 0; i < g_nMessages; )
+	{
+		int burst = 1 + Rand() % 16;
+
+		for ( ; burst && i < g_nMessages; burst--, i++ )
+			g_Pool.Add( g_Messages[i].ptr, g_Messages[i].len );
+
+		g_Pool.Service< CPoolReader, &CPoolReader::OnMessage >( &reader );
+	}
+}
+
+// Parser-like: many small allocations, released at once
+static void BenchScratchSequential()
+{
+	for ( int n = 0; n < 256; n++ )
+	{
+		CScratch_Restore_Auto _sr( &g_Scratch );
+
+		for ( int i = 0; i < 64; i++ )
+			g_Sink += (uintptr_t)g_Scratch.Alloc( 8 + ( i & 7 ) * 24 );
+	}
+}
+
+// String cache: individually freed allocations of mixed sizes
+static void BenchScratchFree()
+{
+	void *ptrs[64];
+
+	for ( int i = 0; i < 64; i++ )
+		ptrs[i] = g_Strings.Alloc( 8 + Rand() % 120 );
+
+	for ( int i = 0; i < 64; i++ )
+		g_Strings.Free( ptrs[ ( i * 37 ) & 63 ] );
+}
+
+static int g_Ints[ 1024 ];
+
+static void BenchPrintInt()
+{
+	char buf[ FMT_INT_LEN + 1 ];
+
+	for ( int i = 0; i < 1024; i++ )
+		g_Sink += printint( buf, sizeof(buf), g_Ints[i] );
+}
+
+static void BenchPrintHex()
+{
+	char buf[ FMT_PTR_LEN + 1 ];
+
+	for ( int i = 0; i < 1024; i++ )
+	{
+		g_Sink += printhex( buf, sizeof(buf), (uintptr_t)g_Ints[i] * 0x9E3779B1u );
+		g_Sink += printhex( buf, sizeof(buf), (unsigned int)g_Ints[i], 0 );
+	}
+}
+
+static unsigned long long g_nTimeMs = 200;
+
+static long long NowNs()
+{
+	return std::chrono::duration_cast< std::chrono::nanoseconds >(
+			std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// bytes and items are processed per call
+static void Run( const char *name, void (*fn)(), unsigned long long bytes, unsigned long long items )
+{
+	// Warm up caches and pools
+	fn();
+
+	unsigned long long allocs = g_nAllocs;
+	unsigned long long allocBytes = g_nAllocBytes;
+	unsigned long long calls = 0;
+
+	long long start = NowNs();
+	long long end;
+
+	do
+	{
+		fn();
+		calls++;
+		end = NowNs();
+	}
+	while ( (unsigned long long)( end - start ) < g_nTimeMs * 1000000ull );
+
+	double sec = (double)( end - start ) / 1.e9;
+
+	printf( "%-22s %10.1f %12.0f %10.2f %10.1f\n",
+			name,
+			(double)( bytes * calls ) / sec / ( 1024.0 * 1024.0 ),
+			(double)( items * calls ) / sec,
+			(double)( g_nAllocs - allocs ) / (double)calls,
+			(double)( g_nAllocBytes - allocBytes ) / (double)calls );
+}
+
+int main( int argc, char **argv )
+{
+	const char *path = NULL;
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !strcmp( argv[i], "-t" ) && i + 1 < argc )
+		{
+			g_nTimeMs = atoi( argv[++i] );
+		}
+		else if ( argv[i][0] == '-' )
+		{
+			fprintf( stderr, "usage: %s [-t ms] [file]\n", argv[0] );
+			return 1;
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	if ( path )
+	{
+		if ( !ReadMessages( path ) )
+			return 1;
+	}
+	else
+	{
+		for ( unsigned int i = 0; i < _ArraySize( g_DefaultMessages ); i++ )
+			AddMessage( g_DefaultMessages[i], strlen( g_DefaultMessages[i] ) );
+	}
+
+	BuildStream();
+	BuildVariables();
+	BuildScanText();
+
+	int maxlen = 0;
+
+	for ( int i = 0; i < g_nMessages; i++ )
+		maxlen = max( maxlen, g_Messages[i].len );
+
+	g_pParseBuf = (char*)malloc( maxlen );
+
+	for ( int i = 0; i < 1024; i++ )
+		g_Ints[i] = RandomInt();
+
+	WriteVariables< false >( g_Buffer );
+	int nVariablesJSON = g_Buffer.Size();
+	WriteVariables< true >( g_Buffer );
+	int nVariablesCBOR = g_Buffer.Size();
+	WriteStackTrace< false >( g_Buffer );
+	int nStackTraceJSON = g_Buffer.Size();
+	WriteStackTrace< true >( g_Buffer );
+	int nStackTraceCBOR = g_Buffer.Size();
+
+	printf( "%d messages, %d bytes, %s\n", g_nMessages, g_nMessageBytes,
+#ifdef SQDBG_SSE2
+			"SSE2"
+#else
+			"scalar"
+#endif
+		  );
+	printf( "\n%-22s %10s %12s %10s %10s\n", "", "MB/s", "items/s", "allocs", "bytes" );
+
+	Run( "memcpy (reference)", BenchCopy, g_nMessageBytes, g_nMessages );
+	Run( "JSONParser", BenchParse, g_nMessageBytes, g_nMessages );
+	Run( "DAP_ReadHeader", BenchReadHeader, g_nStreamLen, g_nMessages );
+	Run( "DAP_WriteHeader", BenchWriteHeader, 0, g_nMessages );
+	Run( "escape scan scalar", BenchScanEscape< JSONScanEscapeScalar >, SCAN_TEXT_SIZE, 1 );
+#ifdef SQDBG_SSE2
+	Run( "escape scan sse2", BenchScanEscape< JSONScanEscapeSSE2 >, SCAN_TEXT_SIZE, 1 );
+#endif
+	Run( "variables json", BenchWriteVariablesJSON, nVariablesJSON, VARIABLE_COUNT );
+	Run( "variables cbor", BenchWriteVariablesCBOR, nVariablesCBOR, VARIABLE_COUNT );
+	Run( "stackTrace json", BenchWriteStackTraceJSON, nStackTraceJSON, 20 );
+	Run( "stackTrace cbor", BenchWriteStackTraceCBOR, nStackTraceCBOR, 20 );
+	Run( "CMessagePool", BenchMessagePool, g_nMessageBytes, g_nMessages );
+	Run( "CScratch sequential", BenchScratchSequential, 0, 256 * 64 );
+	Run( "CScratch free", BenchScratchFree, 0, 64 );
+	Run( "printint", BenchPrintInt, 0, 1024 );
+	Run( "printhex", BenchPrintHex, 0, 2048 );
+
+	// Keep the results alive
+	return g_Sink == 1;
+}
@@ -0,0 +1,367 @@
+//-----------------------------------------------------------------------
+//                       github.com/samisalreadytaken/sqdbg
+//-----------------------------------------------------------------------
+//
+// Load generator: runs a test script with the debugger listening on a
+// loopback port, and a headless client that inspects every stop the way an
+// editor does (threads, stackTrace, scopes, variables) before continuing.
+// Prints latency percentiles per request type. Linux and macOS only
+//
+//   c++ -O2 -pthread -Iinclude -I<squirrel>/include -I<squirrel>/squirrel tools/sqdbgload.cpp <squirrel libs>
+//   sqdbgload [-n cycles] [-d depth] [-e entries] [-t threads] [-x expand] [-p port] [-a]
+//
+// -a only runs the client, against a program that is already listening on
+// the port and breaks repeatedly by itself.
+//
+
+#include <pthread.h>
+
+#include "../sqdbg/server.cpp"
+#include "dapclient.h"
+
+static int g_nCycles = 1000;
+static int g_nDepth = 64;
+static int g_nEntries = 10000;
+static int g_nThreads = 16;
+static int g_nExpand = 8;
+static int g_nPort = 2299;
+static bool g_bClientOnly = false;
+
+static bool g_bClientReady = false;
+static bool g_bClientDone = false;
+
+// Breaks at the bottom of a deep stack holding a large table,
+// every 4th stop is inside one of the parked threads
+static const SQChar g_szScript[] = _SC(
+	"local entities = {};\n"
+	"for ( local i = 0; i < ENTRIES; i++ )\n"
+	"	entities[ \"ent\" + i ] <- { id = i, name = \"entity_\" + i, origin = [ i * 1.5, i * 2.0, 0.0 ], flags = i & 0xFF };\n"
+	"\n"
+	"function Recurse( depth, data )\n"
+	"{\n"
+	"	local a = depth * 2, b = \"frame \" + depth, c = [ depth, a, b ];\n"
+	"	if ( depth > 0 )\n"
+	"		return Recurse( depth - 1, data ) + 1;\n"
+	"	sqdbg_break();\n"
+	"	return 0;\n"
+	"}\n"
+	"\n"
+	"local threads = [];\n"
+	"for ( local i = 0; i < THREADS; i++ )\n"
+	"{\n"
+	"	local t = newthread( function( data ) { for (;;) { suspend(); Recurse( 8, data ); } } );\n"
+	"	t.call( entities );\n"
+	"	threads.append( t );\n"
+	"}\n"
+	"\n"
+	"for ( local i = 0; i < CYCLES; i++ )\n"
+	"{\n"
+	"	if ( THREADS && i % 4 == 3 )\n"
+	"		threads[ ( i / 4 ) % THREADS ].wakeup();\n"
+	"	else\n"
+	"		Recurse( DEPTH, entities );\n"
+	"}\n"
+);
+
+//
+// Client
+//
+static int g_nSeq = 0;
+
+static bool g_bStopped = false;
+static int g_nStoppedThread = 0;
+static long long g_StopTime = 0;
+
+static int Send( const char *command, const char *fmt = NULL, ... )
+{
+	char body[512];
+	int len = snprintf( body, sizeof(body), "{\"seq\":%d,\"type\":\"request\",\"command\":\"%s\"", ++g_nSeq, command );
+
+	if ( fmt )
+	{
+		len += snprintf( body + len, sizeof(body) - len, ",\"arguments\":" );
+
+		va_list va;
+		va_start( va, fmt );
+		len += vsnprintf( body + len, sizeof(body) - len, fmt, va );
+		va_end( va );
+	}
+
+	len += snprintf( body + len, sizeof(body) - len, "}" );
+
+	ClientSend( body, len );
+	return g_nSeq;
+}
+
+static void OnEvent( const json_table_t &table )
+{
+	string_t event;
+	table.GetString( "event", &event );
+
+	if ( event.IsEqualTo( "stopped" ) )
+	{
+		json_table_t *body;
+
+		if ( table.GetTable( "body", &body ) )
+			body->GetInt( "threadId", &g_nStoppedThread );
+
+		g_bStopped = true;
+		g_StopTime = NowNs();
+	}
+}
+
+// Blocks until the response to seq arrives, events are handled on the way
+static json_table_t *WaitResponse( int seq, const char *command, long long start )
+{
+	static json_table_t table;
+
+	for (;;)
+	{
+		if ( ClientRecv( &table ) < 0 )
+		{
+			fprintf( stderr, "connection lost waiting for '%s'\n", command );
+			exit( 1 );
+		}
+
+		string_t type;
+		table.GetString( "type", &type );
+
+		if ( type.IsEqualTo( "event" ) )
+		{
+			OnEvent( table );
+			continue;
+		}
+
+		int request_seq;
+
+		if ( type.IsEqualTo( "response" ) &&
+				table.GetInt( "request_seq", &request_seq ) &&
+				request_seq == seq )
+		{
+			AddSample( GetStat( command ), 0, NowNs() - start );
+			return &table;
+		}
+	}
+}
+
+static json_table_t *Request( const char *command, const char *fmt = NULL, ... )
+{
+	char args[256];
+	args[0] = 0;
+
+	if ( fmt )
+	{
+		va_list va;
+		va_start( va, fmt );
+		vsnprintf( args, sizeof(args), fmt, va );
+		va_end( va );
+	}
+
+	long long start = NowNs();
+	int seq = fmt ? Send( command, "%s", args ) : Send( command );
+	return WaitResponse( seq, command, start );
+}
+
+static json_array_t *GetBodyArray( json_table_t *response, const string_t &key )
+{
+	json_table_t *body;
+	json_array_t *array;
+
+	if ( response->GetTable( "body", &body ) && body->GetArray( key, &array ) )
+		return array;
+
+	return NULL;
+}
+
+static bool WaitStop()
+{
+	json_table_t table;
+
+	while ( !g_bStopped )
+	{
+		if ( ClientRecv( &table ) < 0 )
+			return false;
+
+		string_t type;
+		table.GetString( "type", &type );
+
+		if ( type.IsEqualTo( "event" ) )
+			OnEvent( table );
+	}
+
+	return true;
+}
+
+// Requests sent by an editor to show a stop
+static void Inspect()
+{
+	Request( "threads" );
+
+	json_array_t *frames = GetBodyArray(
+			Request( "stackTrace", "{\"threadId\":%d,\"startFrame\":0,\"levels\":0}", g_nStoppedThread ),
+			"stackFrames" );
+
+	json_table_t *frame;
+	int frameId;
+
+	if ( !frames || !frames->Size() || !frames->GetTable( 0, &frame ) || !frame->GetInt( "id", &frameId ) )
+		return;
+
+	json_array_t *scopes = GetBodyArray(
+			Request( "scopes", "{\"frameId\":%d}", frameId ),
+			"scopes" );
+
+	if ( !scopes )
+		return;
+
+	// Responses are overwritten by the next request, collect references first
+	int refs[64];
+	int nRefs = 0;
+
+	for ( int i = 0; i < scopes->Size() && nRefs < (int)_ArraySize(refs); i++ )
+	{
+		json_table_t *scope;
+		int ref;
+
+		if ( scopes->GetTable( i, &scope ) && scope->GetInt( "variablesReference", &ref ) && ref > 0 )
+			refs[ nRefs++ ] = ref;
+	}
+
+	int expanded = 0;
+
+	for ( int r = 0; r < nRefs; r++ )
+	{
+		json_array_t *variables = GetBodyArray(
+				Request( "variables", "{\"variablesReference\":%d}", refs[r] ),
+				"variables" );
+
+		// Expand containers in the first scope, as an editor restoring its tree would
+		if ( !variables || r != 0 )
+			continue;
+
+		for ( int i = 0; i < variables->Size() && nRefs < (int)_ArraySize(refs) && expanded < g_nExpand; i++ )
+		{
+			json_table_t *variable;
+			int ref;
+
+			if ( variables->GetTable( i, &variable ) && variable->GetInt( "variablesReference", &ref ) && ref > 0 )
+			{
+				refs[ nRefs++ ] = ref;
+				expanded++;
+			}
+		}
+	}
+
+	AddSample( GetStat( "stop-to-ui" ), 0, NowNs() - g_StopTime );
+}
+
+static void *ClientThread( void * )
+{
+	ClientConnect( g_nPort );
+
+	Request( "initialize", "{\"clientID\":\"sqdbgload\",\"clientName\":\"sqdbgload\",\"linesStartAt1\":true,\"columnsStartAt1\":true}" );
+	Request( "attach", "{}" );
+	Request( "setExceptionBreakpoints", "{\"filters\":[]}" );
+	Request( "configurationDone" );
+
+	Store( &g_bClientReady );
+
+	long long start = NowNs();
+
+	for ( int i = 0; i < g_nCycles; i++ )
+	{
+		if ( !WaitStop() )
+		{
+			fprintf( stderr, "connection lost after %d stops\n", i );
+			break;
+		}
+
+		Inspect();
+
+		g_bStopped = false;
+		Request( "continue", "{\"threadId\":%d}", g_nStoppedThread );
+	}
+
+	double sec = (double)( NowNs() - start ) / 1.e9;
+	printf( "%d stops in %.2f s, %.1f stops/s\n", g_nCycles, sec, (double)g_nCycles / sec );
+
+	ClientClose();
+	Store( &g_bClientDone );
+	return NULL;
+}
+
+//
+// Host
+//
+static void RunHost()
+{
+	HSQDEBUGSERVER dbg;
+	HSQUIRRELVM vm = HostOpen( g_nPort, &dbg );
+
+	pthread_t thread;
+	pthread_create( &thread, NULL, ClientThread, NULL );
+
+	HostFrameUntil( dbg, &g_bClientReady );
+
+	HostSetConst( vm, _SC("CYCLES"), g_nCycles );
+	HostSetConst( vm, _SC("DEPTH"), g_nDepth );
+	HostSetConst( vm, _SC("ENTRIES"), g_nEntries );
+	HostSetConst( vm, _SC("THREADS"), g_nThreads );
+
+	HostRun( vm, dbg, g_szScript, sizeof(g_szScript) / sizeof(SQChar) - 1,
+			_SC("sqdbgload.nut"), STRLEN("sqdbgload.nut") );
+
+	// Let the client see the last continue response
+	HostFrameUntil( dbg, &g_bClientDone );
+
+	pthread_join( thread, NULL );
+
+	HostClose( vm );
+}
+
+int main( int argc, char **argv )
+{
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !strcmp( argv[i], "-a" ) )
+		{
+			g_bClientOnly = true;
+			continue;
+		}
+
+		if ( i + 1 >= argc || argv[i][0] != '-' || argv[i][2] )
+		{
+			fprintf( stderr, "usage: %s [-n cycles] [-d depth] [-e entries] [-t threads] [-x expand] [-p port] [-a]\n", argv[0] );
+			return 1;
+		}
+
+		int val = atoi( argv[++i] );
+
+		switch ( argv[i-1][1] )
+		{
+			case 'n': g_nCycles = val; break;
+			case 'd': g_nDepth = val; break;
+			case 'e': g_nEntries = val; break;
+			case 't': g_nThreads = val; break;
+			case 'x': g_nExpand = val; break;
+			case 'p': g_nPort = val; break;
+			default:
+				fprintf( stderr, "unknown option '%s'\n", argv[i-1] );
+				return 1;
+		}
+	}
+
+	if ( g_bClientOnly )
+	{
+		ClientThread( NULL );
+	}
+	else
+	{
+		printf( "%d cycles, depth %d, %d entries, %d threads\n", g_nCycles, g_nDepth, g_nEntries, g_nThreads );
+		RunHost();
+	}
+
+	PrintStats();
+
+	return 0;
+}
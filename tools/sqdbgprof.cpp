@@ -0,0 +1,318 @@
+//-----------------------------------------------------------------------
+//                       github.com/samisalreadytaken/sqdbg
+//-----------------------------------------------------------------------
+//
+// Merges and prints profiles written by sqdbg_prof_continuous()
+//
+//   sqdbgprof [-n count] file...
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct entry_t
+{
+	char *name;
+	char *src; // NULL for groups
+	unsigned long long calls;
+	unsigned long long ns;
+};
+
+static entry_t *g_Entries = NULL;
+static int g_nEntries = 0;
+static int g_nEntriesAlloc = 0;
+
+static unsigned long long ReadLE( const unsigned char *&ptr, int bytes )
+{
+	unsigned long long val = 0;
+
+	for ( int i = 0; i < bytes; i++ )
+		val |= (unsigned long long)*ptr++ << ( i * 8 );
+
+	return val;
+}
+
+static char *ReadString( const unsigned char *&ptr, const unsigned char *end, bool *ok )
+{
+	if ( end - ptr < 2 )
+	{
+		*ok = false;
+		return NULL;
+	}
+
+	unsigned int len = (unsigned int)ReadLE( ptr, 2 );
+
+	if ( (unsigned int)( end - ptr ) < len )
+	{
+		*ok = false;
+		return NULL;
+	}
+
+	char *str = (char*)malloc( len + 1 );
+	memcpy( str, ptr, len );
+	str[len] = 0;
+	ptr += len;
+
+	return str;
+}
+
+static void AddEntry( char *name, char *src, unsigned long long calls, unsigned long long ns )
+{
+	for ( int i = 0; i < g_nEntries; i++ )
+	{
+		entry_t &entry = g_Entries[i];
+
+		if ( !strcmp( entry.name, name ) &&
+				( entry.src == src || ( entry.src && src && !strcmp( entry.src, src ) ) ) )
+		{
+			entry.calls += calls;
+			entry.ns += ns;
+
+			free( name );
+			free( src );
+			return;
+		}
+	}
+
+	if ( g_nEntries == g_nEntriesAlloc )
+	{
+		g_nEntriesAlloc = g_nEntriesAlloc ? g_nEntriesAlloc * 2 : 256;
+		g_Entries = (entry_t*)realloc( g_Entries, g_nEntriesAlloc * sizeof(entry_t) );
+	}
+
+	entry_t &entry = g_Entries[ g_nEntries++ ];
+	entry.name = name;
+	entry.src = src;
+	entry.calls = calls;
+	entry.ns = ns;
+}
+
+// Returns covered time in ms, 0 on failure
+static unsigned long long ReadFile( const char *path )
+{
+	FILE *file = fopen( path, "rb" );
+
+	if ( !file )
+	{
+		fprintf( stderr, "could not open '%s'\n", path );
+		return 0;
+	}
+
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+
+	if ( size < 24 )
+	{
+		fprintf( stderr, "'%s' is not a profile\n", path );
+		fclose( file );
+		return 0;
+	}
+
+	unsigned char *buf = (unsigned char*)malloc( size );
+	bool ok = ( fread( buf, size, 1, file ) == 1 );
+	fclose( file );
+
+	const unsigned char *ptr = buf;
+	const unsigned char *end = buf + size;
+
+	if ( !ok || memcmp( ptr, "SQPF", 4 ) != 0 )
+	{
+		fprintf( stderr, "'%s' is not a profile\n", path );
+		free( buf );
+		return 0;
+	}
+
+	ptr += 4;
+
+	unsigned int version = (unsigned int)ReadLE( ptr, 2 );
+
+	if ( version != 1 )
+	{
+		fprintf( stderr, "'%s' has unsupported version %u\n", path, version );
+		free( buf );
+		return 0;
+	}
+
+	unsigned int threads = (unsigned int)ReadLE( ptr, 2 );
+	unsigned long long startTime = ReadLE( ptr, 8 );
+	unsigned long long endTime = ReadLE( ptr, 8 );
+
+	for ( unsigned int t = 0; t < threads && ok; t++ )
+	{
+		if ( end - ptr < 4 )
+		{
+			ok = false;
+			break;
+		}
+
+		unsigned int count = (unsigned int)ReadLE( ptr, 4 );
+
+		for ( unsigned int i = 0; i < count; i++ )
+		{
+			if ( end - ptr < 1 + 4 + 8 )
+			{
+				ok = false;
+				break;
+			}
+
+			unsigned int flags = (unsigned int)ReadLE( ptr, 1 );
+			unsigned long long calls = ReadLE( ptr, 4 );
+			unsigned long long ns = ReadLE( ptr, 8 );
+
+			char *name = ReadString( ptr, end, &ok );
+			char *src = ReadString( ptr, end, &ok );
+
+			if ( !ok )
+			{
+				free( name );
+				free( src );
+				break;
+			}
+
+			if ( flags & 1 )
+			{
+				free( src );
+				src = NULL;
+			}
+
+			AddEntry( name, src, calls, ns );
+		}
+	}
+
+	free( buf );
+
+	// Partially written files are still merged up to the truncation
+	if ( !ok )
+		fprintf( stderr, "'%s' is truncated\n", path );
+
+	return endTime > startTime ? endTime - startTime : 1;
+}
+
+// Print time and its unit to 9 chars: "000.00 ms"
+static void PrintTime( double ns )
+{
+	if ( ns <= 0.0 || ns != ns )
+	{
+		printf( "      N/A" );
+	}
+	else if ( ns < 1.e3 )
+	{
+		printf( "%6.2f ns", ns );
+	}
+	else if ( ns < 1.e6 )
+	{
+		printf( "%6.2f us", ns / 1.e3 );
+	}
+	else if ( ns < 1.e9 )
+	{
+		printf( "%6.2f ms", ns / 1.e6 );
+	}
+	else if ( ns < 900.e9 )
+	{
+		printf( "%6.2f  s", ns / 1.e9 );
+	}
+	else if ( ns < 60.e9 * 60.0 )
+	{
+		printf( "%6.2f  m", ns / 60.e9 );
+	}
+	else
+	{
+		printf( "%6.2f  h", ns / ( 60.e9 * 60.0 ) );
+	}
+}
+
+static int _sort( const void *pa, const void *pb )
+{
+	const entry_t *a = (const entry_t*)pa;
+	const entry_t *b = (const entry_t*)pb;
+
+	if ( a->ns > b->ns )
+		return -1;
+
+	if ( b->ns > a->ns )
+		return 1;
+
+	return 0;
+}
+
+int main( int argc, char **argv )
+{
+	int limit = -1;
+	int files = 0;
+	unsigned long long totalTime = 0;
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !strcmp( argv[i], "-n" ) && i + 1 < argc )
+		{
+			limit = atoi( argv[++i] );
+			continue;
+		}
+
+		unsigned long long time = ReadFile( argv[i] );
+
+		if ( time )
+		{
+			totalTime += time;
+			files++;
+		}
+	}
+
+	if ( !files )
+	{
+		fprintf( stderr, "usage: %s [-n count] file...\n", argv[0] );
+		return 1;
+	}
+
+	qsort( g_Entries, g_nEntries, sizeof(entry_t), _sort );
+
+	printf( "%d files, %.2f s\n", files, (double)totalTime / 1.e3 );
+
+	// Percentage of wall time covered by the files
+	double flTotal = (double)totalTime * 1.e6;
+
+	for ( int pass = 0; pass < 2; pass++ )
+	{
+		int printed = 0;
+
+		printf( pass == 0 ?
+			"\n   %%   total time  time/call      calls  func\n" :
+			"\n   %%   total time   time/hit       hits  block\n" );
+
+		for ( int i = 0; i < g_nEntries; i++ )
+		{
+			const entry_t &entry = g_Entries[i];
+
+			if ( ( entry.src == NULL ) != ( pass == 1 ) )
+				continue;
+
+			if ( limit >= 0 && printed++ >= limit )
+				break;
+
+			double frac = (double)entry.ns / flTotal * 100.0;
+
+			printf( "%6.2f  ", frac > 100.0 ? 100.0 : frac );
+			PrintTime( (double)entry.ns );
+			printf( "  " );
+			PrintTime( entry.calls ? (double)entry.ns / (double)entry.calls : 0.0 );
+			printf( " %10llu  %s", entry.calls, entry.name );
+
+			if ( entry.src )
+				printf( ", %s", entry.src );
+
+			printf( "\n" );
+		}
+	}
+
+	for ( int i = 0; i < g_nEntries; i++ )
+	{
+		free( g_Entries[i].name );
+		free( g_Entries[i].src );
+	}
+
+	free( g_Entries );
+
+	return 0;
+}
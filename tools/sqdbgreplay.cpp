@@ -0,0 +1,547 @@
+//-----------------------------------------------------------------------
+//                       github.com/samisalreadytaken/sqdbg
+//-----------------------------------------------------------------------
+//
+// Replays a session written by sqdbg_record() against a test VM and prints
+// request latencies of the recording and of the replay. Linux and macOS only
+//
+//   c++ -O2 -pthread -Iinclude -I<squirrel>/include -I<squirrel>/squirrel tools/sqdbgreplay.cpp <squirrel libs>
+//   sqdbgreplay [-r] [-p port] [-s sourcename] session [script.nut]
+//
+// Client messages are sent in their recorded order, each request waiting for
+// its response. Where the debugger had sent a stopped event, the replay waits
+// for the test VM to stop as well. -r also keeps the recorded delays.
+//
+// The script should reproduce the state the session was recorded in. It is
+// compiled with sourcename so that recorded breakpoints apply, and can call
+// sqdbgreplay_frame() to process requests while it is running. Without a
+// script, a loop breaks once for each recorded stop.
+//
+
+#include <pthread.h>
+
+#include "../sqdbg/server.cpp"
+#include "dapclient.h"
+
+#define RECORD_HEADER_SIZE 14
+#define RECORD_ENTRY_SIZE 13
+
+// Longest wait for a response or a stop
+#define REPLAY_TIMEOUT 10000
+
+static int g_nPort = 2298;
+static bool g_bRealTime = false;
+static const char *g_pszSourceName = "sqdbgreplay.nut";
+
+static bool g_bRunScript = false;
+static bool g_bClientDone = false;
+
+static HSQDEBUGSERVER g_pDebugger = NULL;
+
+static const SQChar g_szDefaultScript[] = _SC(
+	"for ( local i = 0; i < STOPS; i++ )\n"
+	"{\n"
+	"	sqdbg_break();\n"
+	"	i = i;\n"
+	"}\n"
+);
+
+struct record_t
+{
+	int direction;
+	long long time; // us
+	char *ptr;
+	int len;
+};
+
+static record_t *g_Records = NULL;
+static int g_nRecords = 0;
+static int g_nStops = 0;
+
+static unsigned long long ReadLE( const unsigned char *&ptr, int bytes )
+{
+	unsigned long long val = 0;
+
+	for ( int i = 0; i < bytes; i++ )
+		val |= (unsigned long long)*ptr++ << ( i * 8 );
+
+	return val;
+}
+
+// Sample sets
+#define RECORDED 0
+#define REPLAYED 1
+
+//
+// Session file
+//
+static CScratch< true > g_Scratch;
+
+// Parses a copy of the message, the original is sent as is
+static bool ParseRecord( const record_t &record, json_table_t *table, char **copy )
+{
+	*copy = (char*)realloc( *copy, record.len );
+	memcpy( *copy, record.ptr, record.len );
+
+	g_Scratch.Free();
+	JSONParser parser( &g_Scratch, *copy, record.len, table );
+	return !parser.GetError();
+}
+
+static bool ReadSession( const char *path )
+{
+	FILE *file = fopen( path, "rb" );
+
+	if ( !file )
+	{
+		fprintf( stderr, "could not open '%s'\n", path );
+		return false;
+	}
+
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+
+	unsigned char *buf = (unsigned char*)malloc( size > 0 ? size : 1 );
+	bool ok = ( size >= RECORD_HEADER_SIZE && fread( buf, size, 1, file ) == 1 );
+	fclose( file );
+
+	const unsigned char *ptr = buf;
+	const unsigned char *end = buf + size;
+
+	if ( !ok || memcmp( ptr, "SQDR", 4 ) != 0 )
+	{
+		fprintf( stderr, "'%s' is not a session recording\n", path );
+		free( buf );
+		return false;
+	}
+
+	ptr += 4;
+
+	unsigned int version = (unsigned int)ReadLE( ptr, 2 );
+
+	if ( version != SQDBG_RECORD_VERSION )
+	{
+		fprintf( stderr, "'%s' has unsupported version %u\n", path, version );
+		free( buf );
+		return false;
+	}
+
+	ReadLE( ptr, 8 ); // start time
+
+	while ( end - ptr >= RECORD_ENTRY_SIZE )
+	{
+		record_t record;
+		record.direction = (int)ReadLE( ptr, 1 );
+		record.time = (long long)ReadLE( ptr, 8 );
+		record.len = (int)ReadLE( ptr, 4 );
+
+		if ( record.len <= 0 || end - ptr < record.len )
+			break;
+
+		record.ptr = (char*)malloc( record.len );
+		memcpy( record.ptr, ptr, record.len );
+		ptr += record.len;
+
+		g_Records = (record_t*)realloc( g_Records, ( g_nRecords + 1 ) * sizeof(record_t) );
+		g_Records[ g_nRecords++ ] = record;
+	}
+
+	// Partially written files are replayed up to the truncation
+	if ( ptr != end )
+		fprintf( stderr, "'%s' is truncated\n", path );
+
+	free( buf );
+
+	// Recorded latencies and stop count
+	struct pending_t { int seq; long long time; stat_t *stat; };
+	pending_t pending[256];
+	int nPending = 0;
+	char *copy = NULL;
+
+	for ( int i = 0; i < g_nRecords; i++ )
+	{
+		const record_t &record = g_Records[i];
+		json_table_t table;
+
+		if ( !ParseRecord( record, &table, &copy ) )
+			continue;
+
+		string_t type;
+		table.GetString( "type", &type );
+
+		if ( record.direction == SQDBG_RECORD_INBOUND && type.IsEqualTo( "request" ) )
+		{
+			string_t command;
+			int seq;
+
+			if ( table.GetString( "command", &command ) && table.GetInt( "seq", &seq ) &&
+					nPending < (int)_ArraySize(pending) )
+			{
+				pending[ nPending ].seq = seq;
+				pending[ nPending ].time = record.time;
+				pending[ nPending ].stat = GetStat( command.ptr, command.len );
+				nPending++;
+			}
+		}
+		else if ( record.direction == SQDBG_RECORD_OUTBOUND && type.IsEqualTo( "response" ) )
+		{
+			int seq;
+
+			if ( !table.GetInt( "request_seq", &seq ) )
+				continue;
+
+			for ( int j = 0; j < nPending; j++ )
+			{
+				if ( pending[j].seq == seq )
+				{
+					AddSample( pending[j].stat, RECORDED, ( record.time - pending[j].time ) * 1000 );
+
+					pending[j] = pending[ --nPending ];
+					break;
+				}
+			}
+		}
+		else if ( record.direction == SQDBG_RECORD_OUTBOUND && type.IsEqualTo( "event" ) )
+		{
+			string_t event;
+			table.GetString( "event", &event );
+
+			if ( event.IsEqualTo( "stopped" ) )
+				g_nStops++;
+		}
+	}
+
+	free( copy );
+
+	return true;
+}
+
+//
+// Client
+//
+static int g_nStopsReceived = 0;
+static int g_nStopsMissed = 0;
+
+// Stops that arrive early are counted and consumed by the next wait
+static bool IsStoppedEvent( const json_table_t &table )
+{
+	string_t type, event;
+	table.GetString( "type", &type );
+	table.GetString( "event", &event );
+
+	return type.IsEqualTo( "event" ) && event.IsEqualTo( "stopped" );
+}
+
+// Returns false on disconnection
+static bool WaitResponse( int seq, stat_t *stat, long long start )
+{
+	json_table_t table;
+
+	for (;;)
+	{
+		int ret = ClientRecv( &table, REPLAY_TIMEOUT );
+
+		if ( ret == 0 )
+		{
+			if ( stat )
+				stat->missing++;
+
+			return true;
+		}
+
+		if ( ret < 0 )
+			return false;
+
+		if ( IsStoppedEvent( table ) )
+		{
+			g_nStopsReceived++;
+			continue;
+		}
+
+		string_t type;
+		int request_seq;
+		table.GetString( "type", &type );
+
+		if ( type.IsEqualTo( "response" ) &&
+				table.GetInt( "request_seq", &request_seq ) &&
+				request_seq == seq )
+		{
+			if ( stat )
+				AddSample( stat, REPLAYED, NowNs() - start );
+
+			return true;
+		}
+	}
+}
+
+static bool WaitStop()
+{
+	json_table_t table;
+
+	while ( !g_nStopsReceived )
+	{
+		int ret = ClientRecv( &table, REPLAY_TIMEOUT );
+
+		if ( ret == 0 )
+		{
+			g_nStopsMissed++;
+			return true;
+		}
+
+		if ( ret < 0 )
+			return false;
+
+		if ( IsStoppedEvent( table ) )
+			g_nStopsReceived++;
+	}
+
+	g_nStopsReceived--;
+	return true;
+}
+
+static void *ClientThread( void * )
+{
+	ClientConnect( g_nPort );
+
+	long long start = NowNs();
+	char *copy = NULL;
+	int requests = 0;
+	int i = 0;
+
+	for ( ; i < g_nRecords; i++ )
+	{
+		const record_t &record = g_Records[i];
+		json_table_t table;
+
+		if ( !ParseRecord( record, &table, &copy ) )
+			continue;
+
+		string_t type;
+		table.GetString( "type", &type );
+
+		if ( record.direction == SQDBG_RECORD_OUTBOUND )
+		{
+			if ( IsStoppedEvent( table ) )
+			{
+				Store( &g_bRunScript );
+
+				if ( !WaitStop() )
+					break;
+			}
+
+			continue;
+		}
+
+		if ( g_bRealTime )
+		{
+			long long wait = record.time * 1000 - ( NowNs() - start );
+
+			if ( wait > 0 )
+				usleep( (useconds_t)( wait / 1000 ) );
+		}
+
+		long long sent = NowNs();
+		ClientSend( record.ptr, record.len );
+
+		string_t command;
+		int seq;
+
+		// Responses to reverse requests are not waited on
+		if ( type.IsEqualTo( "request" ) &&
+				table.GetString( "command", &command ) &&
+				table.GetInt( "seq", &seq ) )
+		{
+			requests++;
+
+			if ( !WaitResponse( seq, GetStat( command.ptr, command.len ), sent ) )
+				break;
+
+			if ( command.IsEqualTo( "disconnect" ) || command.IsEqualTo( "terminate" ) )
+			{
+				i++;
+				break;
+			}
+		}
+	}
+
+	free( copy );
+
+	double sec = (double)( NowNs() - start ) / 1.e9;
+	printf( "%d of %d records, %d requests in %.2f s, %d stops missed\n",
+			i, g_nRecords, requests, sec, g_nStopsMissed );
+
+	ClientClose();
+	Store( &g_bRunScript );
+	Store( &g_bClientDone );
+	return NULL;
+}
+
+//
+// Host
+//
+static SQInteger ScriptFrame( HSQUIRRELVM )
+{
+	sqdbg_frame( g_pDebugger );
+	return 0;
+}
+
+static SQChar *ReadScript( const char *path, SQInteger *len )
+{
+	FILE *file = fopen( path, "rb" );
+
+	if ( !file )
+	{
+		fprintf( stderr, "could not open '%s'\n", path );
+		return NULL;
+	}
+
+	fseek( file, 0, SEEK_END );
+	long size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+
+	char *buf = (char*)malloc( size + 1 );
+
+	if ( size < 0 || ( size && fread( buf, size, 1, file ) != 1 ) )
+	{
+		fprintf( stderr, "could not read '%s'\n", path );
+		fclose( file );
+		free( buf );
+		return NULL;
+	}
+
+	fclose( file );
+	buf[size] = 0;
+
+#ifdef SQUNICODE
+	SQChar *script = (SQChar*)malloc( ( size + 1 ) * sizeof(SQChar) );
+	*len = (SQInteger)mbstowcs( script, buf, size + 1 );
+	free( buf );
+
+	if ( *len < 0 )
+	{
+		fprintf( stderr, "'%s' is not valid text\n", path );
+		free( script );
+		return NULL;
+	}
+
+	return script;
+#else
+	*len = size;
+	return buf;
+#endif
+}
+
+static bool RunHost( const char *scriptPath )
+{
+	SQInteger len;
+	SQChar *script;
+
+	if ( scriptPath )
+	{
+		script = ReadScript( scriptPath, &len );
+
+		if ( !script )
+			return false;
+	}
+	else
+	{
+		len = sizeof(g_szDefaultScript) / sizeof(SQChar) - 1;
+		script = (SQChar*)malloc( sizeof(g_szDefaultScript) );
+		memcpy( script, g_szDefaultScript, sizeof(g_szDefaultScript) );
+	}
+
+	SQChar sourcename[256];
+	int sourcenamelen = 0;
+
+	for ( ; g_pszSourceName[ sourcenamelen ] && sourcenamelen < (int)_ArraySize(sourcename) - 1; sourcenamelen++ )
+		sourcename[ sourcenamelen ] = (SQChar)(unsigned char)g_pszSourceName[ sourcenamelen ];
+
+	sourcename[ sourcenamelen ] = 0;
+
+	HSQUIRRELVM vm = HostOpen( g_nPort, &g_pDebugger );
+
+	HostSetConst( vm, _SC("STOPS"), g_nStops );
+
+	sq_pushroottable( vm );
+	sq_pushstring( vm, _SC("sqdbgreplay_frame"), -1 );
+	sq_newclosure( vm, ScriptFrame, 0 );
+	sq_newslot( vm, -3, SQFalse );
+	sq_pop( vm, 1 );
+
+	pthread_t thread;
+	pthread_create( &thread, NULL, ClientThread, NULL );
+
+	// Client messages before the first stop are processed here
+	HostFrameUntil( g_pDebugger, &g_bRunScript );
+
+	HostRun( vm, g_pDebugger, script, len, sourcename, sourcenamelen );
+	free( script );
+
+	HostFrameUntil( g_pDebugger, &g_bClientDone );
+
+	pthread_join( thread, NULL );
+
+	HostClose( vm );
+
+	return true;
+}
+
+int main( int argc, char **argv )
+{
+	const char *session = NULL;
+	const char *script = NULL;
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( !strcmp( argv[i], "-r" ) )
+		{
+			g_bRealTime = true;
+		}
+		else if ( !strcmp( argv[i], "-p" ) && i + 1 < argc )
+		{
+			g_nPort = atoi( argv[++i] );
+		}
+		else if ( !strcmp( argv[i], "-s" ) && i + 1 < argc )
+		{
+			g_pszSourceName = argv[++i];
+		}
+		else if ( argv[i][0] != '-' && !session )
+		{
+			session = argv[i];
+		}
+		else if ( argv[i][0] != '-' && !script )
+		{
+			script = argv[i];
+		}
+		else
+		{
+			session = NULL;
+			break;
+		}
+	}
+
+	if ( !session )
+	{
+		fprintf( stderr, "usage: %s [-r] [-p port] [-s sourcename] session [script.nut]\n", argv[0] );
+		return 1;
+	}
+
+	if ( !ReadSession( session ) )
+		return 1;
+
+	printf( "%d records, %d stops\n", g_nRecords, g_nStops );
+
+	if ( !RunHost( script ) )
+		return 1;
+
+	const char *labels[] = { "recorded", "replayed" };
+	PrintStats( 2, labels );
+
+	for ( int i = 0; i < g_nRecords; i++ )
+		free( g_Records[i].ptr );
+
+	free( g_Records );
+
+	return 0;
+}
@@ -0,0 +1,211 @@
+//-----------------------------------------------------------------------
+//                       github.com/samisalreadytaken/sqdbg
+//-----------------------------------------------------------------------
+//
+// Bridges a debugger listening with sqdbg_listen_shm() to DAP clients
+// connecting over TCP on the loopback interface. Linux only
+//
+//   sqdbgshm name [port]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../sqdbg/shm.h"
+
+static shmheader_t *g_pShm = NULL;
+static int g_Client = -1;
+static bool g_bClientClosed = false;
+
+static bool IsClientClosed()
+{
+	return __atomic_load_n( &g_bClientClosed, __ATOMIC_ACQUIRE );
+}
+
+static shmheader_t *Attach( const char *name )
+{
+	shmheader_t *shm = ShmMap( name, false );
+
+	if ( !shm )
+		return NULL;
+
+	if ( shm->magic != SQDBG_SHM_MAGIC ||
+			shm->version != SQDBG_SHM_VERSION ||
+			shm->ringsize != SQDBG_SHM_RING_SIZE )
+	{
+		fprintf( stderr, "'%s' is not a compatible debugger\n", name );
+		ShmUnmap( shm );
+		return NULL;
+	}
+
+	// Let the debugger finish the previous session
+	for ( int i = 0; i < 1000 && __atomic_load_n( &shm->connected, __ATOMIC_ACQUIRE ); i++ )
+		usleep( 1000 );
+
+	ShmRingReset( &shm->toServer );
+	ShmRingReset( &shm->toClient );
+
+	shm->serial++;
+	__atomic_store_n( &shm->state, 1, __ATOMIC_RELEASE );
+
+	return shm;
+}
+
+static void Detach( shmheader_t *shm )
+{
+	__atomic_store_n( &shm->state, 0, __ATOMIC_RELEASE );
+
+	// Debugger acknowledges on its next frame
+	for ( int i = 0; i < 1000 && __atomic_load_n( &shm->connected, __ATOMIC_ACQUIRE ); i++ )
+		usleep( 1000 );
+
+	ShmUnmap( shm );
+}
+
+// Client to debugger, the debugger reads once per frame
+static void *ClientReadThread( void * )
+{
+	static char buf[ 64 * 1024 ];
+
+	for (;;)
+	{
+		ssize_t len = recv( g_Client, buf, sizeof(buf), 0 );
+
+		if ( len <= 0 )
+			break;
+
+		for ( ssize_t offset = 0; offset < len; )
+		{
+			if ( __atomic_load_n( &g_pShm->state, __ATOMIC_ACQUIRE ) != 1 )
+				goto done;
+
+			unsigned int written = ShmRingWrite( &g_pShm->toServer, buf + offset, len - offset );
+
+			if ( !written )
+				usleep( 1000 );
+
+			offset += written;
+		}
+	}
+
+done:
+	__atomic_store_n( &g_bClientClosed, true, __ATOMIC_RELEASE );
+	return NULL;
+}
+
+// Debugger to client
+static void Bridge()
+{
+	static char buf[ 64 * 1024 ];
+	bool connected = false;
+
+	for (;;)
+	{
+		unsigned int len = ShmRingRead( &g_pShm->toClient, buf, sizeof(buf) );
+
+		if ( len )
+		{
+			for ( unsigned int offset = 0; offset < len; )
+			{
+				ssize_t sent = send( g_Client, buf + offset, len - offset, MSG_NOSIGNAL );
+
+				if ( sent <= 0 )
+					return;
+
+				offset += sent;
+			}
+
+			continue;
+		}
+
+		if ( IsClientClosed() )
+			return;
+
+		// Disconnected by the debugger
+		if ( __atomic_load_n( &g_pShm->connected, __ATOMIC_ACQUIRE ) )
+		{
+			connected = true;
+		}
+		else if ( connected )
+		{
+			return;
+		}
+
+		ShmRingWait( &g_pShm->toClient, 100 );
+	}
+}
+
+int main( int argc, char **argv )
+{
+	if ( argc < 2 || argv[1][0] != '/' )
+	{
+		fprintf( stderr, "usage: %s /name [port]\n", argv[0] );
+		return 1;
+	}
+
+	const char *name = argv[1];
+	int port = argc > 2 ? atoi( argv[2] ) : 2222;
+
+	int server = socket( AF_INET, SOCK_STREAM, 0 );
+	int opt = 1;
+	setsockopt( server, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt) );
+
+	sockaddr_in addr;
+	memset( &addr, 0, sizeof(addr) );
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons( port );
+	addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+	if ( server == -1 ||
+			bind( server, (sockaddr*)&addr, sizeof(addr) ) == -1 ||
+			listen( server, 1 ) == -1 )
+	{
+		fprintf( stderr, "could not listen on port %d: %s\n", port, strerror(errno) );
+		return 1;
+	}
+
+	printf( "listening on port %d\n", port );
+
+	for (;;)
+	{
+		g_Client = accept( server, NULL, NULL );
+
+		if ( g_Client == -1 )
+			continue;
+
+		setsockopt( g_Client, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt) );
+
+		while ( ( g_pShm = Attach( name ) ) == NULL )
+		{
+			fprintf( stderr, "waiting for '%s'\n", name );
+			sleep( 1 );
+		}
+
+		printf( "client connected\n" );
+
+		g_bClientClosed = false;
+
+		pthread_t thread;
+		pthread_create( &thread, NULL, ClientReadThread, NULL );
+
+		Bridge();
+
+		__atomic_store_n( &g_pShm->state, 0, __ATOMIC_RELEASE );
+		shutdown( g_Client, SHUT_RDWR );
+		pthread_join( thread, NULL );
+		close( g_Client );
+
+		Detach( g_pShm );
+
+		printf( "client disconnected\n" );
+	}
+
+	return 0;
+}